@@ -0,0 +1,7 @@
+# Performance benchmarks of the compiler. See src/benchmarks.rs
+# Pass a benchmark name to only run that one, for example: ./benchmark.sh bench_solve_latencies
+# Runs everything twice, to show the cost of the span-history feature
+echo "With span-history:"
+cargo test --release --no-default-features --features span-history benchmarks::${1:-} -- --ignored --nocapture --test-threads 1
+echo "Without span-history:"
+cargo test --release --no-default-features benchmarks::${1:-} -- --ignored --nocapture --test-threads 1
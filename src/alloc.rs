@@ -1,9 +1,11 @@
 use std::{
+    cell::{Cell, RefCell},
     cmp::Ordering,
     fmt::{Debug, Formatter, Result},
     hash::{Hash, Hasher},
     iter::Enumerate,
     marker::PhantomData,
+    mem::MaybeUninit,
     ops::{Index, IndexMut},
 };
 
@@ -248,6 +250,16 @@ pub struct ArenaAllocator<T, IndexMarker> {
     _ph: PhantomData<IndexMarker>,
 }
 
+impl<T: Clone, IndexMarker> Clone for ArenaAllocator<T, IndexMarker> {
+    fn clone(&self) -> Self {
+        Self {
+            data: self.data.clone(),
+            free_slots: self.free_slots.clone(),
+            _ph: PhantomData,
+        }
+    }
+}
+
 impl<T, IndexMarker> ArenaAllocator<T, IndexMarker> {
     pub fn new() -> Self {
         Self {
@@ -300,6 +312,10 @@ impl<T, IndexMarker> ArenaAllocator<T, IndexMarker> {
         self.data.clear();
         self.free_slots.clear();
     }
+    /// None if `uuid` was freed
+    pub fn get(&self, UUID(uuid, _): UUID<IndexMarker>) -> Option<&T> {
+        self.data.get(uuid)?.as_ref()
+    }
     pub fn is_empty(&self) -> bool {
         self.data.len() == self.free_slots.len()
     }
@@ -556,6 +572,14 @@ impl<T, IndexMarker> FlatAlloc<T, IndexMarker> {
     pub fn clear(&mut self) {
         self.data.clear();
     }
+    /// For tables that are done growing, and will be kept around for a while
+    pub fn shrink_to_fit(&mut self) {
+        self.data.shrink_to_fit();
+    }
+    /// Bytes allocated for the elements themselves, not counting what they point to
+    pub fn allocated_bytes(&self) -> usize {
+        self.data.capacity() * std::mem::size_of::<T>()
+    }
     pub fn iter(&self) -> FlatAllocIter<'_, T, IndexMarker> {
         self.into_iter()
     }
@@ -830,3 +854,130 @@ pub fn zip_eq3<IDMarker, OA, OB, OC>(
         iter_c: iter_c.into_iter(),
     }
 }
+
+/// Words per chunk of a [ScratchArena]. Larger tables get a chunk of their own
+const SCRATCH_CHUNK_WORDS: usize = 4096;
+
+/// Bump allocator for tables that only live during one step of the compiler, like the latency counting of an instance.
+///
+/// Allocating is a pointer bump, and everything is freed at once when the arena is dropped.
+/// Only holds [Copy] types, so nothing has to be dropped individually
+pub struct ScratchArena {
+    /// Leaked [Box]es, only turned back into them when the arena is dropped, such that handed out tables stay valid
+    chunks: RefCell<Vec<(*mut MaybeUninit<u64>, usize)>>,
+    used_in_last_chunk: Cell<usize>,
+}
+
+impl Default for ScratchArena {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl ScratchArena {
+    pub fn new() -> Self {
+        Self {
+            chunks: RefCell::new(Vec::new()),
+            used_in_last_chunk: Cell::new(0),
+        }
+    }
+
+    pub fn alloc_table<T: Copy, IndexMarker>(
+        &self,
+        len: usize,
+        value: T,
+    ) -> ScratchTable<'_, T, IndexMarker> {
+        ScratchTable {
+            data: self.alloc_slice(len, value),
+            _ph: PhantomData,
+        }
+    }
+
+    /// Every call hands out a different part of the arena, so the mutable slices never alias
+    #[allow(clippy::mut_from_ref)]
+    pub fn alloc_slice<T: Copy>(&self, len: usize, value: T) -> &mut [T] {
+        assert!(std::mem::align_of::<T>() <= std::mem::align_of::<u64>());
+        let words = (len * std::mem::size_of::<T>()).div_ceil(std::mem::size_of::<u64>());
+        let mut chunks = self.chunks.borrow_mut();
+        let fits_in_last_chunk = chunks
+            .last()
+            .is_some_and(|(_, chunk_len)| chunk_len - self.used_in_last_chunk.get() >= words);
+        if !fits_in_last_chunk {
+            let chunk_len = words.max(SCRATCH_CHUNK_WORDS);
+            let chunk: Box<[MaybeUninit<u64>]> = std::iter::repeat_with(MaybeUninit::uninit)
+                .take(chunk_len)
+                .collect();
+            chunks.push((Box::into_raw(chunk) as *mut MaybeUninit<u64>, chunk_len));
+            self.used_in_last_chunk.set(0);
+        }
+        let (chunk, _) = *chunks.last().unwrap();
+        let start = self.used_in_last_chunk.get();
+        self.used_in_last_chunk.set(start + words);
+        // SAFETY: Words start..start + words of the chunk are handed out only this once, and the chunk isn't freed until the arena is dropped,
+        // which the returned lifetime can't outlive. The chunk's words are aligned for T, and large enough to hold len of them
+        unsafe {
+            let data = chunk.add(start) as *mut T;
+            for idx in 0..len {
+                data.add(idx).write(value);
+            }
+            std::slice::from_raw_parts_mut(data, len)
+        }
+    }
+}
+
+impl Drop for ScratchArena {
+    fn drop(&mut self) {
+        for (chunk, chunk_len) in self.chunks.get_mut().drain(..) {
+            // SAFETY: Every chunk came from [Box::into_raw] in [ScratchArena::alloc_slice]
+            drop(unsafe { Box::from_raw(std::ptr::slice_from_raw_parts_mut(chunk, chunk_len)) });
+        }
+    }
+}
+
+/// Like [FlatAlloc], but of fixed size, and backed by a [ScratchArena]
+pub struct ScratchTable<'a, T, IndexMarker> {
+    data: &'a mut [T],
+    _ph: PhantomData<IndexMarker>,
+}
+
+impl<T, IndexMarker> ScratchTable<'_, T, IndexMarker> {
+    pub fn len(&self) -> usize {
+        self.data.len()
+    }
+    pub fn is_empty(&self) -> bool {
+        self.data.is_empty()
+    }
+}
+
+impl<T, IndexMarker> Index<UUID<IndexMarker>> for ScratchTable<'_, T, IndexMarker> {
+    type Output = T;
+
+    fn index(&self, UUID(uuid, _): UUID<IndexMarker>) -> &Self::Output {
+        &self.data[uuid]
+    }
+}
+
+impl<T, IndexMarker> IndexMut<UUID<IndexMarker>> for ScratchTable<'_, T, IndexMarker> {
+    fn index_mut(&mut self, UUID(uuid, _): UUID<IndexMarker>) -> &mut Self::Output {
+        &mut self.data[uuid]
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn scratch_tables_dont_overlap() {
+        let arena = ScratchArena::new();
+        let small = arena.alloc_slice(3, 1u8);
+        let large = arena.alloc_slice(SCRATCH_CHUNK_WORDS * 2, 2u64);
+        let after = arena.alloc_slice(5, 3u32);
+        small[2] = 10;
+        large[SCRATCH_CHUNK_WORDS * 2 - 1] = 20;
+        after[0] = 30;
+        assert_eq!(small, &[1, 1, 10]);
+        assert!(large[..SCRATCH_CHUNK_WORDS * 2 - 1].iter().all(|v| *v == 2));
+        assert_eq!(after, &[30, 3, 3, 3, 3]);
+    }
+}
@@ -0,0 +1,267 @@
+//! Performance benchmarks of the compiler pipeline and of its hot algorithms.
+//!
+//! These are `#[ignore]`d tests, such that they don't slow down the regular test suite. Run them with `./benchmark.sh`,
+//! or `cargo test --release benchmarks -- --ignored --nocapture --test-threads 1`.
+//!
+//! The pipeline benchmarks run [Linker::add_file], [Linker::recompile_all] and [CodeGenBackend::codegen] on generated stress designs.
+//! Every benchmark prints its fastest run. The micro-benchmarks also run on an input [SCALING_FACTOR] times bigger, and print how much slower that was.
+//! A ratio far above [SCALING_FACTOR] points at an accidentally quadratic algorithm. It is printed rather than checked, as timings on shared machines are too noisy to fail on.
+
+use std::fmt::Write;
+use std::hint::black_box;
+use std::time::{Duration, Instant};
+
+use crate::codegen::{CodeGenBackend, VerilogCodegenBackend};
+use crate::errors::ErrorLevel;
+use crate::instantiation::latency_algorithm::{
+    convert_fanin_to_fanout, solve_latencies, FanInOut, SpecifiedLatency,
+};
+use crate::instantiation::list_of_lists::ListOfLists;
+use crate::prelude::*;
+use crate::typing::abstract_type::{AbstractType, INT_TYPE};
+use crate::typing::type_inference::{TypeSubstitutor, TypeVariableIDMarker};
+
+const REPETITIONS: usize = 3;
+/// [bench_scaling] measures once at the given size, and once at this many times the size
+const SCALING_FACTOR: usize = 8;
+
+/// Returns the fastest of [REPETITIONS] runs
+fn bench<R>(name: &str, mut f: impl FnMut() -> R) -> Duration {
+    let mut fastest = Duration::MAX;
+    for _ in 0..REPETITIONS {
+        let start = Instant::now();
+        black_box(f());
+        fastest = fastest.min(start.elapsed());
+    }
+    println!(
+        "bench {name:<48} {:>12.3} ms",
+        fastest.as_secs_f64() * 1000.0
+    );
+    fastest
+}
+
+/// Runs `f` for `size` and for `size * SCALING_FACTOR`, and reports how much slower the bigger input was.
+///
+/// Timings on shared CI machines vary too much to fail on. A ratio far above [SCALING_FACTOR] points at worse than linear scaling
+fn bench_scaling<R>(name: &str, size: usize, mut f: impl FnMut(usize) -> R) {
+    let small = bench(&format!("{name} (n={size})"), || f(size));
+    let big_size = size * SCALING_FACTOR;
+    let big = bench(&format!("{name} (n={big_size})"), || f(big_size));
+    let ratio = big.as_secs_f64() / small.as_secs_f64().max(1e-6);
+    println!("bench {name:<48} {ratio:>12.1} x slower for {SCALING_FACTOR}x the input");
+}
+
+/// Generated SUS code for stressing specific parts of the compiler
+mod stress_designs {
+    use super::*;
+
+    /// `depth` modules, each of which instantiates the one below it twice
+    pub fn deep_hierarchy(depth: usize) -> String {
+        let mut code = String::new();
+        writeln!(code, "module level_0 {{").unwrap();
+        writeln!(code, "    interface level_0 : int a -> int o").unwrap();
+        writeln!(code, "    reg o = a + 1").unwrap();
+        writeln!(code, "}}").unwrap();
+        for level in 1..depth {
+            let below = level - 1;
+            writeln!(code, "module level_{level} {{").unwrap();
+            writeln!(code, "    interface level_{level} : int a -> int o").unwrap();
+            writeln!(code, "    int x = level_{below}(a)").unwrap();
+            writeln!(code, "    int y = level_{below}(x)").unwrap();
+            writeln!(code, "    o = x + y").unwrap();
+            writeln!(code, "}}").unwrap();
+        }
+        code
+    }
+
+    pub fn wide_array(width: usize) -> String {
+        format!(
+            "module wide_array {{
+    interface wide_array : int[{width}] values -> int[{width}] added_values
+
+    for int i in 0..{width} {{
+        int t = values[i]
+        added_values[i] = t + i
+    }}
+}}
+"
+        )
+    }
+
+    pub fn generator_loop(iterations: usize) -> String {
+        format!(
+            "module generator_loop {{
+    interface generator_loop : int v -> int o
+
+    gen int[{iterations}] lut
+    for int i in 0..{iterations} {{
+        gen int x = i * 7
+        lut[i] = x % 13
+    }}
+
+    gen int[{iterations}] shifted_lut
+    for int i in 0..{iterations} {{
+        shifted_lut[i] = lut[i] + 1
+    }}
+
+    o = shifted_lut[v]
+}}
+"
+        )
+    }
+
+    /// A single module with `num_wires` wires, each depending on the previous two, with registers in between
+    pub fn latency_graph(num_wires: usize) -> String {
+        let mut code = String::new();
+        writeln!(code, "module latency_graph {{").unwrap();
+        writeln!(code, "    interface latency_graph : int a -> int o").unwrap();
+        writeln!(code, "    int w_0 = a").unwrap();
+        writeln!(code, "    int w_1 = a").unwrap();
+        for i in 2..num_wires {
+            let reg = if i % 3 == 0 { "reg " } else { "" };
+            writeln!(code, "    {reg}int w_{i} = w_{} + w_{}", i - 1, i - 2).unwrap();
+        }
+        writeln!(code, "    o = w_{}", num_wires - 1).unwrap();
+        writeln!(code, "}}").unwrap();
+        code
+    }
+}
+
+/// Runs the whole pipeline on the given source code, and returns the length of the generated code
+fn compile_and_codegen(file_name: &str, code: &str) -> usize {
+    let mut linker = Linker::new();
+    linker.add_standard_library(&mut (), true);
+    linker.add_file(file_name.to_owned(), code.to_owned(), &mut ());
+    linker.recompile_all();
+
+    let mut errors = String::new();
+    for (file_uuid, _file) in &linker.files {
+        linker.for_all_errors_in_file(file_uuid, |err| {
+            if err.level == ErrorLevel::Error {
+                writeln!(errors, "{}", err.reason).unwrap();
+            }
+        });
+    }
+    assert!(errors.is_empty(), "{file_name} has errors:\n{errors}");
+
+    let mut generated_len = 0;
+    for (_id, md) in &linker.modules {
+        md.instantiations.for_each_instance(|_template_args, inst| {
+            generated_len += VerilogCodegenBackend.codegen(md, inst, &linker, true).len();
+        });
+    }
+    generated_len
+}
+
+#[test]
+#[ignore]
+fn bench_pipeline_deep_hierarchy() {
+    let code = stress_designs::deep_hierarchy(300);
+    bench("pipeline: deep hierarchy (300 levels)", || {
+        compile_and_codegen("deep_hierarchy.sus", &code)
+    });
+}
+
+#[test]
+#[ignore]
+fn bench_pipeline_wide_array() {
+    let code = stress_designs::wide_array(8192);
+    bench("pipeline: wide array (8192 elements)", || {
+        compile_and_codegen("wide_array.sus", &code)
+    });
+}
+
+#[test]
+#[ignore]
+fn bench_pipeline_generator_loop() {
+    let code = stress_designs::generator_loop(20000);
+    bench("pipeline: generator loop (20000 iterations)", || {
+        compile_and_codegen("generator_loop.sus", &code)
+    });
+}
+
+#[test]
+#[ignore]
+fn bench_pipeline_latency_graph() {
+    let code = stress_designs::latency_graph(5000);
+    bench("pipeline: latency graph (5000 wires)", || {
+        compile_and_codegen("latency_graph.sus", &code)
+    });
+}
+
+/// Node `i` depends on nodes `i-1` and `i-2`, like [stress_designs::latency_graph]
+fn ladder_fanins(num_nodes: usize) -> ListOfLists<FanInOut> {
+    let edges = (1..num_nodes).flat_map(|to| {
+        let from_prev = (
+            to,
+            FanInOut {
+                other: to - 1,
+                delta_latency: (to % 3 == 0) as i64,
+            },
+        );
+        let from_prev_prev = (to >= 2).then(|| {
+            (
+                to,
+                FanInOut {
+                    other: to - 2,
+                    delta_latency: 0,
+                },
+            )
+        });
+        std::iter::once(from_prev).chain(from_prev_prev)
+    });
+    ListOfLists::from_random_access_iterator(num_nodes, edges)
+}
+
+#[test]
+#[ignore]
+fn bench_solve_latencies() {
+    bench_scaling("solve_latencies: ladder", 20000, |num_nodes| {
+        let fanins = ladder_fanins(num_nodes);
+        let fanouts = convert_fanin_to_fanout(&fanins);
+        let specified = vec![SpecifiedLatency {
+            wire: 0,
+            latency: 0,
+        }];
+        solve_latencies(&fanins, &fanouts, &[0], &[num_nodes - 1], specified).unwrap()
+    });
+}
+
+#[test]
+#[ignore]
+fn bench_list_of_lists_construction() {
+    bench_scaling(
+        "ListOfLists::from_random_access_iterator",
+        200000,
+        |num_nodes| ladder_fanins(num_nodes),
+    );
+    bench_scaling("ListOfLists::from_iter", 200000, |num_groups| {
+        (0..num_groups)
+            .map(|group| 0..group % 5)
+            .collect::<ListOfLists<usize>>()
+    });
+}
+
+#[test]
+#[ignore]
+fn bench_type_substitutor_unification() {
+    const CHAIN_LENGTH: usize = 32;
+    // Chains of type variables that are only resolved at the end, the typical shape when typechecking long expressions
+    bench_scaling("TypeSubstitutor: variable chains", 2000, |num_chains| {
+        let substitutor: TypeSubstitutor<AbstractType, TypeVariableIDMarker> =
+            TypeSubstitutor::new();
+        for _ in 0..num_chains {
+            let chain: Vec<AbstractType> = (0..CHAIN_LENGTH)
+                .map(|_| AbstractType::Unknown(substitutor.alloc()))
+                .collect();
+            for pair in chain.windows(2) {
+                substitutor.unify_must_succeed(&pair[0], &pair[1]);
+            }
+            let array_of_int = AbstractType::Array(Box::new(INT_TYPE));
+            for var in &chain {
+                substitutor.unify_must_succeed(var, &array_of_int);
+            }
+        }
+        substitutor
+    });
+}
@@ -0,0 +1,364 @@
+//! Optional on-disk cache of generated code. See [crate::config::ConfigStruct::cache_dir]
+//!
+//! Two kinds of entries are stored:
+//! - The generated code of an instance, keyed by [instance_key].
+//! - For a root module, the keys of all instances in its hierarchy. If all of those are still present,
+//!   the root isn't instantiated at all, and its code is copied from the cache. See [CachedHierarchies::load]
+//!
+//! Keys are hashed from everything that can influence the generated code, all of which is known before instantiating:
+//! The cache format, the compiler version, the backend, the instance name (which includes all template arguments),
+//! and the source code of the module and of every global it transitively depends on.
+//!
+//! Once the cache outgrows [MAX_CACHE_BYTES], the entries that were used least recently are removed, see [evict_least_recently_used]
+
+use std::{
+    collections::{HashMap, HashSet},
+    fmt::Write as _,
+    fs::{self, File},
+    path::{Path, PathBuf},
+    sync::Arc,
+    time::SystemTime,
+};
+
+use crate::config::{config, EarlyExitUpTo};
+use crate::flattening::Module;
+use crate::linker::{GlobalUUID, LinkInfo};
+use crate::prelude::*;
+use crate::to_string::pretty_print_concrete_instance;
+
+use super::{instances_with_dependencies, sorted_instances, USE_LATENCY};
+
+/// Part of every key. Bump whenever the contents of entries, or what goes into a key, change
+const CACHE_FORMAT_VERSION: u32 = 2;
+/// Once the files in the cache directory add up to more than this, [evict_least_recently_used] removes the oldest ones
+const MAX_CACHE_BYTES: u64 = 512 * 1024 * 1024;
+const HIERARCHY_EXTENSION: &str = "hierarchy";
+
+/// 64-bit FNV-1a. Unlike [std::hash::DefaultHasher], which may change between Rust releases,
+/// its output is fixed, so keys stay valid when the compiler is rebuilt
+pub struct StableHasher(u64);
+
+impl StableHasher {
+    pub fn new() -> Self {
+        Self(0xcbf2_9ce4_8422_2325)
+    }
+    fn write_bytes(&mut self, bytes: &[u8]) {
+        for byte in bytes {
+            self.0 ^= *byte as u64;
+            self.0 = self.0.wrapping_mul(0x0000_0100_0000_01b3);
+        }
+    }
+    /// Length-prefixed, such that consecutive strings can't shift into one another
+    pub fn write_str(&mut self, s: &str) {
+        self.write_bytes(&(s.len() as u64).to_le_bytes());
+        self.write_bytes(s.as_bytes());
+    }
+    pub fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+/// `instance_name` is the [crate::instantiation::InstantiatedModule::name] the instance of `md` will have
+pub fn instance_key(
+    linker: &Linker,
+    md: &Module,
+    instance_name: &str,
+    file_extension: &str,
+    use_latency: bool,
+) -> u64 {
+    let mut hasher = StableHasher::new();
+    hasher.write_bytes(&CACHE_FORMAT_VERSION.to_le_bytes());
+    hasher.write_str(env!("CARGO_PKG_VERSION"));
+    hasher.write_str(file_extension);
+    hasher.write_bytes(&[use_latency as u8, config().latency_shift_registers as u8]);
+    hasher.write_str(instance_name);
+
+    let mut sources: Vec<&str> = vec![source_of(linker, &md.link_info)];
+    let mut visited: HashSet<GlobalUUID> = HashSet::new();
+    let mut to_visit: Vec<GlobalUUID> = md.link_info.resolved_globals.iter().collect();
+    while let Some(global) = to_visit.pop() {
+        if !visited.insert(global) {
+            continue;
+        }
+        let link_info = linker.get_link_info(global);
+        sources.push(source_of(linker, link_info));
+        to_visit.extend(link_info.resolved_globals.iter());
+    }
+    // The order in which globals are discovered shouldn't matter for the key
+    sources[1..].sort_unstable();
+    hasher.write_bytes(&(sources.len() as u64).to_le_bytes());
+    for source in sources {
+        hasher.write_str(source);
+    }
+
+    hasher.finish()
+}
+
+fn source_of<'l>(linker: &'l Linker, link_info: &LinkInfo) -> &'l str {
+    &linker.files[link_info.file].file_text[link_info.span]
+}
+
+fn entry_path(cache_dir: &Path, key: u64, extension: &str) -> PathBuf {
+    let mut path = cache_dir.join(format!("{key:016x}"));
+    path.set_extension(extension);
+    path
+}
+
+/// Also marks the entry as used, such that [evict_least_recently_used] keeps it around
+pub fn load(cache_dir: &Path, key: u64, extension: &str) -> Option<String> {
+    let path = entry_path(cache_dir, key, extension);
+    let contents = fs::read_to_string(&path).ok()?;
+    // Failing to mark it only makes it more likely to be evicted
+    let _ = File::options()
+        .append(true)
+        .open(&path)
+        .and_then(|file| file.set_modified(SystemTime::now()));
+    Some(contents)
+}
+
+/// A cache that can't be written to only costs us the speedup, so this doesn't fail the compilation
+pub fn store(cache_dir: &Path, key: u64, extension: &str, contents: &str) {
+    let path = entry_path(cache_dir, key, extension);
+    // Write to a temporary file first, such that concurrent compilations sharing the cache never read a partial entry
+    let tmp_path = path.with_extension(format!("{extension}.{}.tmp", std::process::id()));
+    let result = fs::create_dir_all(cache_dir)
+        .and_then(|_| fs::write(&tmp_path, contents))
+        .and_then(|_| fs::rename(&tmp_path, &path));
+    if let Err(err) = result {
+        eprintln!("Could not write cache entry {}: {err}", path.display());
+    }
+}
+
+/// The root modules that are instantiated without template arguments, and the name their instance gets
+fn root_instances(linker: &Linker) -> impl Iterator<Item = (&Module, String)> {
+    linker
+        .instantiation_root_modules()
+        .into_iter()
+        .map(move |md_id| {
+            let md = &linker.modules[md_id];
+            let name =
+                pretty_print_concrete_instance(&md.link_info, &FlatAlloc::new(), &linker.types);
+            (md, name)
+        })
+}
+
+/// An instance of which the code was taken from the cache, because its root wasn't instantiated
+#[derive(Debug)]
+pub struct CachedInstance {
+    pub module_name: String,
+    pub name: String,
+    pub mangled_name: String,
+    pub code: String,
+}
+
+/// The roots of which the whole hierarchy was found in the cache
+#[derive(Debug, Default)]
+pub struct CachedHierarchies {
+    /// Per root module name, its instances in the order of [instances_with_dependencies]
+    hierarchies: HashMap<String, Vec<Arc<CachedInstance>>>,
+}
+
+impl CachedHierarchies {
+    /// Only looks in the cache when code is going to be generated, otherwise instantiating the roots is all that is asked for
+    pub fn load(linker: &Linker, file_extension: &str) -> Self {
+        let config = config();
+        let Some(cache_dir) = &config.cache_dir else {
+            return Self::default();
+        };
+        if config.early_exit != EarlyExitUpTo::CodeGen
+            || (!config.codegen && config.codegen_module_and_dependencies_one_file.is_none())
+        {
+            return Self::default();
+        }
+        // Hierarchies that share instances share their code
+        let mut loaded: HashMap<u64, Arc<CachedInstance>> = HashMap::new();
+        let mut hierarchies = HashMap::new();
+        for (md, root_name) in root_instances(linker) {
+            let root_key = instance_key(linker, md, &root_name, file_extension, USE_LATENCY);
+            if let Some(hierarchy) =
+                load_hierarchy(cache_dir, root_key, file_extension, &mut loaded)
+            {
+                hierarchies.insert(md.link_info.name.clone(), hierarchy);
+            }
+        }
+        Self { hierarchies }
+    }
+
+    pub fn contains_root(&self, md: &Module) -> bool {
+        self.hierarchies.contains_key(&md.link_info.name)
+    }
+
+    pub fn hierarchy(&self, md: &Module) -> Option<&[Arc<CachedInstance>]> {
+        self.hierarchies
+            .get(&md.link_info.name)
+            .map(|hierarchy| hierarchy.as_slice())
+    }
+
+    /// Each instance once, even if it is part of several hierarchies
+    pub fn instances_of(&self, md: &Module) -> Vec<&CachedInstance> {
+        let mut seen_names: HashSet<&str> = HashSet::new();
+        self.hierarchies
+            .values()
+            .flatten()
+            .map(|inst| inst.as_ref())
+            .filter(|inst| {
+                inst.module_name == md.link_info.name && seen_names.insert(inst.name.as_str())
+            })
+            .collect()
+    }
+}
+
+/// A hierarchy entry has one line per instance: `key\tmodule name\tinstance name\tmangled name`
+fn load_hierarchy(
+    cache_dir: &Path,
+    root_key: u64,
+    file_extension: &str,
+    loaded: &mut HashMap<u64, Arc<CachedInstance>>,
+) -> Option<Vec<Arc<CachedInstance>>> {
+    let hierarchy = load(cache_dir, root_key, HIERARCHY_EXTENSION)?;
+    hierarchy
+        .lines()
+        .map(|line| {
+            let mut fields = line.split('\t');
+            let key = u64::from_str_radix(fields.next()?, 16).ok()?;
+            if let Some(inst) = loaded.get(&key) {
+                return Some(inst.clone());
+            }
+            let inst = Arc::new(CachedInstance {
+                module_name: fields.next()?.to_owned(),
+                name: fields.next()?.to_owned(),
+                mangled_name: fields.next()?.to_owned(),
+                code: load(cache_dir, key, file_extension)?,
+            });
+            loaded.insert(key, inst.clone());
+            Some(inst)
+        })
+        .collect()
+}
+
+/// Records the hierarchy of every root that was instantiated without errors or warnings, such that the next run can skip it.
+///
+/// Call once code has been generated: A hierarchy is only stored if the code of all of its instances is in the cache
+pub fn store_hierarchies(cache_dir: &Path, linker: &Linker, file_extension: &str) {
+    'roots: for (md, root_name) in root_instances(linker) {
+        // Hierarchies loaded by [CachedHierarchies::load] weren't instantiated, and are still stored
+        let Some(root) = sorted_instances(md).into_iter().next() else {
+            continue;
+        };
+        // Errors in submodules are reported in their parent too, so without them every submodule was instantiated
+        if root.errors.did_error {
+            continue;
+        }
+        let mut hierarchy = String::new();
+        for (inst, inst_md) in instances_with_dependencies(linker, [(root.as_ref(), md)]) {
+            let key = instance_key(linker, inst_md, &inst.name, file_extension, USE_LATENCY);
+            // Warnings would not be shown again if the hierarchy is reused
+            if !inst.errors.is_untouched() || !entry_path(cache_dir, key, file_extension).exists() {
+                continue 'roots;
+            }
+            writeln!(
+                hierarchy,
+                "{key:016x}\t{}\t{}\t{}",
+                inst_md.link_info.name, inst.name, inst.mangled_name
+            )
+            .unwrap();
+        }
+        let root_key = instance_key(linker, md, &root_name, file_extension, USE_LATENCY);
+        store(cache_dir, root_key, HIERARCHY_EXTENSION, &hierarchy);
+    }
+}
+
+/// Removes the entries that were used least recently, until the cache is no larger than [MAX_CACHE_BYTES]
+pub fn evict_least_recently_used(cache_dir: &Path) {
+    evict_down_to(cache_dir, MAX_CACHE_BYTES);
+}
+
+fn evict_down_to(cache_dir: &Path, max_bytes: u64) {
+    let Ok(dir) = fs::read_dir(cache_dir) else {
+        return;
+    };
+    let mut entries: Vec<(SystemTime, u64, PathBuf)> = dir
+        .filter_map(|entry| {
+            let entry = entry.ok()?;
+            let metadata = entry.metadata().ok()?;
+            metadata.is_file().then(|| {
+                let modified = metadata.modified().unwrap_or(SystemTime::UNIX_EPOCH);
+                (modified, metadata.len(), entry.path())
+            })
+        })
+        .collect();
+    let mut total_bytes: u64 = entries.iter().map(|(_, size, _)| size).sum();
+    if total_bytes <= max_bytes {
+        return;
+    }
+    entries.sort_by_key(|(modified, _, _)| *modified);
+    for (_modified, size, path) in entries {
+        if total_bytes <= max_bytes {
+            break;
+        }
+        if fs::remove_file(&path).is_ok() {
+            total_bytes -= size;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Duration;
+
+    fn empty_test_dir(name: &str) -> PathBuf {
+        let dir =
+            std::env::temp_dir().join(format!("sus_disk_cache_{name}_{}", std::process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    #[test]
+    fn stable_hasher_is_fnv1a() {
+        let mut hasher = StableHasher::new();
+        assert_eq!(hasher.finish(), 0xcbf2_9ce4_8422_2325);
+        hasher.write_bytes(b"a");
+        assert_eq!(hasher.finish(), 0xaf63_dc4c_8601_ec8c);
+    }
+
+    #[test]
+    fn stored_entries_are_loaded() {
+        let dir = empty_test_dir("roundtrip");
+        store(&dir, 0x1234, "sv", "module a(); endmodule\n");
+        assert_eq!(
+            load(&dir, 0x1234, "sv").as_deref(),
+            Some("module a(); endmodule\n")
+        );
+        assert_eq!(load(&dir, 0x1234, "vhd"), None);
+        assert_eq!(load(&dir, 0x5678, "sv"), None);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn least_recently_used_entries_are_evicted_first() {
+        let dir = empty_test_dir("eviction");
+        let now = SystemTime::now();
+        for (key, age_in_days) in [(1, 3), (2, 1), (3, 2)] {
+            store(&dir, key, "sv", "0123456789");
+            File::options()
+                .append(true)
+                .open(entry_path(&dir, key, "sv"))
+                .unwrap()
+                .set_modified(now - Duration::from_secs(age_in_days * 24 * 60 * 60))
+                .unwrap();
+        }
+        evict_down_to(&dir, 20);
+        assert!(!entry_path(&dir, 1, "sv").exists());
+        assert!(entry_path(&dir, 2, "sv").exists());
+        assert!(entry_path(&dir, 3, "sv").exists());
+
+        // Loading an entry makes it the most recently used one
+        assert!(load(&dir, 3, "sv").is_some());
+        evict_down_to(&dir, 10);
+        assert!(!entry_path(&dir, 2, "sv").exists());
+        assert!(entry_path(&dir, 3, "sv").exists());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,3 +1,4 @@
+pub mod disk_cache;
 mod shared;
 pub mod system_verilog;
 pub mod vhdl;
@@ -5,28 +6,189 @@ pub mod vhdl;
 pub use system_verilog::VerilogCodegenBackend;
 pub use vhdl::VHDLCodegenBackend;
 
-use crate::{InstantiatedModule, Linker, Module};
+use crate::{
+    config::config, parallel::parallel_map, profiling::PhaseTimer, InstantiatedModule, Linker,
+    Module,
+};
 
+use disk_cache::{CachedHierarchies, CachedInstance, StableHasher};
+use shared::IoWriter;
 use std::{
+    borrow::Cow,
+    collections::HashSet,
+    fmt::{self, Write as _},
     fs::{self, File},
-    io::Write,
+    io::{BufWriter, Write},
     path::PathBuf,
-    rc::Rc,
+    sync::Arc,
 };
 
+/// Number of instances of [CodeGenBackend::codegen_with_dependencies] that are generated in parallel before being written out, per thread.
+///
+/// Limits how much generated code is held in memory at once
+const INSTANCES_PER_THREAD_IN_FLIGHT: usize = 4;
+
+/// Hardcoded for now. Maybe forever, we'll see
+const USE_LATENCY: bool = true;
+
+/// Instance file names longer than this are shortened by [instance_file_name]. Most file systems allow 255 bytes, which leaves room for the extension
+const MAX_FILE_NAME_BYTES: usize = 200;
+
+/// With [crate::config::ConfigStruct::file_per_instance], the names of the files last written for a module are kept in a file with this extension
+const INSTANCE_LIST_EXTENSION: &str = "instances";
+
+/// [InstantiatedModule::mangled_name], unless it is too long for a file name.
+/// Then it is cut short, and a hash of the whole name is appended to keep it unique
+pub fn instance_file_name(mangled_name: &str) -> Cow<'_, str> {
+    if mangled_name.len() <= MAX_FILE_NAME_BYTES {
+        return Cow::Borrowed(mangled_name);
+    }
+    let mut hasher = StableHasher::new();
+    hasher.write_str(mangled_name);
+    // Room for '_' and 16 hex digits
+    let mut end = MAX_FILE_NAME_BYTES - 17;
+    while !mangled_name.is_char_boundary(end) {
+        end -= 1;
+    }
+    Cow::Owned(format!("{}_{:016x}", &mangled_name[..end], hasher.finish()))
+}
+
+/// The instances of a module, in a stable order. The [crate::instantiation::InstantiationCache] itself is unordered
+pub fn sorted_instances(md: &Module) -> Vec<Arc<InstantiatedModule>> {
+    let mut instances: Vec<Arc<InstantiatedModule>> = Vec::new();
+    md.instantiations.for_each_instance(|_template_args, inst| {
+        instances.push(inst.clone());
+    });
+    instances.sort_by(|a, b| a.name.cmp(&b.name));
+    instances
+}
+
+/// All instances that `top_level_instances` (transitively) instantiate, including themselves, each exactly once.
+///
+/// They are in breadth-first order, every instance comes after the instance that first uses it.
+/// This is the order in which [CodeGenBackend::codegen_with_dependencies] writes them
+pub fn instances_with_dependencies<'l>(
+    linker: &'l Linker,
+    top_level_instances: impl IntoIterator<Item = (&'l InstantiatedModule, &'l Module)>,
+) -> Vec<(&'l InstantiatedModule, &'l Module)> {
+    // Instances are shared through the [crate::instantiation::InstantiationCache], so their address identifies them
+    let mut visited: HashSet<*const InstantiatedModule> = HashSet::new();
+    let mut queue: Vec<(&InstantiatedModule, &Module)> = top_level_instances
+        .into_iter()
+        .filter(|(inst, _md)| visited.insert(*inst))
+        .collect();
+
+    let mut cur_idx = 0;
+    while cur_idx < queue.len() {
+        let (cur_instance, _cur_md) = queue[cur_idx];
+        for (_, sub_mod) in &cur_instance.submodules {
+            let new_inst = sub_mod.instance.get().unwrap().as_ref();
+            if visited.insert(new_inst) {
+                queue.push((new_inst, &linker.modules[sub_mod.module_uuid]));
+            }
+        }
+        cur_idx += 1;
+    }
+    queue
+}
+
+/// An instance to write out. Instances of roots that weren't instantiated come from [CachedHierarchies]
+pub enum OutputInstance<'c> {
+    Instantiated(Arc<InstantiatedModule>),
+    Cached(&'c CachedInstance),
+}
+
+impl OutputInstance<'_> {
+    fn name(&self) -> &str {
+        match self {
+            OutputInstance::Instantiated(inst) => &inst.name,
+            OutputInstance::Cached(inst) => &inst.name,
+        }
+    }
+    fn mangled_name(&self) -> &str {
+        match self {
+            OutputInstance::Instantiated(inst) => &inst.mangled_name,
+            OutputInstance::Cached(inst) => &inst.mangled_name,
+        }
+    }
+}
+
+/// [sorted_instances], together with the instances of `md` that are only in `cached`
+pub fn output_instances<'c>(md: &Module, cached: &'c CachedHierarchies) -> Vec<OutputInstance<'c>> {
+    let instantiated = sorted_instances(md);
+    let instantiated_names: HashSet<&str> =
+        instantiated.iter().map(|inst| inst.name.as_str()).collect();
+    let cached_only: Vec<&CachedInstance> = cached
+        .instances_of(md)
+        .into_iter()
+        .filter(|inst| !instantiated_names.contains(inst.name.as_str()))
+        .collect();
+    let mut instances: Vec<OutputInstance> = instantiated
+        .iter()
+        .cloned()
+        .map(OutputInstance::Instantiated)
+        .chain(cached_only.into_iter().map(OutputInstance::Cached))
+        .collect();
+    instances.sort_by(|a, b| a.name().cmp(b.name()));
+    instances
+}
+
+/// Code is generated on worker threads, so these are printed by the calling thread afterwards, in output order
+fn print_instance_status(inst: &InstantiatedModule) {
+    if inst.errors.did_error {
+        println!("Instantiating error: {}", inst.name);
+    } else {
+        println!("Instantiating success: {}", inst.name);
+    }
+}
+
+/// See [print_instance_status]
+fn print_output_instance_status(inst: &OutputInstance) {
+    match inst {
+        OutputInstance::Instantiated(inst) => print_instance_status(inst),
+        OutputInstance::Cached(inst) => println!("Reusing cached code: {}", inst.name),
+    }
+}
+
+fn write_header(out: &mut dyn fmt::Write) {
+    write!(
+        out,
+        "// DO NOT EDIT THIS FILE\n// This file was generated with SUS Compiler {}\n",
+        std::env!("CARGO_PKG_VERSION")
+    )
+    .unwrap();
+}
+
 /// Implemented for SystemVerilog [self::system_verilog] or VHDL [self::vhdl]
-pub trait CodeGenBackend {
+///
+/// Must be [Sync], because independent instances are generated on multiple threads
+pub trait CodeGenBackend: Sync {
     fn file_extension(&self) -> &str;
     fn output_dir_name(&self) -> &str;
+    /// Writes the code for this instance to `out` as it is generated, such that no copy of the whole module has to be kept in memory
+    fn write_codegen(
+        &self,
+        md: &Module,
+        instance: &InstantiatedModule,
+        linker: &Linker,
+        use_latency: bool,
+        out: &mut dyn fmt::Write,
+    );
+
     fn codegen(
         &self,
         md: &Module,
         instance: &InstantiatedModule,
         linker: &Linker,
         use_latency: bool,
-    ) -> String;
+    ) -> String {
+        let mut code = String::new();
+        self.write_codegen(md, instance, linker, use_latency, &mut code);
+        code
+    }
 
-    fn make_output_file(&self, name: &str) -> File {
+    /// Also creates the output directory
+    fn output_file_path(&self, name: &str) -> PathBuf {
         let mut path = PathBuf::with_capacity(
             name.len() + self.output_dir_name().len() + self.file_extension().len() + 2,
         );
@@ -34,75 +196,293 @@ pub trait CodeGenBackend {
         fs::create_dir_all(&path).unwrap();
         path.push(name);
         path.set_extension(self.file_extension());
-        let mut file = File::create(path).unwrap();
-
-        file.write_fmt(format_args!(
-            "// DO NOT EDIT THIS FILE\n// This file was generated with SUS Compiler {}\n",
-            std::env!("CARGO_PKG_VERSION")
-        ))
-        .unwrap();
+        path
+    }
 
+    fn make_output_file(&self, name: &str) -> IoWriter<BufWriter<File>> {
+        let path = self.output_file_path(name);
+        let mut file = IoWriter(BufWriter::new(File::create(path).unwrap()));
+        write_header(&mut file);
         file
     }
 
+    /// Leaves the file alone if it already has exactly these contents, such that its modification time only changes along with its contents
+    fn write_output_file_if_changed(&self, name: &str, contents: &str) {
+        let path = self.output_file_path(name);
+        if fs::read(&path).is_ok_and(|old_contents| old_contents == contents.as_bytes()) {
+            return;
+        }
+        fs::write(path, contents).unwrap();
+    }
+
     fn codegen_instance(
         &self,
         inst: &InstantiatedModule,
         md: &Module,
         linker: &Linker,
-        out_file: &mut File,
+        out_file: &mut dyn fmt::Write,
     ) {
         let inst_name = &inst.name;
         if inst.errors.did_error {
-            println!("Instantiating error: {inst_name}");
             return; // Continue
         }
-        println!("Instantiating success: {inst_name}");
-        let code = self.codegen(md, inst, linker, true); // hardcode use_latency = true for now. Maybe forever, we'll see
-        write!(out_file, "{code}").unwrap();
+        let _timer = PhaseTimer::new("codegen instance", || inst_name.clone());
+        self.write_codegen_cached(md, inst, linker, USE_LATENCY, out_file);
     }
 
-    fn codegen_to_file(&self, md: &Module, linker: &Linker) {
-        let mut out_file = self.make_output_file(&md.link_info.name);
-        md.instantiations.for_each_instance(|_template_args, inst| {
-            self.codegen_instance(inst.as_ref(), md, linker, &mut out_file)
-        });
+    fn codegen_output_instance(
+        &self,
+        inst: &OutputInstance,
+        md: &Module,
+        linker: &Linker,
+        out_file: &mut dyn fmt::Write,
+    ) {
+        match inst {
+            OutputInstance::Instantiated(inst) => self.codegen_instance(inst, md, linker, out_file),
+            OutputInstance::Cached(inst) => out_file.write_str(&inst.code).unwrap(),
+        }
     }
 
-    fn codegen_with_dependencies(&self, linker: &Linker, md: &Module, file_name: &str) {
-        let mut out_file = self.make_output_file(file_name);
-        let mut top_level_instances: Vec<Rc<InstantiatedModule>> = Vec::new();
-        md.instantiations.for_each_instance(|_template_args, inst| {
-            top_level_instances.push(inst.clone());
+    /// Like [Self::write_codegen], but reuses earlier results from [crate::config::ConfigStruct::cache_dir] if it is set
+    fn write_codegen_cached(
+        &self,
+        md: &Module,
+        instance: &InstantiatedModule,
+        linker: &Linker,
+        use_latency: bool,
+        out: &mut dyn fmt::Write,
+    ) {
+        let Some(cache_dir) = &config().cache_dir else {
+            return self.write_codegen(md, instance, linker, use_latency, out);
+        };
+        let extension = self.file_extension();
+        let key = disk_cache::instance_key(linker, md, &instance.name, extension, use_latency);
+        let code = disk_cache::load(cache_dir, key, extension).unwrap_or_else(|| {
+            let code = self.codegen(md, instance, linker, use_latency);
+            disk_cache::store(cache_dir, key, extension, &code);
+            code
         });
-        let mut to_process_queue: Vec<(&InstantiatedModule, &Module)> = top_level_instances
-            .iter()
-            .map(|v| (v.as_ref(), md))
-            .collect();
+        out.write_str(&code).unwrap();
+    }
 
-        let mut cur_idx = 0;
+    /// Writes the [output_instances] of `md`.
+    /// With [crate::config::ConfigStruct::file_per_instance], every instance gets its own output file, see [instance_file_name]
+    fn codegen_to_file(&self, md: &Module, instances: &[OutputInstance], linker: &Linker) {
+        if config().file_per_instance {
+            let file_names: Vec<String> = instances
+                .iter()
+                .filter_map(|inst| self.codegen_instance_to_file(inst, md, linker))
+                .collect();
+            self.replace_instance_files(&md.link_info.name, &file_names);
+            return;
+        }
+        let mut out_file = self.make_output_file(&md.link_info.name);
+        for inst in instances {
+            self.codegen_output_instance(inst, md, linker, &mut out_file)
+        }
+        out_file.0.flush().unwrap();
+    }
 
-        while cur_idx < to_process_queue.len() {
-            let (cur_instance, cur_md) = to_process_queue[cur_idx];
+    /// The output file isn't touched if its code didn't change, see [Self::write_output_file_if_changed].
+    /// Returns the name of the file, or [None] for an instance with errors, which gets no file
+    fn codegen_instance_to_file(
+        &self,
+        inst: &OutputInstance,
+        md: &Module,
+        linker: &Linker,
+    ) -> Option<String> {
+        if let OutputInstance::Instantiated(inst) = inst {
+            return self.codegen_instantiated_to_file(inst, md, linker);
+        }
+        let mut code = String::new();
+        write_header(&mut code);
+        self.codegen_output_instance(inst, md, linker, &mut code);
+        Some(self.write_instance_file(inst.mangled_name(), &code))
+    }
 
-            for (_, sub_mod) in &cur_instance.submodules {
-                let new_inst = sub_mod.instance.get().unwrap().as_ref();
+    /// Errors are checked before generating any code
+    fn codegen_instantiated_to_file(
+        &self,
+        inst: &InstantiatedModule,
+        md: &Module,
+        linker: &Linker,
+    ) -> Option<String> {
+        if inst.errors.did_error {
+            return None;
+        }
+        let mut code = String::new();
+        write_header(&mut code);
+        self.codegen_instance(inst, md, linker, &mut code);
+        Some(self.write_instance_file(&inst.mangled_name, &code))
+    }
 
-                // Skip duplicates
-                // Yeah yeah I know O(n²) but this list shouldn't grow too big. Fix if needed
-                if to_process_queue
-                    .iter()
-                    .any(|existing| std::ptr::eq(existing.0, new_inst))
-                {
-                    continue;
-                }
+    /// Returns the name of the file, see [instance_file_name]
+    fn write_instance_file(&self, mangled_name: &str, code: &str) -> String {
+        let file_name = instance_file_name(mangled_name).into_owned();
+        self.write_output_file_if_changed(&file_name, code);
+        file_name
+    }
 
-                to_process_queue.push((new_inst, &linker.modules[sub_mod.module_uuid]));
+    /// Records `file_names` as the instance files of `list_name`, and removes the files it had last time that aren't among them,
+    /// like those of instances that no longer exist or now have errors
+    fn replace_instance_files(&self, list_name: &str, file_names: &[String]) {
+        let mut list_path = self.output_file_path(list_name);
+        list_path.set_extension(INSTANCE_LIST_EXTENSION);
+        if let Ok(old_list) = fs::read_to_string(&list_path) {
+            let new_file_names: HashSet<&str> = file_names.iter().map(String::as_str).collect();
+            for old_file_name in old_list.lines() {
+                if !new_file_names.contains(old_file_name) {
+                    // Already gone is fine
+                    let _ = fs::remove_file(self.output_file_path(old_file_name));
+                }
             }
+        }
+        fs::write(list_path, file_names.join("\n")).unwrap();
+    }
 
-            self.codegen_instance(cur_instance, cur_md, linker, &mut out_file);
+    /// Removes what [Self::codegen_to_file] wrote for a module, for when it was removed or lost all its instances
+    fn remove_module_output(&self, md_name: &str) {
+        if config().file_per_instance {
+            self.replace_instance_files(md_name, &[]);
+            let mut list_path = self.output_file_path(md_name);
+            list_path.set_extension(INSTANCE_LIST_EXTENSION);
+            let _ = fs::remove_file(list_path);
+        } else {
+            // Already gone is fine
+            let _ = fs::remove_file(self.output_file_path(md_name));
+        }
+    }
 
-            cur_idx += 1;
+    /// [Self::codegen_to_file] for every module that has instances.
+    ///
+    /// Modules without instances, like those that `--top` doesn't reach, keep whatever output file they had
+    fn codegen_all_to_files(&self, linker: &Linker, cached: &CachedHierarchies) {
+        let modules: Vec<(&Module, Vec<OutputInstance>)> = linker
+            .modules
+            .iter()
+            .map(|(_id, md)| (md, output_instances(md, cached)))
+            .filter(|(_md, instances)| !instances.is_empty())
+            .collect();
+        self.codegen_modules_to_files(linker, &modules);
+    }
+
+    /// [Self::codegen_to_file] for each of `modules`. Every module gets its own file, so these are generated in parallel
+    fn codegen_modules_to_files(
+        &self,
+        linker: &Linker,
+        modules: &[(&Module, Vec<OutputInstance>)],
+    ) {
+        parallel_map(
+            config().jobs,
+            modules.iter().collect(),
+            |(md, instances)| self.codegen_to_file(md, instances, linker),
+        );
+        for (_md, instances) in modules {
+            instances.iter().for_each(print_output_instance_status);
+        }
+    }
+
+    /// With [crate::config::ConfigStruct::file_per_instance], every instance of the hierarchy gets its own file instead, and `file_name` only names their list
+    fn codegen_with_dependencies(
+        &self,
+        linker: &Linker,
+        md: &Module,
+        file_name: &str,
+        cached: &CachedHierarchies,
+    ) {
+        if config().file_per_instance {
+            return self.codegen_with_dependencies_per_instance(linker, md, file_name, cached);
+        }
+        let mut out_file = self.make_output_file(file_name);
+        if let Some(hierarchy) = cached.hierarchy(md) {
+            for inst in hierarchy {
+                let inst = OutputInstance::Cached(inst);
+                print_output_instance_status(&inst);
+                self.codegen_output_instance(&inst, md, linker, &mut out_file);
+            }
+            out_file.0.flush().unwrap();
+            return;
+        }
+        let top_level_instances = sorted_instances(md);
+        let to_process_queue = instances_with_dependencies(
+            linker,
+            top_level_instances.iter().map(|inst| (inst.as_ref(), md)),
+        );
+
+        let jobs = config().jobs;
+        if jobs == 1 {
+            for (inst, inst_md) in to_process_queue {
+                print_instance_status(inst);
+                self.codegen_instance(inst, inst_md, linker, &mut out_file);
+            }
+            out_file.0.flush().unwrap();
+            return;
+        }
+        // The instances are generated in parallel, but written in the order of the queue.
+        // Work is handed out in batches, such that only a few generated instances wait in memory at any one time
+        for batch in to_process_queue.chunks(jobs * INSTANCES_PER_THREAD_IN_FLIGHT) {
+            let generated = parallel_map(jobs, batch.to_vec(), |(inst, inst_md)| {
+                let mut code = String::new();
+                self.codegen_instance(inst, inst_md, linker, &mut code);
+                code
+            });
+            for ((inst, _inst_md), code) in batch.iter().zip(generated) {
+                print_instance_status(inst);
+                out_file.write_str(&code).unwrap();
+            }
         }
+        out_file.0.flush().unwrap();
+    }
+
+    fn codegen_with_dependencies_per_instance(
+        &self,
+        linker: &Linker,
+        md: &Module,
+        list_name: &str,
+        cached: &CachedHierarchies,
+    ) {
+        let file_names: Vec<String> = if let Some(hierarchy) = cached.hierarchy(md) {
+            hierarchy
+                .iter()
+                .filter_map(|inst| {
+                    let inst = OutputInstance::Cached(inst);
+                    print_output_instance_status(&inst);
+                    self.codegen_instance_to_file(&inst, md, linker)
+                })
+                .collect()
+        } else {
+            let top_level_instances = sorted_instances(md);
+            let to_process_queue = instances_with_dependencies(
+                linker,
+                top_level_instances.iter().map(|inst| (inst.as_ref(), md)),
+            );
+            let file_names = parallel_map(
+                config().jobs,
+                to_process_queue.clone(),
+                |(inst, inst_md)| self.codegen_instantiated_to_file(inst, inst_md, linker),
+            );
+            for (inst, _inst_md) in &to_process_queue {
+                print_instance_status(inst);
+            }
+            file_names.into_iter().flatten().collect()
+        };
+        self.replace_instance_files(list_name, &file_names);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn long_instance_file_names_are_shortened_uniquely() {
+        assert_eq!(instance_file_name("short_name"), "short_name");
+        let long_a = "a".repeat(300);
+        let long_b = format!("{}b", "a".repeat(299));
+        let name_a = instance_file_name(&long_a);
+        let name_b = instance_file_name(&long_b);
+        assert!(name_a.len() <= MAX_FILE_NAME_BYTES);
+        assert!(name_b.len() <= MAX_FILE_NAME_BYTES);
+        assert_ne!(name_a, name_b);
     }
 }
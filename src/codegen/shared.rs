@@ -1,26 +1,72 @@
 //! Shared utilities
 
-use std::borrow::Cow;
+use std::fmt::{self, Display};
+use std::io;
 
-use crate::instantiation::RealWire;
+use crate::instantiation::{InstantiatedModule, RealWire};
+use crate::prelude::*;
 
-pub fn wire_name_with_latency(
-    wire: &RealWire,
+/// The name of a wire delayed to a certain latency. Formatted in place, to avoid allocating a String per wire reference
+#[derive(Clone, Copy)]
+pub struct WireNameWithLatency<'w> {
+    wire: &'w RealWire,
+    /// The latency the wire itself is generated at
+    wire_latency: i64,
     absolute_latency: i64,
     use_latency: bool,
-) -> Cow<str> {
-    assert!(wire.absolute_latency <= absolute_latency);
-    if use_latency && (wire.absolute_latency != absolute_latency) {
-        if absolute_latency < 0 {
-            Cow::Owned(format!("_{}_N{}", wire.name, -absolute_latency))
+}
+
+impl Display for WireNameWithLatency<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let name = &self.wire.name;
+        if self.use_latency && (self.wire_latency != self.absolute_latency) {
+            if self.absolute_latency < 0 {
+                write!(f, "_{name}_N{}", -self.absolute_latency)
+            } else {
+                write!(f, "_{name}_D{}", self.absolute_latency)
+            }
         } else {
-            Cow::Owned(format!("_{}_D{}", wire.name, absolute_latency))
+            f.write_str(name)
         }
-    } else {
-        Cow::Borrowed(&wire.name)
     }
 }
 
-pub fn wire_name_self_latency(wire: &RealWire, use_latency: bool) -> Cow<str> {
-    wire_name_with_latency(wire, wire.absolute_latency, use_latency)
+pub fn wire_name_with_latency(
+    instance: &InstantiatedModule,
+    wire_id: WireID,
+    absolute_latency: i64,
+    use_latency: bool,
+) -> WireNameWithLatency<'_> {
+    let wire_latency = instance.wire_latencies[wire_id];
+    assert!(wire_latency <= absolute_latency);
+    WireNameWithLatency {
+        wire: &instance.wires[wire_id],
+        wire_latency,
+        absolute_latency,
+        use_latency,
+    }
+}
+
+pub fn wire_name_self_latency(
+    instance: &InstantiatedModule,
+    wire_id: WireID,
+    use_latency: bool,
+) -> WireNameWithLatency<'_> {
+    wire_name_with_latency(
+        instance,
+        wire_id,
+        instance.wire_latencies[wire_id],
+        use_latency,
+    )
+}
+
+/// The backends generate code through [fmt::Write]. This streams that code into an [io::Write], like a buffered output file
+pub struct IoWriter<W: io::Write>(pub W);
+
+impl<W: io::Write> fmt::Write for IoWriter<W> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        // Like failing to create the output file, failing to write to it is fatal
+        self.0.write_all(s.as_bytes()).unwrap();
+        Ok(())
+    }
 }
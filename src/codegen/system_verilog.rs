@@ -1,6 +1,8 @@
-use std::borrow::Cow;
+use std::fmt::{self, Display};
 use std::ops::Deref;
 
+use crate::alloc::zip_eq;
+use crate::config::config;
 use crate::linker::{IsExtern, LinkInfo};
 use crate::prelude::*;
 
@@ -8,8 +10,9 @@ use crate::flattening::{DeclarationKind, Instruction, Module, Port};
 use crate::instantiation::{
     InstantiatedModule, RealWire, RealWireDataSource, RealWirePathElem, CALCULATE_LATENCY_LATER,
 };
+use crate::typing::concrete_type::ConcreteType;
 use crate::typing::template::TVec;
-use crate::{typing::concrete_type::ConcreteType, value::Value};
+use crate::value::{IntValue, Value};
 
 use super::shared::*;
 use std::fmt::Write;
@@ -24,60 +27,125 @@ impl super::CodeGenBackend for VerilogCodegenBackend {
     fn output_dir_name(&self) -> &str {
         "verilog_output"
     }
-    fn codegen(
+    fn write_codegen(
         &self,
         md: &Module,
         instance: &InstantiatedModule,
         linker: &Linker,
         use_latency: bool,
-    ) -> String {
-        gen_verilog_code(md, instance, linker, use_latency)
+        out: &mut dyn Write,
+    ) {
+        gen_verilog_code(md, instance, linker, use_latency, out)
+    }
+}
+
+/// See [typ_to_declaration]
+struct TypDeclaration<'t, Name: Display> {
+    typ: &'t ConcreteType,
+    var_name: Name,
+}
+
+impl<Name: Display> Display for TypDeclaration<'_, Name> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let mut typ = self.typ;
+        while let ConcreteType::Array(arr) = typ {
+            let (content_typ, size) = arr.deref();
+            let sz = size.unwrap_value().unwrap_integer();
+            write!(f, "[{}:0]", sz - &IntValue::ONE)?;
+            typ = content_typ;
+        }
+        let var_name = &self.var_name;
+        match typ {
+            ConcreteType::Named(reference) => {
+                let sz = ConcreteType::sizeof_named(reference);
+                if sz == 1 {
+                    write!(f, " {var_name}")
+                } else {
+                    write!(f, "[{}:0] {var_name}", sz - 1)
+                }
+            }
+            ConcreteType::Array(_) => unreachable!("All arrays have been used up already"),
+            ConcreteType::Value(_) | ConcreteType::Unknown(_) => unreachable!(),
+        }
     }
 }
 
 /// Creates the Verilog variable declaration for tbis variable.
 ///
 /// IE for `int[15] myVar` it creates `[31:0] myVar[14:0]`
-fn typ_to_declaration(mut typ: &ConcreteType, var_name: &str) -> String {
-    let mut array_string = String::new();
-    while let ConcreteType::Array(arr) = typ {
-        let (content_typ, size) = arr.deref();
-        let sz = size.unwrap_value().unwrap_integer();
-        use std::fmt::Write;
-        write!(array_string, "[{}:0]", sz - 1).unwrap();
-        typ = content_typ;
+fn typ_to_declaration<Name: Display>(
+    typ: &ConcreteType,
+    var_name: Name,
+) -> TypDeclaration<'_, Name> {
+    TypDeclaration { typ, var_name }
+}
+
+/// With [crate::config::ConfigStruct::latency_shift_registers], all delayed copies of a wire are the stages of one packed array
+#[derive(Clone, Copy)]
+struct ShiftRegisterName<'w>(&'w RealWire);
+
+impl Display for ShiftRegisterName<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "_{}_delay", self.0.name)
     }
-    match typ {
-        ConcreteType::Named(reference) => {
-            let sz = ConcreteType::sizeof_named(reference);
-            if sz == 1 {
-                format!("{array_string} {var_name}")
-            } else {
-                format!("{array_string}[{}:0] {var_name}", sz - 1)
-            }
+}
+
+/// A reference to a wire, or the constant it holds if it is inlined. See [CodeGenerationContext::can_inline]
+enum WireRef<'g> {
+    Inlined(InlineConstant<'g>),
+    Wire(WireNameWithLatency<'g>),
+    /// Stage `n` holds the wire delayed by `n` cycles
+    ShiftRegisterStage(ShiftRegisterName<'g>, i64),
+}
+
+impl Display for WireRef<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            WireRef::Inlined(constant) => constant.fmt(f),
+            WireRef::Wire(name) => name.fmt(f),
+            WireRef::ShiftRegisterStage(register, stage) => write!(f, "{register}[{stage}]"),
+        }
+    }
+}
+
+/// Forwards to the output, and comments out everything written while [Self::commented_out] is set
+struct ProgramText<'out> {
+    out: &'out mut dyn Write,
+    commented_out: bool,
+}
+
+impl Write for ProgramText<'_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        if !self.commented_out {
+            return self.out.write_str(s);
+        }
+        let mut lines = s.split('\n');
+        self.out.write_str(lines.next().unwrap())?;
+        for line in lines {
+            self.out.write_str("\n// ")?;
+            self.out.write_str(line)?;
         }
-        ConcreteType::Array(_) => unreachable!("All arrays have been used up already"),
-        ConcreteType::Value(_) | ConcreteType::Unknown(_) => unreachable!(),
+        Ok(())
     }
 }
 
-struct CodeGenerationContext<'g> {
+struct CodeGenerationContext<'g, 'out> {
     /// Generate code to this variable
-    program_text: String,
+    program_text: ProgramText<'out>,
 
     md: &'g Module,
     instance: &'g InstantiatedModule,
     linker: &'g Linker,
 
     use_latency: bool,
-
-    needed_untils: FlatAlloc<i64, WireIDMarker>,
+    /// See [crate::config::ConfigStruct::latency_shift_registers]
+    latency_shift_registers: bool,
 }
 
-impl<'g> CodeGenerationContext<'g> {
+impl<'g> CodeGenerationContext<'g, '_> {
     /// This is for making the resulting Verilog a little nicer to read
-    fn can_inline(&self, wire: &RealWire) -> bool {
-        match &wire.source {
+    fn can_inline(&self, wire_id: WireID) -> bool {
+        match &self.instance.wire_sources[wire_id] {
             RealWireDataSource::Constant {
                 value: Value::Bool(_) | Value::Integer(_),
             } => true,
@@ -85,50 +153,63 @@ impl<'g> CodeGenerationContext<'g> {
         }
     }
 
-    fn operation_to_string(&self, wire: &'g RealWire) -> Cow<'g, str> {
-        assert!(self.can_inline(wire));
-        match &wire.source {
-            RealWireDataSource::Constant { value } => value.inline_constant_to_string(),
+    fn operation_to_string(&self, wire_id: WireID) -> InlineConstant<'g> {
+        assert!(self.can_inline(wire_id));
+        match &self.instance.wire_sources[wire_id] {
+            RealWireDataSource::Constant { value } => InlineConstant(value),
             _other => unreachable!(),
         }
     }
 
-    fn wire_name(&self, wire_id: WireID, requested_latency: i64) -> Cow<'g, str> {
-        let wire = &self.instance.wires[wire_id];
-        if self.can_inline(wire) {
-            self.operation_to_string(wire)
+    fn wire_name(&self, wire_id: WireID, requested_latency: i64) -> WireRef<'g> {
+        let wire_latency = self.instance.wire_latencies[wire_id];
+        if self.can_inline(wire_id) {
+            WireRef::Inlined(self.operation_to_string(wire_id))
+        } else if self.use_latency
+            && self.latency_shift_registers
+            && requested_latency != wire_latency
+        {
+            assert!(wire_latency < requested_latency);
+            WireRef::ShiftRegisterStage(
+                ShiftRegisterName(&self.instance.wires[wire_id]),
+                requested_latency - wire_latency,
+            )
         } else {
-            wire_name_with_latency(wire, requested_latency, self.use_latency)
+            WireRef::Wire(wire_name_with_latency(
+                self.instance,
+                wire_id,
+                requested_latency,
+                self.use_latency,
+            ))
         }
     }
 
-    fn wire_ref_path_to_string(&self, path: &[RealWirePathElem], absolute_latency: i64) -> String {
-        let mut result = String::new();
+    fn write_wire_ref_path(&mut self, path: &[RealWirePathElem], absolute_latency: i64) {
         for path_elem in path {
-            result.push_str(&match path_elem {
+            match path_elem {
                 RealWirePathElem::ArrayAccess { span: _, idx_wire } => {
                     let idx_wire_name = self.wire_name(*idx_wire, absolute_latency);
-                    format!("[{idx_wire_name}]")
+                    write!(self.program_text, "[{idx_wire_name}]").unwrap();
                 }
-            });
+            }
         }
-        result
     }
 
-    fn add_latency_registers(
-        &mut self,
-        wire_id: WireID,
-        w: &RealWire,
-    ) -> Result<(), std::fmt::Error> {
+    fn add_latency_registers(&mut self, wire_id: WireID) -> Result<(), std::fmt::Error> {
         if self.use_latency {
-            // Can do 0 iterations, when w.needed_until == w.absolute_latency. Meaning it's only needed this cycle
-            assert!(w.absolute_latency != CALCULATE_LATENCY_LATER);
-            assert!(self.needed_untils[wire_id] != CALCULATE_LATENCY_LATER);
-            for i in w.absolute_latency..self.needed_untils[wire_id] {
-                let from = wire_name_with_latency(w, i, self.use_latency);
-                let to = wire_name_with_latency(w, i + 1, self.use_latency);
+            let wire_latency = self.instance.wire_latencies[wire_id];
+            let needed_until = self.instance.wire_needed_untils[wire_id];
+            // Can do 0 iterations, when needed_until == wire_latency. Meaning it's only needed this cycle
+            assert!(wire_latency != CALCULATE_LATENCY_LATER);
+            assert!(needed_until != CALCULATE_LATENCY_LATER);
+            if self.latency_shift_registers {
+                return self.add_latency_shift_register(wire_id);
+            }
+            for i in wire_latency..needed_until {
+                let from = wire_name_with_latency(self.instance, wire_id, i, self.use_latency);
+                let to = wire_name_with_latency(self.instance, wire_id, i + 1, self.use_latency);
 
-                let var_decl = typ_to_declaration(&w.typ, &to);
+                let var_decl = typ_to_declaration(&self.instance.wire_types[wire_id], to);
 
                 let clk_name = self.md.get_clock_name();
                 writeln!(
@@ -140,17 +221,40 @@ impl<'g> CodeGenerationContext<'g> {
         Ok(())
     }
 
+    /// Declares stages `1..=num_stages` in one packed array, and shifts them all in one `always_ff`
+    fn add_latency_shift_register(&mut self, wire_id: WireID) -> Result<(), std::fmt::Error> {
+        let num_stages =
+            self.instance.wire_needed_untils[wire_id] - self.instance.wire_latencies[wire_id];
+        if num_stages == 0 {
+            return Ok(());
+        }
+        let register = ShiftRegisterName(&self.instance.wires[wire_id]);
+        let input = wire_name_self_latency(self.instance, wire_id, self.use_latency);
+        let var_decl = typ_to_declaration(&self.instance.wire_types[wire_id], register);
+        let clk_name = self.md.get_clock_name();
+        write!(
+            self.program_text,
+            "/*latency*/ logic [{num_stages}:1]{var_decl}; always_ff @(posedge {clk_name}) begin "
+        )?;
+        if num_stages == 1 {
+            write!(self.program_text, "{register} <= {input};")?;
+        } else {
+            let last_kept = num_stages - 1;
+            write!(
+                self.program_text,
+                "{register} <= {{{register}[{last_kept}:1], {input}}};"
+            )?;
+        }
+        writeln!(self.program_text, " end")
+    }
+
     fn comment_out(&mut self, f: impl FnOnce(&mut Self)) {
-        let store_program_text_temporary = std::mem::take(&mut self.program_text);
+        assert!(!self.program_text.commented_out);
+        self.program_text.write_str("// ").unwrap();
+        self.program_text.commented_out = true;
         f(self);
-        let added_text = std::mem::replace(&mut self.program_text, store_program_text_temporary);
-
-        writeln!(
-            self.program_text,
-            "// {}",
-            added_text.replace("\n", "\n// ")
-        )
-        .unwrap();
+        self.program_text.commented_out = false;
+        self.program_text.write_char('\n').unwrap();
     }
 
     fn write_verilog_code(&mut self) {
@@ -191,11 +295,10 @@ impl<'g> CodeGenerationContext<'g> {
         )
         .unwrap();
         for (_id, port) in self.instance.interface_ports.iter_valids() {
-            let port_wire = &self.instance.wires[port.wire];
             let input_or_output = if port.is_input { "input" } else { "output" };
-            let wire_doc = port_wire.source.wire_or_reg();
-            let wire_name = wire_name_self_latency(port_wire, self.use_latency);
-            let wire_decl = typ_to_declaration(&port_wire.typ, &wire_name);
+            let wire_doc = self.instance.wire_sources[port.wire].wire_or_reg();
+            let wire_name = wire_name_self_latency(self.instance, port.wire, self.use_latency);
+            let wire_decl = typ_to_declaration(&self.instance.wire_types[port.wire], &wire_name);
             write!(
                 self.program_text,
                 ",\n\t{input_or_output} {wire_doc} {wire_decl}"
@@ -207,22 +310,25 @@ impl<'g> CodeGenerationContext<'g> {
         // Add latency registers for the interface declarations
         // Should not appear in the program text for extern modules
         for (_id, port) in self.instance.interface_ports.iter_valids() {
-            let port_wire = &self.instance.wires[port.wire];
-            self.add_latency_registers(port.wire, port_wire).unwrap();
+            self.add_latency_registers(port.wire).unwrap();
         }
     }
 
     /// Pass a `to` parameter to say to what the constant should be assigned.  
-    fn write_constant(&mut self, to: &str, value: &Value) {
+    ///
+    /// For arrays, the element names are appended to `to` one by one, instead of allocating a new name per element
+    fn write_constant(&mut self, to: &mut String, value: &Value) {
         match value {
             Value::Bool(_) | Value::Integer(_) | Value::Unset => {
-                let v_str = value.inline_constant_to_string();
+                let v_str = InlineConstant(value);
                 writeln!(self.program_text, "{to} = {v_str};").unwrap();
             }
             Value::Array(arr) => {
+                let to_len = to.len();
                 for (idx, v) in arr.iter().enumerate() {
-                    let new_to = format!("{to}[{idx}]");
-                    self.write_constant(&new_to, v);
+                    write!(to, "[{idx}]").unwrap();
+                    self.write_constant(to, v);
+                    to.truncate(to_len);
                 }
             }
             Value::Error => unreachable!("Error values should never have reached codegen!"),
@@ -230,9 +336,9 @@ impl<'g> CodeGenerationContext<'g> {
     }
 
     fn write_wire_declarations(&mut self) {
-        for (wire_id, w) in &self.instance.wires {
+        for (wire_id, w, source) in zip_eq(&self.instance.wires, &self.instance.wire_sources) {
             // For better readability of output Verilog
-            if self.can_inline(w) {
+            if self.can_inline(wire_id) {
                 continue;
             }
 
@@ -244,24 +350,26 @@ impl<'g> CodeGenerationContext<'g> {
                     continue;
                 }
             }
-            let wire_or_reg = w.source.wire_or_reg();
+            let wire_or_reg = source.wire_or_reg();
+            let wire_latency = self.instance.wire_latencies[wire_id];
 
-            let wire_name = wire_name_self_latency(w, self.use_latency);
-            let wire_decl = typ_to_declaration(&w.typ, &wire_name);
+            let wire_name = wire_name_self_latency(self.instance, wire_id, self.use_latency);
+            let wire_decl = typ_to_declaration(&self.instance.wire_types[wire_id], wire_name);
             write!(self.program_text, "{wire_or_reg} {wire_decl}").unwrap();
 
-            match &w.source {
+            match source {
                 RealWireDataSource::Select { root, path } => {
-                    let wire_name = self.wire_name(*root, w.absolute_latency);
-                    let path = self.wire_ref_path_to_string(path, w.absolute_latency);
-                    writeln!(self.program_text, " = {wire_name}{path};").unwrap();
+                    let wire_name = self.wire_name(*root, wire_latency);
+                    write!(self.program_text, " = {wire_name}").unwrap();
+                    self.write_wire_ref_path(path, wire_latency);
+                    writeln!(self.program_text, ";").unwrap();
                 }
                 RealWireDataSource::UnaryOp { op, right } => {
                     writeln!(
                         self.program_text,
                         " = {}{};",
                         op.op_text(),
-                        self.wire_name(*right, w.absolute_latency)
+                        self.wire_name(*right, wire_latency)
                     )
                     .unwrap();
                 }
@@ -269,9 +377,9 @@ impl<'g> CodeGenerationContext<'g> {
                     writeln!(
                         self.program_text,
                         " = {} {} {};",
-                        self.wire_name(*left, w.absolute_latency),
+                        self.wire_name(*left, wire_latency),
                         op.op_text(),
-                        self.wire_name(*right, w.absolute_latency)
+                        self.wire_name(*right, wire_latency)
                     )
                     .unwrap();
                 }
@@ -279,7 +387,7 @@ impl<'g> CodeGenerationContext<'g> {
                     // Trivial constants (bools & ints) should have been inlined already
                     // So appearences of this are always arrays or other compound types
                     writeln!(self.program_text, ";").unwrap();
-                    self.write_constant(&wire_name, value);
+                    self.write_constant(&mut wire_name.to_string(), value);
                 }
                 RealWireDataSource::ReadOnly => {
                     writeln!(self.program_text, ";").unwrap();
@@ -290,12 +398,12 @@ impl<'g> CodeGenerationContext<'g> {
                 } => {
                     writeln!(self.program_text, ";").unwrap();
                     if let Some(initial_value) = is_state {
-                        let to = format!("initial {wire_name}");
-                        self.write_constant(&to, initial_value);
+                        let mut to = format!("initial {wire_name}");
+                        self.write_constant(&mut to, initial_value);
                     }
                 }
             }
-            self.add_latency_registers(wire_id, w).unwrap();
+            self.add_latency_registers(wire_id).unwrap();
         }
     }
 
@@ -308,7 +416,7 @@ impl<'g> CodeGenerationContext<'g> {
                 .get()
                 .expect("Invalid submodules are impossible to remain by the time codegen happens");
             if sm_md.link_info.is_extern == IsExtern::Extern {
-                self.write_template_args(&sm_md.link_info, &sm.template_args);
+                self.write_template_args(&sm_md.link_info, sm.template_args());
             } else {
                 self.program_text.write_str(&sm_inst.mangled_name).unwrap();
             };
@@ -321,18 +429,18 @@ impl<'g> CodeGenerationContext<'g> {
             )
             .unwrap();
             for (port_id, iport) in sm_inst.interface_ports.iter_valids() {
-                let port_name =
-                    wire_name_self_latency(&sm_inst.wires[iport.wire], self.use_latency);
-                let wire_name = if let Some(port_wire) = &sm.port_map[port_id] {
-                    wire_name_self_latency(
-                        &self.instance.wires[port_wire.maps_to_wire],
+                let port_name = wire_name_self_latency(sm_inst, iport.wire, self.use_latency);
+                write!(self.program_text, ",\n\t.{port_name}(").unwrap();
+                // Ports that are defined on the submodule, but not used by impl are left empty
+                if let Some(port_wire) = &sm.port_map[port_id] {
+                    let wire_name = wire_name_self_latency(
+                        self.instance,
+                        port_wire.maps_to_wire,
                         self.use_latency,
-                    )
-                } else {
-                    // Ports that are defined on the submodule, but not used by impl
-                    Cow::Borrowed("")
-                };
-                write!(self.program_text, ",\n\t.{port_name}({wire_name})").unwrap();
+                    );
+                    write!(self.program_text, "{wire_name}").unwrap();
+                }
+                self.program_text.write_char(')').unwrap();
             }
             writeln!(self.program_text, "\n);").unwrap();
         }
@@ -352,7 +460,7 @@ impl<'g> CodeGenerationContext<'g> {
                 ConcreteType::Named(..) | ConcreteType::Array(..) => {
                     unreachable!("No extern module type arguments. Should have been caught by Lint")
                 }
-                ConcreteType::Value(value) => value.inline_constant_to_string(),
+                ConcreteType::Value(value) => InlineConstant(value),
                 ConcreteType::Unknown(_) => unreachable!("All args are known at codegen"),
             };
             if first {
@@ -363,17 +471,19 @@ impl<'g> CodeGenerationContext<'g> {
             self.program_text.write_char('.').unwrap();
             self.program_text.write_str(arg_name).unwrap();
             self.program_text.write_char('(').unwrap();
-            self.program_text.write_str(&arg_value).unwrap();
+            write!(self.program_text, "{arg_value}").unwrap();
             self.program_text.write_char(')').unwrap();
         });
         self.program_text.write_char(')').unwrap();
     }
 
     fn write_multiplexers(&mut self) {
-        for (_id, w) in &self.instance.wires {
-            match &w.source {
+        for (wire_id, source) in &self.instance.wire_sources {
+            let wire_latency = self.instance.wire_latencies[wire_id];
+            match source {
                 RealWireDataSource::Multiplexer { is_state, sources } => {
-                    let output_name = wire_name_self_latency(w, self.use_latency);
+                    let output_name =
+                        wire_name_self_latency(self.instance, wire_id, self.use_latency);
                     let arrow_str = if is_state.is_some() {
                         let clk_name = self.md.get_clock_name();
                         writeln!(self.program_text, "always_ff @(posedge {clk_name}) begin")
@@ -381,26 +491,23 @@ impl<'g> CodeGenerationContext<'g> {
                         "<="
                     } else {
                         writeln!(self.program_text, "always_comb begin\n\t// Combinatorial wires are not defined when not valid. This is just so that the synthesis tool doesn't generate latches").unwrap();
-                        let invalid_val = w.typ.get_initial_val();
-                        let tabbed_name = format!("\t{output_name}");
-                        self.write_constant(&tabbed_name, &invalid_val);
+                        let invalid_val = self.instance.wire_types[wire_id].get_initial_val();
+                        let mut tabbed_name = format!("\t{output_name}");
+                        self.write_constant(&mut tabbed_name, &invalid_val);
                         "="
                     };
 
                     for s in sources {
-                        let path = self.wire_ref_path_to_string(&s.to_path, w.absolute_latency);
-                        let from_name = self.wire_name(s.from, w.absolute_latency);
+                        let from_name = self.wire_name(s.from, wire_latency);
                         self.program_text.write_char('\t').unwrap();
                         for cond in s.condition.iter() {
-                            let cond_name = self.wire_name(cond.condition_wire, w.absolute_latency);
+                            let cond_name = self.wire_name(cond.condition_wire, wire_latency);
                             let invert = if cond.inverse { "!" } else { "" };
                             write!(self.program_text, "if({invert}{cond_name}) ").unwrap();
                         }
-                        writeln!(
-                            self.program_text,
-                            "{output_name}{path} {arrow_str} {from_name};"
-                        )
-                        .unwrap();
+                        write!(self.program_text, "{output_name}").unwrap();
+                        self.write_wire_ref_path(&s.to_path, wire_latency);
+                        writeln!(self.program_text, " {arrow_str} {from_name};").unwrap();
                     }
                     writeln!(self.program_text, "end").unwrap();
                 }
@@ -471,12 +578,16 @@ impl<'g> CodeGenerationContext<'g> {
     }
 }
 
-impl Value {
-    fn inline_constant_to_string(&self) -> Cow<str> {
-        match self {
-            Value::Bool(b) => Cow::Borrowed(if *b { "1'b1" } else { "1'b0" }),
-            Value::Integer(v) => Cow::Owned(v.to_string()),
-            Value::Unset => Cow::Borrowed("'x"),
+/// A [Value] that fits in an expression, like `1'b1` or `5`
+#[derive(Clone, Copy)]
+struct InlineConstant<'v>(&'v Value);
+
+impl Display for InlineConstant<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self.0 {
+            Value::Bool(b) => f.write_str(if *b { "1'b1" } else { "1'b0" }),
+            Value::Integer(v) => write!(f, "{v}"),
+            Value::Unset => f.write_str("'x"),
             Value::Array(_) => unreachable!("Not an inline constant!"),
             Value::Error => unreachable!("Error values should never have reached codegen!"),
         }
@@ -515,16 +626,18 @@ fn gen_verilog_code(
     instance: &InstantiatedModule,
     linker: &Linker,
     use_latency: bool,
-) -> String {
+    out: &mut dyn Write,
+) {
     let mut ctx = CodeGenerationContext {
         md,
         instance,
         linker,
-        program_text: String::new(),
+        program_text: ProgramText {
+            out,
+            commented_out: false,
+        },
         use_latency,
-        needed_untils: instance.compute_needed_untils(),
+        latency_shift_registers: config().latency_shift_registers,
     };
     ctx.write_verilog_code();
-
-    ctx.program_text
 }
@@ -2,7 +2,8 @@ use crate::{
     flattening::{DeclarationKind, Instruction},
     linker::IsExtern,
     typing::concrete_type::ConcreteType,
-    FlatAlloc, InstantiatedModule, Linker, Module, WireIDMarker,
+    value::IntValue,
+    InstantiatedModule, Linker, Module,
 };
 use std::fmt::Write;
 use std::ops::Deref;
@@ -19,23 +20,23 @@ impl super::CodeGenBackend for VHDLCodegenBackend {
     fn output_dir_name(&self) -> &str {
         "vhdl_output"
     }
-    fn codegen(
+    fn write_codegen(
         &self,
         md: &Module,
         instance: &InstantiatedModule,
         _linker: &Linker,
         use_latency: bool,
-    ) -> String {
-        gen_vhdl_code(md, instance, use_latency)
+        out: &mut dyn Write,
+    ) {
+        gen_vhdl_code(md, instance, use_latency, out)
     }
 }
 
-struct CodeGenerationContext<'g, 'out, Stream: std::fmt::Write> {
+struct CodeGenerationContext<'g, 'out, Stream: std::fmt::Write + ?Sized> {
     md: &'g Module,
     instance: &'g InstantiatedModule,
     program_text: &'out mut Stream,
     use_latency: bool,
-    _needed_untils: FlatAlloc<i64, WireIDMarker>,
 }
 
 fn typ_to_declaration(mut typ: &ConcreteType) -> String {
@@ -43,7 +44,7 @@ fn typ_to_declaration(mut typ: &ConcreteType) -> String {
     while let ConcreteType::Array(arr) = typ {
         let (content_typ, size) = arr.deref();
         let sz = size.unwrap_value().unwrap_integer();
-        write!(array_string, "array (0 to {}) of", sz - 1).unwrap();
+        write!(array_string, "array (0 to {}) of", sz - &IntValue::ONE).unwrap();
         typ = content_typ;
     }
     match typ {
@@ -60,7 +61,7 @@ fn typ_to_declaration(mut typ: &ConcreteType) -> String {
     }
 }
 
-impl<Stream: std::fmt::Write> CodeGenerationContext<'_, '_, Stream> {
+impl<Stream: std::fmt::Write + ?Sized> CodeGenerationContext<'_, '_, Stream> {
     fn write_vhdl_code(&mut self) {
         match self.md.link_info.is_extern {
             IsExtern::Normal => {
@@ -99,10 +100,9 @@ impl<Stream: std::fmt::Write> CodeGenerationContext<'_, '_, Stream> {
         .unwrap();
 
         while let Some((_, port)) = it.next() {
-            let port_wire = &self.instance.wires[port.wire];
-            let port_name = &port_wire.name;
+            let port_name = &self.instance.wires[port.wire].name;
             let port_direction = if port.is_input { "in" } else { "out" };
-            let port_type = typ_to_declaration(&port_wire.typ);
+            let port_type = typ_to_declaration(&self.instance.wire_types[port.wire]);
             let end = if it.peek().is_some() { ";" } else { "" };
             writeln!(
                 self.program_text,
@@ -145,9 +145,9 @@ impl<Stream: std::fmt::Write> CodeGenerationContext<'_, '_, Stream> {
                 }
                 true
             })
-            .map(|(_, wire)| {
-                let signal_name = wire_name_self_latency(wire, self.use_latency);
-                let signal_type = typ_to_declaration(&wire.typ);
+            .map(|(wire_id, _)| {
+                let signal_name = wire_name_self_latency(self.instance, wire_id, self.use_latency);
+                let signal_type = typ_to_declaration(&self.instance.wire_types[wire_id]);
                 format!("    signal {signal_name} : {signal_type}")
             })
             .fold(String::new(), |mut a, b| {
@@ -165,18 +165,19 @@ impl<Stream: std::fmt::Write> CodeGenerationContext<'_, '_, Stream> {
 
 // TODO This should be removed as soon as this feature is usable
 #[allow(unreachable_code)]
-fn gen_vhdl_code(_md: &Module, _instance: &InstantiatedModule, _use_latency: bool) -> String {
+fn gen_vhdl_code(
+    _md: &Module,
+    _instance: &InstantiatedModule,
+    _use_latency: bool,
+    _out: &mut dyn Write,
+) {
     todo!("VHDl codegen is unfinshed");
-    let mut program_text = String::new();
 
     let mut ctx = CodeGenerationContext {
         md: _md,
         instance: _instance,
         use_latency: _use_latency,
-        program_text: &mut program_text,
-        _needed_untils: _instance.compute_needed_untils(),
+        program_text: _out,
     };
     ctx.write_vhdl_code();
-
-    program_text
 }
@@ -1,17 +1,26 @@
+use std::cell::RefCell;
 use std::ffi::OsStr;
+use std::ops::Range;
 use std::path::{Path, PathBuf};
 use std::str::FromStr;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Mutex;
 
 use crate::config::EarlyExitUpTo;
-use crate::linker::AFTER_INITIAL_PARSE_CP;
 use crate::prelude::*;
 
 use sus_proc_macro::{get_builtin_const, get_builtin_type};
-use tree_sitter::Parser;
+use tree_sitter::{InputEdit, Parser, Point, Tree};
 
 use crate::{
-    config::config, debug::SpanDebugger, errors::ErrorStore, file_position::FileText,
+    codegen::disk_cache::StableHasher,
+    config::config,
+    debug::SpanDebugger,
+    errors::ErrorStore,
+    file_position::{FileText, LineCol},
     linker::FileData,
+    parallel::parallel_map,
+    profiling::PhaseTimer,
 };
 
 use crate::flattening::{
@@ -33,10 +42,105 @@ pub trait LinkerExtraFileInfoManager {
 
 impl LinkerExtraFileInfoManager for () {}
 
+thread_local! {
+    /// Creating a [Parser] and loading the language into it isn't free, so every thread keeps one around
+    static SUS_PARSER: RefCell<Parser> = RefCell::new({
+        let mut parser = Parser::new();
+        parser.set_language(&tree_sitter_sus::language()).unwrap();
+        parser
+    });
+}
+
+/// Parses SUS code with this thread's [Parser]. `old_tree` is passed on to [Parser::parse] for incremental reparsing
+pub fn parse_sus(text: &str, old_tree: Option<&Tree>) -> Tree {
+    SUS_PARSER.with_borrow_mut(|parser| parser.parse(text, old_tree).unwrap())
+}
+
+/// tree-sitter columns are in bytes, whereas [LineCol] counts UTF-16 code units
+fn byte_to_point(file_text: &FileText, byte: usize) -> Point {
+    let row = file_text.byte_to_linecol(byte).line;
+    Point {
+        row,
+        column: byte - file_text.line_start(row),
+    }
+}
+
+/// A file that has been read and parsed, but not yet added to a [Linker]. Parsing doesn't need the [Linker], so it can be done on any thread
+pub struct ParsedFile {
+    pub file_identifier: String,
+    pub text: String,
+    pub tree: Tree,
+}
+
+impl ParsedFile {
+    pub fn parse(file_identifier: String, text: String) -> Self {
+        let mut timer = PhaseTimer::new("parse", || file_identifier.clone());
+        timer.add_counter("bytes", text.len());
+        let tree = parse_sus(&text, None);
+        Self {
+            file_identifier,
+            text,
+            tree,
+        }
+    }
+}
+
+fn read_file(file_path: &Path) -> String {
+    match std::fs::read_to_string(file_path) {
+        Ok(file_text) => file_text,
+        Err(reason) => {
+            let file_path_disp = file_path.display();
+            panic!("Could not open file '{file_path_disp}' because {reason}")
+        }
+    }
+}
+
+/// Sorted, such that files are always added in the same order
+fn sus_files_in_directory(directory: &Path) -> Vec<PathBuf> {
+    let mut files = std::fs::read_dir(directory)
+        .unwrap()
+        .map(|res| res.map(|e| e.path()))
+        .collect::<Result<Vec<_>, std::io::Error>>()
+        .unwrap();
+    files.sort();
+    files
+        .into_iter()
+        .map(|file| file.canonicalize().unwrap())
+        .filter(|file_path| file_path.is_file() && file_path.extension() == Some(OsStr::new("sus")))
+        .collect()
+}
+
+/// The standard library after [Linker::recompile_all_up_to_instantiation], such that the language server's
+/// workspace reloads only have to clone it, instead of recompiling it.
+///
+/// Only kept in memory, so it doesn't speed up the CLI, which compiles the standard library once per run.
+/// Only taken when asked for, see [Linker::add_standard_library]
+struct StdLibSnapshot {
+    /// See [hash_std_lib]
+    content_hash: u64,
+    linker: Linker,
+}
+
+static STD_LIB_SNAPSHOT: Mutex<Option<StdLibSnapshot>> = Mutex::new(None);
+
+/// Covers the compiler version, and the identifiers and contents of all standard library files
+fn hash_std_lib(std_files: &[(String, String)]) -> u64 {
+    let mut hasher = StableHasher::new();
+    hasher.write_str(env!("CARGO_PKG_VERSION"));
+    for (identifier, text) in std_files {
+        hasher.write_str(identifier);
+        hasher.write_str(text);
+    }
+    hasher.finish()
+}
+
 impl Linker {
+    /// Reuses [STD_LIB_SNAPSHOT] if the standard library didn't change since it was taken.
+    /// With `keep_snapshot`, a newly compiled standard library is stored there for the [Linker]s of later workspace reloads
     pub fn add_standard_library<ExtraInfoManager: LinkerExtraFileInfoManager>(
         &mut self,
         info_mngr: &mut ExtraInfoManager,
+        keep_snapshot: bool,
     ) {
         assert!(self.modules.is_empty());
         assert!(self.types.is_empty());
@@ -46,7 +150,43 @@ impl Linker {
         }
         let std_path = PathBuf::from_str(STD_LIB_PATH)
             .expect("Standard library directory is not a valid path?");
-        self.add_all_files_in_directory(&std_path, info_mngr);
+        let std_files: Vec<(String, String)> = sus_files_in_directory(&std_path)
+            .into_iter()
+            .map(|file_path| {
+                (
+                    info_mngr.convert_filename(&file_path),
+                    read_file(&file_path),
+                )
+            })
+            .collect();
+        let content_hash = hash_std_lib(&std_files);
+
+        let mut snapshot = STD_LIB_SNAPSHOT.lock().unwrap();
+        *self = match &*snapshot {
+            Some(snapshot) if snapshot.content_hash == content_hash => snapshot.linker.clone(),
+            _ => {
+                let mut std_linker = Linker::new();
+                let parsed_files = parallel_map(config().jobs, std_files, |(identifier, text)| {
+                    ParsedFile::parse(identifier, text)
+                });
+                for parsed in parsed_files {
+                    std_linker.add_parsed_file(parsed, &mut ());
+                }
+                std_linker.recompile_all_up_to_instantiation();
+                if keep_snapshot {
+                    *snapshot = Some(StdLibSnapshot {
+                        content_hash,
+                        linker: std_linker.clone(),
+                    });
+                }
+                std_linker
+            }
+        };
+        drop(snapshot);
+        let std_file_ids: Vec<FileUUID> = self.files.iter().map(|(id, _)| id).collect();
+        for file_id in std_file_ids {
+            info_mngr.on_file_added(file_id, self);
+        }
 
         // Sanity check for the names the compiler knows internally.
         // They are defined in std/core.sus
@@ -87,20 +227,33 @@ impl Linker {
         directory: &PathBuf,
         info_mngr: &mut ExtraInfoManager,
     ) {
-        let mut files = std::fs::read_dir(directory)
-            .unwrap()
-            .map(|res| res.map(|e| e.path()))
-            .collect::<Result<Vec<_>, std::io::Error>>()
-            .unwrap();
-        files.sort();
-        for file in files {
-            let file_path = file.canonicalize().unwrap();
-            if file_path.is_file() && file_path.extension() == Some(OsStr::new("sus")) {
-                let file_text = std::fs::read_to_string(&file_path).unwrap();
-                let file_identifier: String = info_mngr.convert_filename(&file_path);
-                self.add_file(file_identifier, file_text, info_mngr);
-            }
-        }
+        self.add_files_from_paths(sus_files_in_directory(directory), info_mngr);
+    }
+
+    /// Reads and parses all files in parallel, but adds them to the [Linker] in the order given.
+    ///
+    /// This order is important, as it determines the UUIDs of the files and their globals. See [Self::add_standard_library]
+    pub fn add_files_from_paths<ExtraInfoManager: LinkerExtraFileInfoManager>(
+        &mut self,
+        file_paths: Vec<PathBuf>,
+        info_mngr: &mut ExtraInfoManager,
+    ) -> Vec<FileUUID> {
+        let to_parse: Vec<(PathBuf, String)> = file_paths
+            .into_iter()
+            .map(|file_path| {
+                let file_identifier = info_mngr.convert_filename(&file_path);
+                (file_path, file_identifier)
+            })
+            .collect();
+
+        let parsed_files = parallel_map(config().jobs, to_parse, |(file_path, file_identifier)| {
+            ParsedFile::parse(file_identifier, read_file(&file_path))
+        });
+
+        parsed_files
+            .into_iter()
+            .map(|parsed| self.add_parsed_file(parsed, info_mngr))
+            .collect()
     }
 
     pub fn add_file<ExtraInfoManager: LinkerExtraFileInfoManager>(
@@ -109,16 +262,26 @@ impl Linker {
         text: String,
         info_mngr: &mut ExtraInfoManager,
     ) -> FileUUID {
+        self.add_parsed_file(ParsedFile::parse(file_identifier, text), info_mngr)
+    }
+
+    pub fn add_parsed_file<ExtraInfoManager: LinkerExtraFileInfoManager>(
+        &mut self,
+        parsed: ParsedFile,
+        info_mngr: &mut ExtraInfoManager,
+    ) -> FileUUID {
+        let ParsedFile {
+            file_identifier,
+            text,
+            tree,
+        } = parsed;
+
         // File doesn't yet exist
         assert!(!self
             .files
             .iter()
             .any(|fd| fd.1.file_identifier == file_identifier));
 
-        let mut parser = Parser::new();
-        parser.set_language(&tree_sitter_sus::language()).unwrap();
-        let tree = parser.parse(&text, None).unwrap();
-
         let file_id = self.files.reserve();
         self.files.alloc_reservation(
             file_id,
@@ -132,6 +295,9 @@ impl Linker {
         );
 
         self.with_file_builder(file_id, |builder| {
+            let _timer = PhaseTimer::new("gather_initial_file_data", || {
+                builder.file_data.file_identifier.clone()
+            });
             let mut span_debugger =
                 SpanDebugger::new("gather_initial_file_data in add_file", builder.file_data);
             gather_initial_file_data(builder);
@@ -152,27 +318,68 @@ impl Linker {
         info_mngr: &mut ExtraInfoManager,
     ) {
         if let Some(file_id) = self.find_file(file_identifier) {
-            let file_data = self.remove_everything_in_file(file_id);
+            self.update_file_with_edits(file_id, [(None, text)], info_mngr);
+        } else {
+            self.add_file(file_identifier.to_owned(), text, info_mngr);
+        }
+    }
 
-            let mut parser = Parser::new();
-            parser.set_language(&tree_sitter_sus::language()).unwrap();
-            let tree = parser.parse(&text, None).unwrap();
+    /// Applies text edits to an existing file, and reparses it reusing the previous syntax tree where possible.
+    ///
+    /// The edits are applied in order, each range refers to the text as left by the previous edits. A `None` range replaces the whole text.
+    pub fn update_file_with_edits<ExtraInfoManager: LinkerExtraFileInfoManager>(
+        &mut self,
+        file_id: FileUUID,
+        edits: impl IntoIterator<Item = (Option<Range<LineCol>>, String)>,
+        info_mngr: &mut ExtraInfoManager,
+    ) {
+        let file_data = self.remove_everything_in_file(file_id);
 
-            file_data.parsing_errors = ErrorStore::new();
-            file_data.file_text = FileText::new(text);
-            file_data.tree = tree;
+        let mut can_reuse_tree = true;
+        for (range, new_text) in edits {
+            let Some(range) = range else {
+                file_data.file_text = FileText::new(new_text);
+                can_reuse_tree = false;
+                continue;
+            };
+            let file_text = &mut file_data.file_text;
+            let start_byte = file_text.linecol_to_byte_clamp(range.start);
+            let old_end_byte = file_text.linecol_to_byte_clamp(range.end).max(start_byte);
+            let start_position = byte_to_point(file_text, start_byte);
+            let old_end_position = byte_to_point(file_text, old_end_byte);
 
-            self.with_file_builder(file_id, |builder| {
-                let mut span_debugger =
-                    SpanDebugger::new("gather_initial_file_data in update_file", builder.file_data);
-                gather_initial_file_data(builder);
-                span_debugger.defuse();
-            });
+            file_text.apply_edit(start_byte..old_end_byte, &new_text);
+            let new_end_byte = start_byte + new_text.len();
 
-            info_mngr.on_file_updated(file_id, self);
-        } else {
-            self.add_file(file_identifier.to_owned(), text, info_mngr);
+            file_data.tree.edit(&InputEdit {
+                start_byte,
+                old_end_byte,
+                new_end_byte,
+                start_position,
+                old_end_position,
+                new_end_position: byte_to_point(file_text, new_end_byte),
+            });
         }
+
+        let parse_timer = PhaseTimer::new("parse", || file_data.file_identifier.clone());
+        let old_tree = can_reuse_tree.then_some(&file_data.tree);
+        let tree = parse_sus(&file_data.file_text.file_text, old_tree);
+        drop(parse_timer);
+
+        file_data.parsing_errors = ErrorStore::new();
+        file_data.tree = tree;
+
+        self.with_file_builder(file_id, |builder| {
+            let _timer = PhaseTimer::new("gather_initial_file_data", || {
+                builder.file_data.file_identifier.clone()
+            });
+            let mut span_debugger =
+                SpanDebugger::new("gather_initial_file_data in update_file", builder.file_data);
+            gather_initial_file_data(builder);
+            span_debugger.defuse();
+        });
+
+        info_mngr.on_file_updated(file_id, self);
     }
 
     pub fn find_file(&self, file_identifier: &str) -> Option<FileUUID> {
@@ -180,29 +387,31 @@ impl Linker {
             .find(|_id, f| f.file_identifier == file_identifier)
     }
 
+    /// Recompiles everything that was affected by the files added, updated or removed since the last call.
+    ///
+    /// Globals that don't (transitively) depend on any of the changes keep their flattened code, errors and instantiations.
     pub fn recompile_all(&mut self) {
-        // First reset all modules back to post-gather_initial_file_data
-        for (_, md) in &mut self.modules {
-            let Module {
-                link_info,
-                instantiations,
-                ..
-            } = md;
-            link_info.reset_to(AFTER_INITIAL_PARSE_CP);
-            link_info.instructions.clear();
-            instantiations.clear_instances()
-        }
-        for (_, typ) in &mut self.types {
-            typ.link_info.reset_to(AFTER_INITIAL_PARSE_CP);
-        }
-        for (_, cst) in &mut self.constants {
-            cst.link_info.reset_to(AFTER_INITIAL_PARSE_CP);
-        }
+        let _timer = PhaseTimer::whole_phase("recompile_all");
+        self.recompile_all_up_to_instantiation();
+        self.instantiate_roots(&AtomicBool::new(false));
+    }
+
+    /// Everything [Linker::recompile_all] does before instantiating
+    pub fn recompile_all_up_to_instantiation(&mut self) {
+        self.run_compile_stages();
+        self.update_reference_index();
+    }
+
+    fn run_compile_stages(&mut self) {
+        // First reset all affected globals back to post-gather_initial_file_data
+        self.reset_invalidated_globals();
         if config().early_exit == EarlyExitUpTo::Initialize {
             return;
         }
 
+        let flatten_timer = PhaseTimer::whole_phase("flatten_all_globals");
         flatten_all_globals(self);
+        drop(flatten_timer);
         config().for_each_debug_module(config().debug_print_module_contents, &self.modules, |md| {
             md.print_flattened_module(&self.files[md.link_info.file]);
         });
@@ -210,7 +419,9 @@ impl Linker {
             return;
         }
 
+        let typecheck_timer = PhaseTimer::whole_phase("typecheck_all_modules");
         typecheck_all_modules(self);
+        drop(typecheck_timer);
 
         config().for_each_debug_module(config().debug_print_module_contents, &self.modules, |md| {
             md.print_flattened_module(&self.files[md.link_info.file]);
@@ -219,27 +430,61 @@ impl Linker {
             return;
         }
 
+        let lint_timer = PhaseTimer::whole_phase("perform_lints");
         perform_lints(self);
+        drop(lint_timer);
+    }
+
+    /// The modules in [Linker::instantiation_roots] that can be instantiated on their own, because they have no template parameters
+    pub fn instantiation_root_modules(&self) -> Vec<ModuleUUID> {
+        // Won't be possible once we have template modules
+        self.modules
+            .iter()
+            .filter(|(_id, md)| {
+                md.link_info.template_parameters.is_empty()
+                    && self.instantiation_roots.includes(md, &self.files)
+            })
+            .map(|(id, _md)| id)
+            .collect()
+    }
+
+    /// Instantiates the modules in [Linker::instantiation_roots], and with them all their submodules.
+    ///
+    /// Only needs a shared reference, so the language server can run this in the background while answering requests.
+    /// Stops soon after `cancelled` is set, also in the middle of an instance. Interrupted instances aren't cached, they are instantiated on the next call
+    pub fn instantiate_roots(&self, cancelled: &AtomicBool) {
+        self.instantiate_roots_except(cancelled, |_md| false);
+    }
 
-        if config().early_exit == EarlyExitUpTo::Lint {
+    /// [Linker::instantiate_roots], leaving out the roots for which `skip_root` returns true
+    pub fn instantiate_roots_except(
+        &self,
+        cancelled: &AtomicBool,
+        skip_root: impl Fn(&Module) -> bool,
+    ) {
+        if config().early_exit < EarlyExitUpTo::Instantiate {
             return;
         }
-
-        // Make an initial instantiation of all modules
-        // Won't be possible once we have template modules
-        for (_id, md) in &self.modules {
-            //md.print_flattened_module();
-            // Already instantiate any modules without parameters
-            // Currently this is all modules
+        // Make an initial instantiation of the root modules, see [crate::linker::InstantiationRoots]
+        // Modules that weren't reset are already cached
+        let _instantiate_timer = PhaseTimer::whole_phase("instantiate_all_modules");
+        let linker: &Linker = self;
+        let mut to_instantiate = linker.instantiation_root_modules();
+        to_instantiate.retain(|md_id| !skip_root(&linker.modules[*md_id]));
+        // Submodules shared between these are deduplicated by the [crate::instantiation::InstantiationCache]
+        parallel_map(config().jobs, to_instantiate, |md_id| {
+            if cancelled.load(Ordering::Relaxed) {
+                return;
+            }
+            let md = &linker.modules[md_id];
             let span_debug_message = format!("instantiating {}", &md.link_info.name);
             let mut span_debugger =
-                SpanDebugger::new(&span_debug_message, &self.files[md.link_info.file]);
-            // Can immediately instantiate modules that have no template args
-            if md.link_info.template_parameters.is_empty() {
-                let _inst = md.instantiations.instantiate(md, self, FlatAlloc::new());
-            }
+                SpanDebugger::new(&span_debug_message, &linker.files[md.link_info.file]);
+            let no_template_args = linker.template_args_interner.intern(&FlatAlloc::new());
+            let _inst = md
+                .instantiations
+                .instantiate(md, linker, no_template_args, cancelled);
             span_debugger.defuse();
-        }
-        if config().early_exit == EarlyExitUpTo::Instantiate {}
+        });
     }
 }
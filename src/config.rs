@@ -11,7 +11,9 @@ use std::{
 ///
 /// This is mainly to aid in debugging, where incorrect results from flattening/typechecking may lead to errors,
 /// which we still wish to see in say the LSP
-#[derive(Clone, Copy, Debug, PartialEq, Eq, ValueEnum)]
+///
+/// The stages are ordered, so `config().early_exit < EarlyExitUpTo::Instantiate` means instantiation is skipped
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, ValueEnum)]
 pub enum EarlyExitUpTo {
     Initialize,
     Flatten,
@@ -38,10 +40,27 @@ pub struct ConfigStruct {
     pub debug_print_latency_graph: bool,
     pub debug_whitelist: Option<HashSet<String>>,
     pub codegen_module_and_dependencies_one_file: Option<String>,
+    /// When not empty, only these modules and the modules they use are instantiated
+    pub top_modules: Vec<String>,
     pub early_exit: EarlyExitUpTo,
     pub use_color: bool,
     pub ci: bool,
     pub target_language: TargetLanguage,
+    /// Emit the latency registers of each wire as one packed shift register, instead of a separate register per cycle
+    pub latency_shift_registers: bool,
+    /// Generate a separate output file for every instance, and only write the ones whose contents changed
+    pub file_per_instance: bool,
+    /// Number of worker threads for flattening, typechecking, instantiation and code generation. 1 means everything runs on the main thread
+    pub jobs: usize,
+    /// Directory in which generated code is kept between runs. Instances whose source code and dependencies didn't change reuse it
+    pub cache_dir: Option<PathBuf>,
+    /// See [crate::profiling]
+    pub time_passes: bool,
+    pub time_passes_json: Option<PathBuf>,
+    /// See [crate::mem_report]
+    pub mem_report: bool,
+    /// Keep running after compiling, and recompile whenever one of [Self::files] changes. See [crate::dev_aid::watch]
+    pub watch: bool,
     pub files: Vec<PathBuf>,
 }
 
@@ -93,6 +112,10 @@ fn command_builder() -> Command {
         .arg(Arg::new("standalone")
             .long("standalone")
             .help("Generate standalone code with all dependencies in one file of the module specified."))
+        .arg(Arg::new("top")
+            .long("top")
+            .help("Only instantiate (and generate code for) this module and the modules it uses. Can be given multiple times. Without --codegen, --standalone implies --top")
+            .action(clap::ArgAction::Append))
         .arg(Arg::new("upto")
             .long("upto")
             .help("Describes at what point in the compilation process we should exit early. This is mainly to aid in debugging, where incorrect results from flattening/typechecking may lead to errors, which we still wish to see in say the LSP")
@@ -111,6 +134,46 @@ fn command_builder() -> Command {
             .help("Sets the target HDL")
             .value_parser(clap::builder::EnumValueParser::<TargetLanguage>::new())
             .default_value("system-verilog"))
+        .arg(Arg::new("latency-shift-registers")
+            .long("latency-shift-registers")
+            .help("In SystemVerilog output, emit all latency registers of a wire as a single packed array shift register, instead of a declaration and always_ff block per cycle. Speeds up parsing and elaboration of deeply pipelined designs")
+            .action(clap::ArgAction::SetTrue))
+        .arg(Arg::new("file-per-instance")
+            .long("file-per-instance")
+            .help("Write every instance to its own output file, named after the instance, instead of one file per module. With --standalone, this applies to every instance it depends on. Files whose contents didn't change are not rewritten, such that incremental synthesis and simulation builds don't redo them. Files of instances that no longer exist are removed")
+            .action(clap::ArgAction::SetTrue))
+        .arg(Arg::new("jobs")
+            .long("jobs")
+            .short('j')
+            .help("Number of threads used to flatten, typecheck, instantiate and generate code for independent modules in parallel. Results are merged in a deterministic order")
+            .value_parser(|jobs_int : &str| {
+                match jobs_int.parse::<usize>() {
+                    Ok(0) | Err(_) => Err("Must be a positive number of threads"),
+                    Ok(jobs) => Ok(jobs)
+                }
+            })
+            .default_value("1"))
+        .arg(Arg::new("cache-dir")
+            .long("cache-dir")
+            .help("Directory to cache generated code in between runs. Instances whose module and dependencies didn't change are not generated again, and top modules of which nothing changed are not instantiated either")
+            .value_parser(clap::value_parser!(PathBuf)))
+        .arg(Arg::new("time-passes")
+            .long("time-passes")
+            .help("Print how long each compiler phase took, and which modules and instances took longest")
+            .action(clap::ArgAction::SetTrue))
+        .arg(Arg::new("time-passes-json")
+            .long("time-passes-json")
+            .help("Write the timing of all compiler phases to the given file in the Chrome trace format")
+            .value_parser(clap::value_parser!(PathBuf)))
+        .arg(Arg::new("mem-report")
+            .long("mem-report")
+            .help("Print an estimate of the memory held by each file, module and instance once compilation is done")
+            .action(clap::ArgAction::SetTrue))
+        .arg(Arg::new("watch")
+            .long("watch")
+            .help("Keep running after compiling, and recompile whenever one of the files changes. Only the affected modules are recompiled, and only the output files of modules that changed are rewritten")
+            .conflicts_with("lsp")
+            .action(clap::ArgAction::SetTrue))
         .arg(Arg::new("files")
             .action(clap::ArgAction::Append)
             .help(".sus Files")
@@ -147,8 +210,20 @@ where
     let use_color = !matches.get_flag("nocolor") && !use_lsp;
     let early_exit = *matches.get_one("upto").unwrap();
     let codegen_module_and_dependencies_one_file = matches.get_one("standalone").cloned();
+    let top_modules = matches
+        .get_many("top")
+        .map(|s| s.cloned().collect())
+        .unwrap_or_default();
     let ci = matches.get_flag("ci");
     let target_language = *matches.get_one("target").unwrap();
+    let latency_shift_registers = matches.get_flag("latency-shift-registers");
+    let file_per_instance = matches.get_flag("file-per-instance");
+    let jobs = *matches.get_one("jobs").unwrap();
+    let cache_dir = matches.get_one("cache-dir").cloned();
+    let time_passes = matches.get_flag("time-passes");
+    let time_passes_json = matches.get_one("time-passes-json").cloned();
+    let mem_report = matches.get_flag("mem-report");
+    let watch = matches.get_flag("watch");
     let file_paths: Vec<PathBuf> = match matches.get_many("files") {
         Some(files) => files.cloned().collect(),
         None => std::fs::read_dir(".")
@@ -168,10 +243,19 @@ where
         debug_print_latency_graph,
         debug_whitelist,
         codegen_module_and_dependencies_one_file,
+        top_modules,
         early_exit,
         use_color,
         ci,
         target_language,
+        latency_shift_registers,
+        file_per_instance,
+        jobs,
+        cache_dir,
+        time_passes,
+        time_passes_json,
+        mem_report,
+        watch,
         files: file_paths,
     })
 }
@@ -179,6 +263,11 @@ where
 /// Access the singleton [ConfigStruct] representing the CLI arguments passed to `sus_compiler`
 pub fn config() -> &'static ConfigStruct {
     static CONFIG: LazyLock<ConfigStruct> = LazyLock::new(|| {
+        // The arguments of the test harness (filters, --ignored, ...) aren't meant for us
+        #[cfg(test)]
+        return parse_args([""]).unwrap();
+
+        #[cfg(not(test))]
         parse_args(std::env::args_os())
             .map_err(|err| err.exit())
             .unwrap()
@@ -220,6 +309,25 @@ mod tests {
         assert!(!config.use_color)
     }
 
+    #[test]
+    fn test_watch_conflicts_with_lsp() {
+        let config = parse_args(["", "--lsp", "--watch"]);
+        assert!(config.is_err());
+        let err = config.unwrap_err();
+        assert_eq!(err.kind(), clap::error::ErrorKind::ArgumentConflict);
+    }
+
+    #[test]
+    fn test_jobs_must_be_positive() {
+        let config = parse_args(["", "--jobs", "0"]);
+        assert!(config.is_err());
+        let err = config.unwrap_err();
+        assert_eq!(err.kind(), clap::error::ErrorKind::ValueValidation);
+
+        let config = parse_args(["", "-j", "8"]).unwrap();
+        assert_eq!(config.jobs, 8)
+    }
+
     #[test]
     fn test_automatic_codegen() {
         let config = parse_args([""]).unwrap();
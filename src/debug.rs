@@ -15,6 +15,7 @@ const DEFAULT_RANGE: Range<usize> = usize::MAX..usize::MAX;
 /// Would like to use [crate::file_position::Span], but cannot copy the span because that would create infinite loop.
 ///
 /// So use [Range] instead.
+#[cfg(any(debug_assertions, feature = "span-history"))]
 pub fn add_debug_span(span_rng: Range<usize>) {
     // Convert to range so we don't invoke any of Span's triggers
     SPANS_HISTORY.with_borrow_mut(|history| {
@@ -25,6 +26,11 @@ pub fn add_debug_span(span_rng: Range<usize>) {
     });
 }
 
+/// Release builds without the `span-history` feature don't keep the history
+#[cfg(not(any(debug_assertions, feature = "span-history")))]
+#[inline(always)]
+pub fn add_debug_span(_span_rng: Range<usize>) {}
+
 struct TouchedSpansHistory {
     span_history: [Range<usize>; SPAN_TOUCH_HISTORY_SIZE],
     num_spans: usize,
@@ -41,6 +47,10 @@ thread_local! {
 }
 
 fn print_most_recent_spans(file_data: &FileData) {
+    if cfg!(not(any(debug_assertions, feature = "span-history"))) {
+        println!("Panic unwinding. No spans to print, this build doesn't have the `span-history` feature");
+        return;
+    }
     let spans_to_print: Vec<Range<usize>> = SPANS_HISTORY.with_borrow_mut(|history| {
         assert!(history.in_use);
 
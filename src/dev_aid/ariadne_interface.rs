@@ -1,14 +1,18 @@
+use std::collections::HashSet;
 use std::path::Path;
+use std::sync::atomic::AtomicBool;
 use std::{ops::Range, path::PathBuf};
 
+use crate::codegen::{disk_cache::CachedHierarchies, CodeGenBackend};
 use crate::compiler_top::LinkerExtraFileInfoManager;
-use crate::linker::FileData;
+use crate::linker::{FileData, InstantiationRoots};
 use crate::prelude::*;
 
 use crate::{
     alloc::ArenaVector,
     config::config,
     errors::{CompileError, ErrorLevel},
+    profiling::PhaseTimer,
 };
 
 use ariadne::*;
@@ -75,32 +79,62 @@ impl LinkerExtraFileInfoManager for FileSourcesManager {
     }
 }
 
-pub fn compile_all(file_paths: Vec<PathBuf>) -> (Linker, FileSourcesManager) {
+/// Roots of which the whole hierarchy is in [crate::config::ConfigStruct::cache_dir] aren't instantiated. Their code is returned instead
+pub fn compile_all(
+    file_paths: Vec<PathBuf>,
+    codegen_backend: &dyn CodeGenBackend,
+) -> (Linker, FileSourcesManager, CachedHierarchies) {
     let mut linker = Linker::new();
     let mut file_source_manager = FileSourcesManager {
         file_sources: ArenaVector::new(),
     };
-    linker.add_standard_library(&mut file_source_manager);
-
-    for file_path in file_paths {
-        let file_text = match std::fs::read_to_string(&file_path) {
-            Ok(file_text) => file_text,
-            Err(reason) => {
-                let file_path_disp = file_path.display();
-                panic!("Could not open file '{file_path_disp}' for syntax highlighting because {reason}")
-            }
-        };
-
-        linker.add_file(
-            file_path.to_string_lossy().into_owned(),
-            file_text,
-            &mut file_source_manager,
-        );
-    }
+    linker.add_standard_library(&mut file_source_manager, false);
+
+    linker.add_files_from_paths(file_paths, &mut file_source_manager);
+    exit_on_unknown_top_modules(&linker);
+
+    linker.instantiation_roots = instantiation_roots_from_config();
 
-    linker.recompile_all();
+    let recompile_timer = PhaseTimer::whole_phase("recompile_all");
+    linker.recompile_all_up_to_instantiation();
+    let cached = CachedHierarchies::load(&linker, codegen_backend.file_extension());
+    linker.instantiate_roots_except(&AtomicBool::new(false), |md| cached.contains_root(md));
+    drop(recompile_timer);
 
-    (linker, file_source_manager)
+    (linker, file_source_manager, cached)
+}
+
+/// Module names are known as soon as the files are added, so a misspelled `--top` module doesn't have to wait for the whole compilation
+fn exit_on_unknown_top_modules(linker: &Linker) {
+    for md_name in &config().top_modules {
+        if !linker
+            .modules
+            .iter()
+            .any(|(_, md)| &md.link_info.name == md_name)
+        {
+            eprintln!("Unknown module {md_name}");
+            std::process::exit(1);
+        }
+    }
+}
+
+/// With `--top`, or with `--standalone` when not generating code for all modules, only those modules need to be instantiated
+fn instantiation_roots_from_config() -> InstantiationRoots {
+    let config = config();
+    let mut roots: HashSet<String> = config.top_modules.iter().cloned().collect();
+    if !config.codegen {
+        roots.extend(
+            config
+                .codegen_module_and_dependencies_one_file
+                .iter()
+                .cloned(),
+        );
+    }
+    if roots.is_empty() {
+        InstantiationRoots::AllModules
+    } else {
+        InstantiationRoots::Named(roots)
+    }
 }
 
 fn ariadne_config() -> Config {
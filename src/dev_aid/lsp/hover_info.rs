@@ -60,14 +60,15 @@ impl HoverCollector<'_> {
                     };
                     self.monospace(value_str);
                 } else {
-                    for (_id, wire) in &inst.wires {
+                    for (wire_id, wire) in &inst.wires {
                         if wire.original_instruction != id {
                             continue;
                         }
-                        let typ_str = wire.typ.display(&self.linker.types);
+                        let typ_str = inst.wire_types[wire_id].display(&self.linker.types);
                         let name_str = &wire.name;
-                        let latency_str = if wire.absolute_latency != CALCULATE_LATENCY_LATER {
-                            format!("{}", wire.absolute_latency)
+                        let latency = inst.wire_latencies[wire_id];
+                        let latency_str = if latency != CALCULATE_LATENCY_LATER {
+                            format!("{latency}")
                         } else {
                             "?".to_owned()
                         };
@@ -86,7 +87,7 @@ impl HoverCollector<'_> {
                 }
                 self.sus_code(pretty_print_concrete_instance(
                     &submodule.link_info,
-                    &sm.template_args,
+                    sm.template_args(),
                     &self.linker.types,
                 ));
             }
@@ -2,12 +2,30 @@ mod hover_info;
 mod semantic_tokens;
 mod tree_walk;
 
-use crate::{compiler_top::LinkerExtraFileInfoManager, linker::GlobalUUID, prelude::*};
+use crate::{
+    compiler_top::LinkerExtraFileInfoManager,
+    linker::{GlobalUUID, InstantiationRoots},
+    mem_report::MemoryReport,
+    prelude::*,
+};
 
 use hover_info::hover;
 use lsp_types::{notification::*, request::Request, *};
-use semantic_tokens::{make_semantic_tokens, semantic_token_capabilities};
-use std::{collections::HashMap, error::Error, net::SocketAddr, path::Path};
+use semantic_tokens::{
+    make_semantic_tokens_in_range, semantic_token_capabilities, SemanticTokensCache,
+};
+use std::{
+    collections::{HashMap, HashSet},
+    error::Error,
+    hash::{DefaultHasher, Hash, Hasher},
+    net::SocketAddr,
+    path::Path,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex, RwLock,
+    },
+    thread::JoinHandle,
+};
 
 use crate::{
     config::config,
@@ -78,11 +96,13 @@ impl Linker {
     fn find_uri(&self, uri: &Url) -> Option<FileUUID> {
         self.find_file(uri.as_str())
     }
+    /// Instantiation is left to [BackgroundInstantiation]
     fn update_text(&mut self, uri: &Url, new_file_text: String, manager: &mut LSPFileManager) {
         self.add_or_update_file(uri.as_str(), new_file_text, manager);
 
-        self.recompile_all();
+        self.recompile_all_up_to_instantiation();
     }
+    /// Instantiation is left to [BackgroundInstantiation]
     fn ensure_contains_file(&mut self, uri: &Url, manager: &mut LSPFileManager) -> FileUUID {
         if let Some(found) = self.find_uri(uri) {
             found
@@ -90,16 +110,20 @@ impl Linker {
             let file_text = std::fs::read_to_string(uri.to_file_path().unwrap()).unwrap();
 
             let file_uuid = self.add_file(uri.to_string(), file_text, manager);
-            self.recompile_all();
+            self.recompile_all_up_to_instantiation();
             file_uuid
         }
     }
+    /// Requests are only handled once their file is loaded, see [main_loop]
+    fn loaded_file(&self, uri: &Url) -> FileUUID {
+        self.find_uri(uri)
+            .expect("The file of a request is loaded before handling it")
+    }
     fn location_in_file(
-        &mut self,
+        &self,
         text_pos: &lsp_types::TextDocumentPositionParams,
-        manager: &mut LSPFileManager,
     ) -> (FileUUID, usize) {
-        let file_id = self.ensure_contains_file(&text_pos.text_document.uri, manager);
+        let file_id = self.loaded_file(&text_pos.text_document.uri);
         let file_data = &self.files[file_id];
 
         let position = file_data
@@ -163,29 +187,156 @@ fn convert_diagnostic(
 fn push_all_errors(
     connection: &lsp_server::Connection,
     linker: &Linker,
+    published: &Mutex<PublishedDiagnostics>,
 ) -> Result<(), Box<dyn Error + Sync + Send>> {
-    for (file_id, file_data) in &linker.files {
-        let mut diag_vec: Vec<Diagnostic> = Vec::new();
+    for notification in published.lock().unwrap().make_notifications(linker) {
+        connection
+            .sender
+            .send(lsp_server::Message::Notification(notification))?;
+    }
+    Ok(())
+}
+
+/// Hashes the byte spans, levels and messages of the errors in the file, without converting any span to a line and column.
+/// Errors are combined without regard for their order, as instance errors aren't reported in a fixed order
+///
+/// The same byte span can be on another line after an edit, so this alone doesn't tell whether the diagnostics of an edited file are unchanged.
+/// Also returns whether the errors point into one of `edited_files`
+fn errors_fingerprint(
+    linker: &Linker,
+    file_id: FileUUID,
+    edited_files: &HashSet<String>,
+) -> (u64, bool) {
+    let mut fingerprint: u64 = 0;
+    let mut points_into_edited = edited_files.contains(&linker.files[file_id].file_identifier);
+    linker.for_all_errors_in_file(file_id, |err| {
+        let mut hasher = DefaultHasher::new();
+        err.position.hash(&mut hasher);
+        err.level.hash(&mut hasher);
+        err.reason.hash(&mut hasher);
+        for info in &err.infos {
+            let info_identifier = &linker.files[info.file].file_identifier;
+            points_into_edited |= edited_files.contains(info_identifier);
+            info_identifier.hash(&mut hasher);
+            info.position.hash(&mut hasher);
+            info.info.hash(&mut hasher);
+        }
+        fingerprint = fingerprint.wrapping_add(hasher.finish());
+    });
+    (fingerprint, points_into_edited)
+}
+
+fn make_diagnostics_notification(
+    file_identifier: &str,
+    diagnostics: Vec<Diagnostic>,
+) -> lsp_server::Notification {
+    let params = &PublishDiagnosticsParams {
+        uri: Url::parse(file_identifier).unwrap(),
+        diagnostics,
+        version: None,
+    };
+    lsp_server::Notification {
+        method: PublishDiagnostics::METHOD.to_owned(),
+        params: serde_json::to_value(params).unwrap(),
+    }
+}
 
-        linker.for_all_errors_in_file(file_id, |err| {
-            diag_vec.push(convert_diagnostic(err, &file_data.file_text, linker));
+/// The [errors_fingerprint] of the diagnostics last published for each file.
+/// Editing one file usually leaves the errors of most other files as they were, and those aren't sent again
+#[derive(Default)]
+struct PublishedDiagnostics {
+    fingerprints: HashMap<String, u64>,
+    /// Files whose text changed since the last [Self::make_notifications]. Diagnostics pointing into them are always sent again
+    edited_files: HashSet<String>,
+}
+
+impl PublishedDiagnostics {
+    fn mark_edited(&mut self, file_identifier: &str) {
+        self.edited_files.insert(file_identifier.to_owned());
+    }
+
+    /// Diagnostics for the files whose errors changed since the last call. Only the spans of those are converted to lines and columns.
+    /// Files that were removed from the linker get their diagnostics cleared
+    fn make_notifications(&mut self, linker: &Linker) -> Vec<lsp_server::Notification> {
+        let mut notifications = Vec::new();
+        let mut fingerprints = HashMap::with_capacity(linker.files.len());
+        for (file_id, file_data) in &linker.files {
+            let (fingerprint, points_into_edited) =
+                errors_fingerprint(linker, file_id, &self.edited_files);
+            if self.fingerprints.remove(&file_data.file_identifier) != Some(fingerprint)
+                || points_into_edited
+            {
+                let mut diag_vec: Vec<Diagnostic> = Vec::new();
+                linker.for_all_errors_in_file(file_id, |err| {
+                    diag_vec.push(convert_diagnostic(err, &file_data.file_text, linker));
+                });
+                notifications.push(make_diagnostics_notification(
+                    &file_data.file_identifier,
+                    diag_vec,
+                ));
+            }
+            fingerprints.insert(file_data.file_identifier.clone(), fingerprint);
+        }
+        for removed_file in self.fingerprints.keys() {
+            notifications.push(make_diagnostics_notification(removed_file, Vec::new()));
+        }
+        self.fingerprints = fingerprints;
+        self.edited_files.clear();
+        notifications
+    }
+}
+
+/// Instantiating is by far the slowest part of compiling. So after an edit, the language server only recompiles up to instantiation
+/// itself, and leaves instantiation to a worker thread. Requests are answered in the meantime,
+/// from the freshly flattened code and whichever instances are done already.
+///
+/// The next edit cancels the worker before modifying the [Linker]. The worker stops within an instruction or so,
+/// and throws away the instances it was still building, see [Linker::instantiate_roots]
+struct BackgroundInstantiation {
+    cancelled: Arc<AtomicBool>,
+    worker: JoinHandle<()>,
+}
+
+impl BackgroundInstantiation {
+    /// Pushes the errors that changed once instantiation is complete
+    fn start(
+        linker: &Arc<RwLock<Linker>>,
+        connection: &lsp_server::Connection,
+        published: &Arc<Mutex<PublishedDiagnostics>>,
+    ) -> Self {
+        let cancelled = Arc::new(AtomicBool::new(false));
+        let worker_cancelled = cancelled.clone();
+        let linker = linker.clone();
+        let sender = connection.sender.clone();
+        let published = published.clone();
+        let worker = std::thread::spawn(move || {
+            let linker = linker.read().unwrap();
+            linker.instantiate_roots(&worker_cancelled);
+            if !worker_cancelled.load(Ordering::Relaxed) {
+                let notifications = published.lock().unwrap().make_notifications(&linker);
+                for notification in notifications {
+                    // Only fails when the connection is closing down
+                    let _ = sender.send(lsp_server::Message::Notification(notification));
+                }
+            }
         });
+        Self { cancelled, worker }
+    }
 
-        let params = &PublishDiagnosticsParams {
-            uri: Url::parse(&file_data.file_identifier).unwrap(),
-            diagnostics: diag_vec,
-            version: None,
-        };
-        let params_json = serde_json::to_value(params)?;
-
-        connection.sender.send(lsp_server::Message::Notification(
-            lsp_server::Notification {
-                method: PublishDiagnostics::METHOD.to_owned(),
-                params: params_json,
-            },
-        ))?;
+    /// Returns once the worker has stopped, such that the [Linker] can be modified again.
+    /// Returns true if it hadn't finished yet, and so has to be started again
+    fn cancel(self) -> bool {
+        let was_unfinished = !self.worker.is_finished();
+        self.cancelled.store(true, Ordering::Relaxed);
+        self.worker.join().unwrap();
+        was_unfinished
     }
-    Ok(())
+}
+
+/// Most requests have a `textDocument`, of which the file must be loaded before the request can be answered
+fn request_document_uri(params: &serde_json::Value) -> Option<Url> {
+    let uri = params.get("textDocument")?.get("uri")?.as_str()?;
+    Url::parse(uri).ok()
 }
 
 struct LSPFileManager {}
@@ -200,7 +351,10 @@ fn initialize_all_files(init_params: &InitializeParams) -> (Linker, LSPFileManag
     let mut linker = Linker::new();
     let mut manager = LSPFileManager {};
 
-    linker.add_standard_library(&mut manager);
+    // Every workspace reload makes a new linker
+    linker.add_standard_library(&mut manager, true);
+    // Only what the open files need is instantiated, see [handle_notification]
+    linker.instantiation_roots = InstantiationRoots::InFiles(HashSet::new());
 
     if let Some(workspace_folder) = &init_params.workspace_folders {
         for folder in workspace_folder {
@@ -300,6 +454,18 @@ fn gather_all_references_in_one_file(linker: &Linker, file_id: FileUUID, pos: us
     }
 }
 
+/// The global that a global, port, interface or parameter reference refers to.
+/// All references to it lie within this global or the globals that referenced it, see [crate::linker::ReferenceIndex]
+fn owning_global(refers_to: &RefersTo) -> Option<GlobalUUID> {
+    refers_to
+        .global
+        .or(refers_to.port.map(|(md_id, _)| GlobalUUID::Module(md_id)))
+        .or(refers_to
+            .interface
+            .map(|(md_id, _)| GlobalUUID::Module(md_id)))
+        .or(refers_to.parameter.map(|(global, _)| global))
+}
+
 fn gather_all_references_across_all_files(
     linker: &Linker,
     file_id: FileUUID,
@@ -309,15 +475,22 @@ fn gather_all_references_across_all_files(
 
     if let Some((location, hover_info)) = get_selected_object(linker, file_id, pos) {
         let refers_to = RefersTo::from(hover_info);
-        if refers_to.is_global() {
-            for (other_file_id, other_file) in &linker.files {
-                let found_refs = gather_references_in_file(linker, other_file, refers_to);
-                for r in &found_refs {
-                    assert!(location.size() == r.size())
-                }
-                if !found_refs.is_empty() {
-                    ref_locations.push((other_file_id, found_refs))
-                }
+        if let Some(owner) = owning_global(&refers_to) {
+            let mut refs_per_file: HashMap<FileUUID, Vec<Span>> = HashMap::new();
+            let candidates =
+                std::iter::once(owner).chain(linker.reference_index.referenced_by(owner, linker));
+            for global in candidates {
+                let global_file = linker.get_link_info(global).file;
+                tree_walk::visit_all_in_module(linker, global, |span, info| {
+                    if refers_to.refers_to_same_as(info) {
+                        assert!(location.size() == span.size());
+                        refs_per_file.entry(global_file).or_default().push(span);
+                    }
+                });
+            }
+            for (other_file_id, mut found_refs) in refs_per_file {
+                found_refs.sort();
+                ref_locations.push((other_file_id, found_refs))
             }
         } else if let Some(local) = refers_to.local {
             let found_refs = for_each_local_reference_in_global(linker, local.0, local.1);
@@ -332,11 +505,14 @@ fn gather_all_references_across_all_files(
     ref_locations
 }
 
+/// Custom request without parameters. Answered with the text of a [MemoryReport], to find out where a long-running server's memory goes
+const MEMORY_REPORT_METHOD: &str = "sus/memoryReport";
+
 fn handle_request(
     method: &str,
     params: serde_json::Value,
-    linker: &mut Linker,
-    manager: &mut LSPFileManager,
+    linker: &Linker,
+    semantic_tokens_cache: &mut SemanticTokensCache,
 ) -> Result<serde_json::Value, serde_json::Error> {
     match method {
         request::HoverRequest::METHOD => {
@@ -344,8 +520,7 @@ fn handle_request(
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
             println!("HoverRequest");
 
-            let (file_uuid, pos) =
-                linker.location_in_file(&params.text_document_position_params, manager);
+            let (file_uuid, pos) = linker.location_in_file(&params.text_document_position_params);
             let file_data = &linker.files[file_uuid];
             let mut hover_list: Vec<MarkedString> = Vec::new();
 
@@ -370,8 +545,7 @@ fn handle_request(
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
             println!("GotoDefinition");
 
-            let (file_uuid, pos) =
-                linker.location_in_file(&params.text_document_position_params, manager);
+            let (file_uuid, pos) = linker.location_in_file(&params.text_document_position_params);
 
             let mut goto_definition_list: Vec<SpanFile> = Vec::new();
 
@@ -420,19 +594,42 @@ fn handle_request(
             let params: SemanticTokensParams =
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
 
-            let uuid = linker.ensure_contains_file(&params.text_document.uri, manager);
+            let uuid = linker.loaded_file(&params.text_document.uri);
 
-            serde_json::to_value(SemanticTokensResult::Tokens(make_semantic_tokens(
-                uuid, linker,
-            )))
+            serde_json::to_value(SemanticTokensResult::Tokens(
+                semantic_tokens_cache.full(uuid, linker),
+            ))
+        }
+        request::SemanticTokensFullDeltaRequest::METHOD => {
+            println!("SemanticTokensFullDeltaRequest: {params}");
+            let params: SemanticTokensDeltaParams =
+                serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
+
+            let uuid = linker.loaded_file(&params.text_document.uri);
+
+            serde_json::to_value(semantic_tokens_cache.full_delta(
+                uuid,
+                linker,
+                &params.previous_result_id,
+            ))
+        }
+        request::SemanticTokensRangeRequest::METHOD => {
+            println!("SemanticTokensRangeRequest: {params}");
+            let params: SemanticTokensRangeParams =
+                serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
+
+            let uuid = linker.loaded_file(&params.text_document.uri);
+
+            serde_json::to_value(SemanticTokensRangeResult::Tokens(
+                make_semantic_tokens_in_range(uuid, params.range, linker),
+            ))
         }
         request::DocumentHighlightRequest::METHOD => {
             let params: DocumentHighlightParams =
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
             println!("DocumentHighlight");
 
-            let (file_id, pos) =
-                linker.location_in_file(&params.text_document_position_params, manager);
+            let (file_id, pos) = linker.location_in_file(&params.text_document_position_params);
             let file_data = &linker.files[file_id];
 
             let ref_locations = gather_all_references_in_one_file(linker, file_id, pos);
@@ -451,7 +648,7 @@ fn handle_request(
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
             println!("FindAllReferences");
 
-            let (file_id, pos) = linker.location_in_file(&params.text_document_position, manager);
+            let (file_id, pos) = linker.location_in_file(&params.text_document_position);
 
             let ref_locations = gather_all_references_across_all_files(linker, file_id, pos);
 
@@ -462,7 +659,7 @@ fn handle_request(
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
             println!("Rename");
 
-            let (file_id, pos) = linker.location_in_file(&params.text_document_position, manager);
+            let (file_id, pos) = linker.location_in_file(&params.text_document_position);
 
             let ref_locations_lists = gather_all_references_across_all_files(linker, file_id, pos);
 
@@ -496,13 +693,16 @@ fn handle_request(
                 serde_json::from_value(params).expect("JSON Encoding Error while parsing params");
             println!("Completion");
 
-            let (file_uuid, position) =
-                linker.location_in_file(&params.text_document_position, manager);
+            let (file_uuid, position) = linker.location_in_file(&params.text_document_position);
 
             serde_json::to_value(CompletionResponse::Array(gather_completions(
                 linker, file_uuid, position,
             )))
         }
+        MEMORY_REPORT_METHOD => {
+            println!("MemoryReport");
+            serde_json::to_value(MemoryReport::new(linker).to_string())
+        }
         req => {
             println!("Other request: {req:?}");
             Ok(serde_json::Value::Null)
@@ -516,32 +716,116 @@ fn handle_notification(
     linker: &mut Linker,
     manager: &mut LSPFileManager,
     initialize_params: &InitializeParams,
-) -> Result<(), Box<dyn Error + Sync + Send>> {
-    match notification.method.as_str() {
+    published: &Mutex<PublishedDiagnostics>,
+) -> Result<bool, Box<dyn Error + Sync + Send>> {
+    // Whether [BackgroundInstantiation] has to run again
+    let needs_instantiation = match notification.method.as_str() {
         notification::DidChangeTextDocument::METHOD => {
             println!("DidChangeTextDocument");
             let params: DidChangeTextDocumentParams = serde_json::from_value(notification.params)
                 .expect("JSON Encoding Error while parsing params");
 
-            let mut content_change_iter = params.content_changes.into_iter();
-            let only_change = content_change_iter.next().unwrap();
-            assert!(content_change_iter.next().is_none());
-            assert!(only_change.range.is_none());
-            linker.update_text(&params.text_document.uri, only_change.text, manager);
+            let file_id = linker.ensure_contains_file(&params.text_document.uri, manager);
+            let edits = params.content_changes.into_iter().map(|change| {
+                let range = change
+                    .range
+                    .map(|range| from_position(range.start)..from_position(range.end));
+                (range, change.text)
+            });
+            linker.update_file_with_edits(file_id, edits, manager);
+            linker.recompile_all_up_to_instantiation();
+            published
+                .lock()
+                .unwrap()
+                .mark_edited(params.text_document.uri.as_str());
+
+            push_all_errors(connection, linker, published)?;
+            true
+        }
+        notification::DidOpenTextDocument::METHOD => {
+            println!("DidOpenTextDocument");
+            let params: DidOpenTextDocumentParams = serde_json::from_value(notification.params)
+                .expect("JSON Encoding Error while parsing params");
 
-            push_all_errors(connection, linker)?;
+            if let InstantiationRoots::InFiles(open_files) = &mut linker.instantiation_roots {
+                open_files.insert(params.text_document.uri.to_string());
+            }
+            // The editor's text may differ from what we read from disk
+            linker.update_text(
+                &params.text_document.uri,
+                params.text_document.text,
+                manager,
+            );
+            published
+                .lock()
+                .unwrap()
+                .mark_edited(params.text_document.uri.as_str());
+
+            push_all_errors(connection, linker, published)?;
+            true
         }
         notification::DidChangeWatchedFiles::METHOD => {
             println!("Workspace Files modified");
+            let instantiation_roots = std::mem::take(&mut linker.instantiation_roots);
             (*linker, *manager) = initialize_all_files(initialize_params);
+            // Files that are open in the editor are still open
+            linker.instantiation_roots = instantiation_roots;
+            // Any file may have changed on disk
+            let mut published_lock = published.lock().unwrap();
+            for (_id, file_data) in &linker.files {
+                published_lock.mark_edited(&file_data.file_identifier);
+            }
+            drop(published_lock);
 
-            push_all_errors(connection, linker)?;
+            push_all_errors(connection, linker, published)?;
+            true
+        }
+        other => {
+            println!("got other notification: {other:?}");
+            false
+        }
+    };
+    Ok(needs_instantiation)
+}
+
+/// The other notifications are handled by [handle_passive_notification], without waiting for [BackgroundInstantiation]
+fn modifies_linker(notification_method: &str) -> bool {
+    matches!(
+        notification_method,
+        notification::DidChangeTextDocument::METHOD
+            | notification::DidOpenTextDocument::METHOD
+            | notification::DidChangeWatchedFiles::METHOD
+    )
+}
+
+/// Closed files are collected in `closed_files`, and only removed from [Linker::instantiation_roots] by [apply_closed_files]
+fn handle_passive_notification(
+    notification: lsp_server::Notification,
+    closed_files: &mut Vec<String>,
+) {
+    match notification.method.as_str() {
+        notification::DidCloseTextDocument::METHOD => {
+            println!("DidCloseTextDocument");
+            let params: DidCloseTextDocumentParams = serde_json::from_value(notification.params)
+                .expect("JSON Encoding Error while parsing params");
+
+            closed_files.push(params.text_document.uri.to_string());
         }
         other => {
             println!("got other notification: {other:?}");
         }
     }
-    Ok(())
+}
+
+/// Instances that were already made stay cached, the closed files just no longer need new ones
+fn apply_closed_files(linker: &mut Linker, closed_files: &mut Vec<String>) {
+    if let InstantiationRoots::InFiles(open_files) = &mut linker.instantiation_roots {
+        for closed_file in closed_files.drain(..) {
+            open_files.remove(&closed_file);
+        }
+    } else {
+        closed_files.clear();
+    }
 }
 
 fn main_loop(
@@ -553,9 +837,21 @@ fn main_loop(
 
     let initialize_params: InitializeParams = serde_json::from_value(initialize_params).unwrap();
 
-    let (mut linker, mut manager) = initialize_all_files(&initialize_params);
+    let (linker, mut manager) = initialize_all_files(&initialize_params);
 
-    push_all_errors(&connection, &linker)?;
+    let published = Arc::new(Mutex::new(PublishedDiagnostics::default()));
+    push_all_errors(&connection, &linker, &published)?;
+
+    // Requests only need to read the linker, so they are answered while instantiation runs in the background
+    let linker = Arc::new(RwLock::new(linker));
+    let mut background_instantiation = Some(BackgroundInstantiation::start(
+        &linker,
+        &connection,
+        &published,
+    ));
+    let mut semantic_tokens_cache = SemanticTokensCache::default();
+    // Closing a file doesn't interrupt instantiation. It is applied the next time the linker is modified
+    let mut closed_files: Vec<String> = Vec::new();
 
     println!("starting LSP main loop");
     for msg in &connection.receiver {
@@ -563,11 +859,36 @@ fn main_loop(
             lsp_server::Message::Request(req) => {
                 if connection.handle_shutdown(&req)? {
                     println!("Shutdown request");
+                    if let Some(background) = background_instantiation.take() {
+                        background.cancel();
+                    }
                     return Ok(());
                 }
 
-                let response_value =
-                    handle_request(&req.method, req.params, &mut linker, &mut manager);
+                if let Some(uri) = request_document_uri(&req.params) {
+                    if linker.read().unwrap().find_uri(&uri).is_none() {
+                        if let Some(background) = background_instantiation.take() {
+                            background.cancel();
+                        }
+                        let mut linker = linker.write().unwrap();
+                        apply_closed_files(&mut linker, &mut closed_files);
+                        linker.ensure_contains_file(&uri, &mut manager);
+                        drop(linker);
+                        semantic_tokens_cache.invalidate();
+                        background_instantiation = Some(BackgroundInstantiation::start(
+                            &linker,
+                            &connection,
+                            &published,
+                        ));
+                    }
+                }
+
+                let response_value = handle_request(
+                    &req.method,
+                    req.params,
+                    &linker.read().unwrap(),
+                    &mut semantic_tokens_cache,
+                );
 
                 let result = response_value.unwrap();
                 let response = lsp_server::Response {
@@ -582,19 +903,40 @@ fn main_loop(
             lsp_server::Message::Response(resp) => {
                 println!("got response: {resp:?}");
             }
+            lsp_server::Message::Notification(notification)
+                if !modifies_linker(&notification.method) =>
+            {
+                handle_passive_notification(notification, &mut closed_files);
+            }
             lsp_server::Message::Notification(notification) => {
-                handle_notification(
+                // A newer edit supersedes the instantiation that is still running
+                let was_unfinished = background_instantiation
+                    .take()
+                    .is_some_and(|background| background.cancel());
+                let mut linker_mut = linker.write().unwrap();
+                apply_closed_files(&mut linker_mut, &mut closed_files);
+                let needs_instantiation = handle_notification(
                     &connection,
                     notification,
-                    &mut linker,
+                    &mut linker_mut,
                     &mut manager,
                     &initialize_params,
+                    &published,
                 )?;
+                drop(linker_mut);
+                semantic_tokens_cache.invalidate();
+                if needs_instantiation || was_unfinished {
+                    background_instantiation = Some(BackgroundInstantiation::start(
+                        &linker,
+                        &connection,
+                        &published,
+                    ));
+                }
             }
         }
 
         println!("All loaded files:");
-        for (_id, file) in &linker.files {
+        for (_id, file) in &linker.read().unwrap().files {
             println!("File: {}", &file.file_identifier);
         }
     }
@@ -625,7 +967,11 @@ pub fn lsp_main() -> Result<(), Box<dyn Error + Sync + Send>> {
             resolve_provider: Some(true),
             ..Default::default()
         }),
-        text_document_sync: Some(TextDocumentSyncCapability::Kind(TextDocumentSyncKind::FULL)),
+        text_document_sync: Some(TextDocumentSyncCapability::Kind(
+            TextDocumentSyncKind::INCREMENTAL,
+        )),
+        // The default, but stated explicitly as [LineCol] depends on it
+        position_encoding: Some(PositionEncodingKind::UTF16),
         ..Default::default()
     })
     .unwrap();
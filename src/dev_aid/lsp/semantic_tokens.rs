@@ -1,13 +1,16 @@
+use std::collections::HashMap;
+
 use crate::prelude::*;
 
 use lsp_types::{
-    Position, SemanticToken, SemanticTokenModifier, SemanticTokenType, SemanticTokensFullOptions,
-    SemanticTokensLegend, SemanticTokensOptions, SemanticTokensServerCapabilities,
-    WorkDoneProgressOptions,
+    Position, SemanticToken, SemanticTokenModifier, SemanticTokenType, SemanticTokens,
+    SemanticTokensDelta, SemanticTokensEdit, SemanticTokensFullDeltaResult,
+    SemanticTokensFullOptions, SemanticTokensLegend, SemanticTokensOptions,
+    SemanticTokensServerCapabilities, WorkDoneProgressOptions,
 };
 
 use crate::{
-    dev_aid::lsp::to_position,
+    dev_aid::lsp::{from_position, to_position},
     flattening::IdentifierType,
     linker::{FileData, GlobalUUID},
 };
@@ -66,8 +69,8 @@ pub fn semantic_token_capabilities() -> SemanticTokensServerCapabilities {
             token_types: Vec::from(TOKEN_TYPES),
             token_modifiers: Vec::from(TOKEN_MODIFIERS),
         },
-        range: Some(false), // Don't support ranges yet
-        full: Some(SemanticTokensFullOptions::Bool(true)), // TODO: Support delta updating for faster syntax highlighting, just do whole file for now
+        range: Some(true),
+        full: Some(SemanticTokensFullOptions::Delta { delta: Some(true) }),
     })
 }
 
@@ -139,10 +142,25 @@ impl IDEIdentifierType {
     }
 }
 
-fn walk_name_color(file: &FileData, linker: &Linker) -> Vec<(Span, IDEIdentifierType)> {
+fn walk_name_color(
+    globals: impl Iterator<Item = GlobalUUID>,
+    linker: &Linker,
+) -> Vec<(Span, IDEIdentifierType)> {
     let mut result: Vec<(Span, IDEIdentifierType)> = Vec::new();
 
-    tree_walk::visit_all(linker, file, |span, item| {
+    for global in globals {
+        walk_name_color_in_global(global, linker, &mut result);
+    }
+
+    result
+}
+
+fn walk_name_color_in_global(
+    global: GlobalUUID,
+    linker: &Linker,
+    result: &mut Vec<(Span, IDEIdentifierType)>,
+) {
+    tree_walk::visit_all_in_module(linker, global, |span, item| {
         result.push((
             span,
             match item {
@@ -173,19 +191,197 @@ fn walk_name_color(file: &FileData, linker: &Linker) -> Vec<(Span, IDEIdentifier
             },
         ));
     });
+}
 
-    result
+fn spans_overlap(a: Span, b: Span) -> bool {
+    let (a, b) = (a.as_range(), b.as_range());
+    a.start < b.end && b.start < a.end
 }
 
-pub fn make_semantic_tokens(uuid: FileUUID, linker: &Linker) -> lsp_types::SemanticTokens {
+fn make_semantic_tokens(uuid: FileUUID, linker: &Linker) -> Vec<SemanticToken> {
     let file_data = &linker.files[uuid];
 
-    let mut ide_tokens = walk_name_color(file_data, linker);
+    let mut ide_tokens = walk_name_color(file_data.associated_values.iter().copied(), linker);
+
+    convert_to_semantic_tokens(file_data, &mut ide_tokens)
+}
+
+/// Only walks the globals that overlap the requested range, which is usually the part of the file that is on screen
+pub fn make_semantic_tokens_in_range(
+    uuid: FileUUID,
+    range: lsp_types::Range,
+    linker: &Linker,
+) -> SemanticTokens {
+    let file_data = &linker.files[uuid];
+    let file_text = &file_data.file_text;
+    let range = Span::from(
+        file_text.linecol_to_byte_clamp(from_position(range.start))
+            ..file_text.linecol_to_byte_clamp(from_position(range.end)),
+    );
 
-    let data = convert_to_semantic_tokens(file_data, &mut ide_tokens);
+    let globals_in_range = file_data
+        .associated_values
+        .iter()
+        .copied()
+        .filter(|global| spans_overlap(linker.get_link_info(*global).span, range));
+    let mut ide_tokens = walk_name_color(globals_in_range, linker);
+    ide_tokens.retain(|(span, _)| spans_overlap(*span, range));
 
-    lsp_types::SemanticTokens {
+    SemanticTokens {
         result_id: None,
-        data,
+        data: convert_to_semantic_tokens(file_data, &mut ide_tokens),
+    }
+}
+
+/// The last tokens sent for a file, such that a `semanticTokens/full/delta` request can be answered with only the tokens that changed
+struct SentTokens {
+    result_id: String,
+    tokens: Vec<SemanticToken>,
+    /// The linker was changed since these tokens were computed
+    is_stale: bool,
+}
+
+/// Kept by the LSP main loop, and indexed by file identifier, as [FileUUID]s don't survive reloading all files
+#[derive(Default)]
+pub struct SemanticTokensCache {
+    files: HashMap<String, SentTokens>,
+    next_result_id: u64,
+}
+
+impl SemanticTokensCache {
+    /// Must be called whenever the linker is changed. An edit re-gathers every global in its file,
+    /// and may change what identifiers in other files refer to, so all cached files are recomputed on their next request
+    pub fn invalidate(&mut self) {
+        for sent in self.files.values_mut() {
+            sent.is_stale = true;
+        }
+    }
+
+    /// Returns the previously sent tokens (if they belong to `previous_result_id`) and the up to date tokens
+    fn update(
+        &mut self,
+        uuid: FileUUID,
+        linker: &Linker,
+        previous_result_id: Option<&str>,
+    ) -> (Option<Vec<SemanticToken>>, &SentTokens) {
+        let file_identifier = &linker.files[uuid].file_identifier;
+        let previous = self.files.remove(file_identifier);
+
+        let (previous_tokens, tokens) = match previous {
+            Some(sent) if !sent.is_stale => {
+                // Nothing changed, so the client either has these tokens already, or gets them again without walking the file
+                let has_previous = previous_result_id == Some(sent.result_id.as_str());
+                let tokens = sent.tokens;
+                (has_previous.then(|| tokens.clone()), tokens)
+            }
+            previous => {
+                let previous_tokens = previous
+                    .filter(|sent| previous_result_id == Some(sent.result_id.as_str()))
+                    .map(|sent| sent.tokens);
+                (previous_tokens, make_semantic_tokens(uuid, linker))
+            }
+        };
+
+        self.next_result_id += 1;
+        let sent = SentTokens {
+            result_id: self.next_result_id.to_string(),
+            tokens,
+            is_stale: false,
+        };
+        self.files.insert(file_identifier.clone(), sent);
+        (previous_tokens, &self.files[file_identifier])
+    }
+
+    pub fn full(&mut self, uuid: FileUUID, linker: &Linker) -> SemanticTokens {
+        let (_, sent) = self.update(uuid, linker, None);
+        SemanticTokens {
+            result_id: Some(sent.result_id.clone()),
+            data: sent.tokens.clone(),
+        }
+    }
+
+    pub fn full_delta(
+        &mut self,
+        uuid: FileUUID,
+        linker: &Linker,
+        previous_result_id: &str,
+    ) -> SemanticTokensFullDeltaResult {
+        let (previous_tokens, sent) = self.update(uuid, linker, Some(previous_result_id));
+        let result_id = Some(sent.result_id.clone());
+        match previous_tokens {
+            Some(previous_tokens) => {
+                SemanticTokensFullDeltaResult::TokensDelta(SemanticTokensDelta {
+                    result_id,
+                    edits: diff_tokens(&previous_tokens, &sent.tokens)
+                        .into_iter()
+                        .collect(),
+                })
+            }
+            // The client's tokens are unknown, so send them all
+            None => SemanticTokensFullDeltaResult::Tokens(SemanticTokens {
+                result_id,
+                data: sent.tokens.clone(),
+            }),
+        }
+    }
+}
+
+/// Replaces everything between the common prefix and the common suffix with a single edit.
+/// Because every token is encoded relative to the previous one, an edit only changes the tokens around it.
+///
+/// The edit's indices count integers, of which there are 5 per token
+fn diff_tokens(old: &[SemanticToken], new: &[SemanticToken]) -> Option<SemanticTokensEdit> {
+    const INTS_PER_TOKEN: u32 = 5;
+
+    let prefix = old.iter().zip(new).take_while(|(a, b)| a == b).count();
+    let max_suffix = old.len().min(new.len()) - prefix;
+    let suffix = old[prefix..]
+        .iter()
+        .rev()
+        .zip(new[prefix..].iter().rev())
+        .take(max_suffix)
+        .take_while(|(a, b)| a == b)
+        .count();
+
+    let deleted = &old[prefix..old.len() - suffix];
+    let inserted = &new[prefix..new.len() - suffix];
+    if deleted.is_empty() && inserted.is_empty() {
+        return None;
+    }
+    Some(SemanticTokensEdit {
+        start: prefix as u32 * INTS_PER_TOKEN,
+        delete_count: deleted.len() as u32 * INTS_PER_TOKEN,
+        data: Some(inserted.to_vec()),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn token(delta_line: u32) -> SemanticToken {
+        SemanticToken {
+            delta_line,
+            delta_start: 0,
+            length: 1,
+            token_type: 0,
+            token_modifiers_bitset: 0,
+        }
+    }
+
+    #[test]
+    fn diff_tokens_replaces_only_the_middle() {
+        let old = [token(0), token(1), token(2), token(3)];
+        let new = [token(0), token(5), token(6), token(2), token(3)];
+        let edit = diff_tokens(&old, &new).unwrap();
+        assert_eq!(edit.start, 5);
+        assert_eq!(edit.delete_count, 5);
+        assert_eq!(edit.data, Some(vec![token(5), token(6)]));
+
+        assert!(diff_tokens(&old, &old).is_none());
+
+        // The suffix may not overlap the prefix
+        let edit = diff_tokens(&[token(1), token(1)], &[token(1)]).unwrap();
+        assert_eq!((edit.start, edit.delete_count), (5, 5));
     }
 }
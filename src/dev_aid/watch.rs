@@ -0,0 +1,221 @@
+//! `--watch`: keeps the [Linker] of the CLI resident, and recompiles whenever one of the input files changes.
+//!
+//! Files are polled for a new modification time, so no file system notification library is needed.
+//! [Linker::recompile_all] only resets the globals that are affected by the change. Unaffected instances keep their [Arc],
+//! which is how the output files of modules that didn't change are recognized and left alone.
+
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use std::time::{Duration, SystemTime};
+
+use crate::codegen::{
+    disk_cache::CachedHierarchies, instances_with_dependencies, output_instances, sorted_instances,
+    CodeGenBackend, OutputInstance,
+};
+use crate::compiler_top::LinkerExtraFileInfoManager;
+use crate::config::{config, EarlyExitUpTo};
+use crate::flattening::Module;
+use crate::instantiation::InstantiatedModule;
+use crate::prelude::*;
+use crate::profiling::{report_time_passes, PhaseTimer};
+
+use super::ariadne_interface::{print_all_errors, FileSourcesManager};
+
+const POLL_INTERVAL: Duration = Duration::from_millis(200);
+
+struct WatchedFile {
+    path: PathBuf,
+    file_identifier: String,
+    /// [None] until first polled, so changes made during the initial compilation are picked up too
+    modified: Option<SystemTime>,
+}
+
+fn modified_time(path: &Path) -> Option<SystemTime> {
+    std::fs::metadata(path)
+        .and_then(|meta| meta.modified())
+        .ok()
+}
+
+/// The instances each module's output file was last generated from
+struct GeneratedInstances(HashMap<String, Vec<Arc<InstantiatedModule>>>);
+
+impl GeneratedInstances {
+    fn of(linker: &Linker) -> Self {
+        Self(
+            linker
+                .modules
+                .iter()
+                .map(|(_id, md)| (md.link_info.name.clone(), sorted_instances(md)))
+                .collect(),
+        )
+    }
+
+    /// Modules that are new, or of which an instance was added, removed or rebuilt since `self`
+    fn changed_modules<'l>(&self, linker: &'l Linker) -> Vec<&'l Module> {
+        linker
+            .modules
+            .iter()
+            .map(|(_id, md)| md)
+            .filter(|md| {
+                let Some(old_instances) = self.0.get(&md.link_info.name) else {
+                    return true;
+                };
+                let new_instances = sorted_instances(md);
+                old_instances.len() != new_instances.len()
+                    || !old_instances
+                        .iter()
+                        .zip(&new_instances)
+                        .all(|(old, new)| Arc::ptr_eq(old, new))
+            })
+            .collect()
+    }
+
+    /// Modules that had an output file, but are no longer in the linker, for instance because they were renamed
+    fn removed_modules<'s>(&'s self, linker: &Linker) -> Vec<&'s str> {
+        self.0
+            .iter()
+            .filter(|(md_name, instances)| {
+                !instances.is_empty()
+                    && !linker
+                        .modules
+                        .iter()
+                        .any(|(_, md)| &md.link_info.name == *md_name)
+            })
+            .map(|(md_name, _)| md_name.as_str())
+            .collect()
+    }
+}
+
+/// Whether `md`, or any module it (transitively) instantiates, is among `changed_modules`
+fn hierarchy_changed(linker: &Linker, md: &Module, changed_modules: &[&Module]) -> bool {
+    let top_level_instances = sorted_instances(md);
+    changed_modules
+        .iter()
+        .any(|changed| std::ptr::eq(*changed, md))
+        || instances_with_dependencies(
+            linker,
+            top_level_instances.iter().map(|inst| (inst.as_ref(), md)),
+        )
+        .iter()
+        .any(|(_inst, inst_md)| {
+            changed_modules
+                .iter()
+                .any(|changed| std::ptr::eq(*changed, *inst_md))
+        })
+}
+
+/// Reads the files that changed since the last poll into the linker. Returns whether any of them had new contents
+fn update_changed_files(
+    watched: &mut [WatchedFile],
+    linker: &mut Linker,
+    sources: &mut FileSourcesManager,
+) -> bool {
+    let mut any_updated = false;
+    for file in watched {
+        let modified = modified_time(&file.path);
+        if modified == file.modified {
+            continue;
+        }
+        file.modified = modified;
+        // A file that is missing or unreadable, for instance while an editor replaces it, is read again once it reappears
+        let Ok(text) = std::fs::read_to_string(&file.path) else {
+            continue;
+        };
+        if let Some(file_id) = linker.find_file(&file.file_identifier) {
+            if linker.files[file_id].file_text.file_text == text {
+                continue;
+            }
+        }
+        linker.add_or_update_file(&file.file_identifier, text, sources);
+        any_updated = true;
+    }
+    any_updated
+}
+
+/// Removed modules, and modules that lost all their instances, have their output files deleted
+fn regenerate_outputs(
+    linker: &Linker,
+    codegen_backend: &dyn CodeGenBackend,
+    generated: &GeneratedInstances,
+) {
+    let config = config();
+    if config.early_exit != EarlyExitUpTo::CodeGen {
+        return;
+    }
+    let changed_modules = generated.changed_modules(linker);
+    let removed_modules = generated.removed_modules(linker);
+    if changed_modules.is_empty() && removed_modules.is_empty() {
+        return;
+    }
+    let _timer = PhaseTimer::whole_phase("codegen");
+    if let Some(md_name) = &config.codegen_module_and_dependencies_one_file {
+        match linker
+            .modules
+            .iter()
+            .find(|(_, md)| &md.link_info.name == md_name)
+        {
+            Some((_, md)) if hierarchy_changed(linker, md, &changed_modules) => codegen_backend
+                .codegen_with_dependencies(
+                    linker,
+                    md,
+                    &format!("{md_name}_standalone"),
+                    &CachedHierarchies::default(),
+                ),
+            Some(_) => {}
+            None => eprintln!("Unknown module {md_name}"),
+        }
+    }
+    if config.codegen {
+        for md_name in removed_modules {
+            println!("Removing output of {md_name}");
+            codegen_backend.remove_module_output(md_name);
+        }
+        let (emptied_modules, changed_modules): (Vec<&Module>, Vec<&Module>) = changed_modules
+            .into_iter()
+            .partition(|md| sorted_instances(md).is_empty());
+        for md in emptied_modules {
+            codegen_backend.remove_module_output(&md.link_info.name);
+        }
+        println!("Regenerating {} module(s)", changed_modules.len());
+        let no_cache = CachedHierarchies::default();
+        let modules: Vec<(&Module, Vec<OutputInstance>)> = changed_modules
+            .into_iter()
+            .map(|md| (md, output_instances(md, &no_cache)))
+            .collect();
+        codegen_backend.codegen_modules_to_files(linker, &modules);
+    }
+}
+
+/// Never returns. Expects `linker` to already have been compiled, and its outputs generated, from `file_paths`
+pub fn watch_files(
+    file_paths: &[PathBuf],
+    linker: &mut Linker,
+    sources: &mut FileSourcesManager,
+    codegen_backend: &dyn CodeGenBackend,
+) -> ! {
+    let mut watched: Vec<WatchedFile> = file_paths
+        .iter()
+        .map(|path| WatchedFile {
+            path: path.clone(),
+            file_identifier: sources.convert_filename(path),
+            modified: None,
+        })
+        .collect();
+    let mut generated = GeneratedInstances::of(linker);
+    println!("Watching {} file(s) for changes", watched.len());
+
+    loop {
+        std::thread::sleep(POLL_INTERVAL);
+        if !update_changed_files(&mut watched, linker, sources) {
+            continue;
+        }
+        println!("Recompiling");
+        linker.recompile_all();
+        print_all_errors(linker, &mut sources.file_sources);
+
+        regenerate_outputs(linker, codegen_backend, &generated);
+        generated = GeneratedInstances::of(linker);
+        report_time_passes();
+    }
+}
@@ -10,7 +10,7 @@ use crate::flattening::{
 };
 use crate::linker::{checkpoint::ErrorCheckpoint, FileData, LinkInfo};
 
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 pub enum ErrorLevel {
     Error,
     Warning,
@@ -77,6 +77,21 @@ impl ErrorStore {
     pub fn is_untouched(&self) -> bool {
         self.errors.is_empty()
     }
+
+    /// Bytes allocated for the errors, their messages and their infos
+    pub fn allocated_bytes(&self) -> usize {
+        let mut bytes = self.errors.capacity() * std::mem::size_of::<CompileError>();
+        for err in &self.errors {
+            bytes +=
+                err.reason.capacity() + err.infos.capacity() * std::mem::size_of::<ErrorInfo>();
+            bytes += err
+                .infos
+                .iter()
+                .map(|info| info.info.capacity())
+                .sum::<usize>();
+        }
+        bytes
+    }
 }
 
 impl<'e> IntoIterator for &'e ErrorStore {
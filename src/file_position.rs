@@ -104,7 +104,8 @@ impl BracketSpan {
     }
 }
 
-#[derive(Clone, Copy, PartialEq, Eq)]
+/// `col` counts UTF-16 code units, as positions in the Language Server Protocol do by default
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
 pub struct LineCol {
     pub line: usize,
     pub col: usize,
@@ -122,12 +123,17 @@ impl Ord for LineCol {
 
 pub type SpanFile = (Span, FileUUID);
 
+#[derive(Clone)]
 pub struct FileText {
     pub file_text: String,
     lines_start_at: Vec<usize>,
 }
 
 impl FileText {
+    /// Bytes allocated for the text and the index of line starts
+    pub fn allocated_bytes(&self) -> usize {
+        self.file_text.capacity() + self.lines_start_at.capacity() * std::mem::size_of::<usize>()
+    }
     pub fn new(file_text: String) -> Self {
         let mut lines_start_at = Vec::new();
 
@@ -154,10 +160,10 @@ impl FileText {
 
         LineCol {
             line,
-            col: text_before.chars().count(),
+            col: text_before.encode_utf16().count(),
         }
     }
-    /// Clamps the linecol to be within the file, so cannot error.
+    /// Clamps the linecol to be within the file, so cannot error. A column within a surrogate pair rounds up to the next character
     pub fn linecol_to_byte_clamp(&self, linecol: LineCol) -> usize {
         let line_end = match (linecol.line + 1).cmp(&self.lines_start_at.len()) {
             std::cmp::Ordering::Less => self.lines_start_at[linecol.line + 1] - 1,
@@ -168,12 +174,11 @@ impl FileText {
         let line_text = &self.file_text[line_start..line_end];
 
         let mut cols_left = linecol.col;
-        let mut char_indices = line_text.char_indices();
-        for (byte, _) in &mut char_indices {
+        for (byte, c) in line_text.char_indices() {
             if cols_left == 0 {
                 return line_start + byte;
             }
-            cols_left -= 1;
+            cols_left = cols_left.saturating_sub(c.len_utf16());
         }
         line_end
     }
@@ -190,6 +195,34 @@ impl FileText {
     pub fn len(&self) -> usize {
         self.file_text.len()
     }
+
+    /// Byte position at which the given line starts
+    pub fn line_start(&self, line: usize) -> usize {
+        self.lines_start_at[line]
+    }
+
+    /// Replaces the text in `byte_range` by `new_text`, only updating the line starts that changed
+    pub fn apply_edit(&mut self, byte_range: Range<usize>, new_text: &str) {
+        self.file_text.replace_range(byte_range.clone(), new_text);
+
+        // Lines starting within (start, end] were broken up by a newline inside of the replaced text
+        let first_removed = self
+            .lines_start_at
+            .partition_point(|&line_start| line_start <= byte_range.start);
+        let first_kept = self
+            .lines_start_at
+            .partition_point(|&line_start| line_start <= byte_range.end);
+
+        let new_end = byte_range.start + new_text.len();
+        for line_start in &mut self.lines_start_at[first_kept..] {
+            *line_start = *line_start - byte_range.end + new_end;
+        }
+        let new_line_starts = new_text
+            .match_indices('\n')
+            .map(|(idx, _)| byte_range.start + idx + 1);
+        self.lines_start_at
+            .splice(first_removed..first_kept, new_line_starts);
+    }
 }
 
 impl Index<Span> for FileText {
@@ -200,3 +233,59 @@ impl Index<Span> for FileText {
         &self.file_text[index.as_range()]
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// [FileText::apply_edit] must leave the same line starts as reading the edited text from scratch
+    fn check_edit(text: &str, byte_range: Range<usize>, new_text: &str) {
+        let mut edited = FileText::new(text.to_owned());
+        edited.apply_edit(byte_range.clone(), new_text);
+
+        let mut expected_text = text.to_owned();
+        expected_text.replace_range(byte_range, new_text);
+        let expected = FileText::new(expected_text);
+        assert_eq!(edited.file_text, expected.file_text);
+        assert_eq!(edited.lines_start_at, expected.lines_start_at);
+    }
+
+    #[test]
+    fn multi_line_edits() {
+        let text = "module a {\n    int x\n}\n";
+        // Insert lines in the middle
+        check_edit(text, 15..15, "\n    int y\n    int z");
+        // Delete a whole line
+        check_edit(text, 11..21, "");
+        // Replace the end of one line up to the start of another
+        check_edit(text, 8..18, "\n\n\nb");
+        // Join all lines
+        check_edit(text, 0..text.len(), "module b {}");
+    }
+
+    #[test]
+    fn edits_at_end_of_file() {
+        let text = "module a {\n}";
+        check_edit(text, text.len()..text.len(), "\n");
+        check_edit(text, text.len()..text.len(), "\nmodule b {\n}\n");
+        check_edit(text, 10..text.len(), "");
+        check_edit("", 0..0, "a\nb\n");
+    }
+
+    #[test]
+    fn columns_are_utf16_code_units() {
+        // 'é' is one code unit, '😀' two
+        let text = FileText::new("x\naé😀b".to_owned());
+        let b_byte = text.file_text.find('b').unwrap();
+        assert!(text.byte_to_linecol(b_byte) == LineCol { line: 1, col: 4 });
+        assert_eq!(
+            text.linecol_to_byte_clamp(LineCol { line: 1, col: 4 }),
+            b_byte
+        );
+        // Within the surrogate pair of '😀'
+        assert_eq!(
+            text.linecol_to_byte_clamp(LineCol { line: 1, col: 3 }),
+            b_byte
+        );
+    }
+}
@@ -1,12 +1,20 @@
-use crate::alloc::{ArenaAllocator, UUIDAllocator, UUIDRange, UUID};
+use crate::alloc::{UUIDAllocator, UUIDRange, UUID};
 use crate::typing::abstract_type::{AbstractType, DomainType};
 use crate::{alloc::UUIDRangeIter, prelude::*};
 
-use num::BigInt;
 use sus_proc_macro::{field, kind, kw};
 
-use crate::linker::{FileData, GlobalResolver, GlobalUUID, AFTER_FLATTEN_CP};
-use crate::{debug::SpanDebugger, value::Value};
+use crate::errors::ErrorStore;
+use crate::linker::{
+    GlobalResolver, GlobalUUID, ResolvedGlobals, AFTER_FLATTEN_CP, AFTER_INITIAL_PARSE_CP,
+};
+use crate::parallel::parallel_map;
+use crate::{
+    config::config,
+    debug::SpanDebugger,
+    profiling::PhaseTimer,
+    value::{IntValue, Value},
+};
 
 use super::name_context::LocalVariableContext;
 use super::parser::Cursor;
@@ -767,7 +775,7 @@ impl FlatteningContext<'_, '_> {
                 name : name.to_owned(),
                 name_span,
                 decl_span,
-                declaration_runtime_depth : OnceCell::new(),
+                declaration_runtime_depth : OnceLock::new(),
                 latency_specifier : span_latency_specifier.map(|(ls, _)| ls),
                 documentation
             }));
@@ -943,7 +951,7 @@ impl FlatteningContext<'_, '_> {
             let text = &self.globals.file_data.file_text[expr_span];
             use std::str::FromStr;
             (
-                ExpressionSource::Constant(Value::Integer(BigInt::from_str(text).unwrap())),
+                ExpressionSource::Constant(Value::Integer(IntValue::from_str(text).unwrap())),
                 true,
             )
         } else if kind == kind!("unary_op") {
@@ -1634,7 +1642,7 @@ impl FlatteningContext<'_, '_> {
                             decl_span,
                             name_span,
                             name: module_name.to_string(),
-                            declaration_runtime_depth: OnceCell::new(),
+                            declaration_runtime_depth: OnceLock::new(),
                             read_only: false,
                             declaration_itself_is_not_written_to: true,
                             decl_kind: DeclarationKind::NotPort,
@@ -1655,12 +1663,46 @@ impl FlatteningContext<'_, '_> {
 /// Flattens all globals in the project.
 ///
 /// Requires that first, all globals have been initialized.
+///
+/// Globals don't read each other's flattening results, so files are flattened in parallel (See [crate::config::ConfigStruct::jobs]).
+/// The results are then written back into the [Linker] in file order.
 pub fn flatten_all_globals(linker: &mut Linker) {
-    let linker_files: *const ArenaAllocator<FileData, FileUUIDMarker> = &linker.files;
-    // SAFETY we won't be touching the files anywere. This is just to get the compiler to stop complaining about linker going into the closure.
-    for (_file_id, file) in unsafe { &*linker_files } {
+    // Incremental compilation: Globals that weren't reset don't need to be flattened again
+    let mut files_to_flatten: Vec<(FileUUID, Vec<GlobalUUID>)> = Vec::new();
+    for (file_id, file) in &linker.files {
+        let to_flatten: Vec<GlobalUUID> = file
+            .associated_values
+            .iter()
+            .copied()
+            .filter(|global| {
+                linker
+                    .get_link_info(*global)
+                    .is_at_checkpoint(AFTER_INITIAL_PARSE_CP)
+            })
+            .collect();
+        if !to_flatten.is_empty() {
+            files_to_flatten.push((file_id, to_flatten));
+        }
+    }
+    let work: Vec<(FileUUID, Vec<(GlobalUUID, (ErrorStore, ResolvedGlobals))>)> = files_to_flatten
+        .into_iter()
+        .map(|(file_id, globals)| {
+            let globals = globals
+                .into_iter()
+                .map(|global| (global, GlobalResolver::take_errors_globals(linker, global)))
+                .collect();
+            (file_id, globals)
+        })
+        .collect();
+
+    let shared_linker: &Linker = linker;
+    let flattened_files = parallel_map(config().jobs, work, |(file_id, globals)| {
+        let linker = shared_linker;
+        let file = &linker.files[file_id];
         let mut span_debugger = SpanDebugger::new("flatten_all_globals", file);
         let mut associated_value_iter = file.associated_values.iter();
+        let mut to_flatten = globals.into_iter().peekable();
+        let mut results = Vec::new();
 
         let mut cursor = Cursor::new_at_root(&file.tree, &file.file_text);
 
@@ -1670,16 +1712,43 @@ pub fn flatten_all_globals(linker: &mut Linker) {
                     .next()
                     .expect("Iterator cannot be exhausted");
 
-                flatten_global(linker, global_obj, cursor);
+                // to_flatten is in the same order as associated_values
+                if let Some((_, errors_globals)) =
+                    to_flatten.next_if(|(global, _)| *global == global_obj)
+                {
+                    results.push((
+                        global_obj,
+                        flatten_global(linker, global_obj, errors_globals, cursor),
+                    ));
+                }
             });
         });
         span_debugger.defuse();
+        assert!(to_flatten.next().is_none());
+        results
+    });
+
+    for (global_obj, flattened) in flattened_files.into_iter().flatten() {
+        apply_flattened_global(linker, global_obj, flattened);
     }
 }
 
-fn flatten_global(linker: &mut Linker, global_obj: GlobalUUID, cursor: &mut Cursor<'_>) {
-    let errors_globals = GlobalResolver::take_errors_globals(linker, global_obj);
+/// The result of flattening a single global, to be written back with [apply_flattened_global]
+struct FlattenedGlobal {
+    instructions: FlatAlloc<Instruction, FlatIDMarker>,
+    type_alloc: TypingAllocator,
+    errors: ErrorStore,
+    resolved_globals: ResolvedGlobals,
+}
+
+fn flatten_global(
+    linker: &Linker,
+    global_obj: GlobalUUID,
+    errors_globals: (ErrorStore, ResolvedGlobals),
+    cursor: &mut Cursor<'_>,
+) -> FlattenedGlobal {
     let obj_link_info = linker.get_link_info(global_obj);
+    let mut timer = PhaseTimer::new("flatten", || obj_link_info.get_full_name());
     let globals = GlobalResolver::new(linker, obj_link_info, errors_globals);
 
     let mut local_variable_context = LocalVariableContext::new_initial();
@@ -1747,10 +1816,32 @@ fn flatten_global(linker: &mut Linker, global_obj: GlobalUUID, cursor: &mut Curs
     // Make sure all ports have been visited
     assert!(context.ports_to_visit.is_empty());
 
-    let mut instructions = context.instructions;
+    let instructions = context.instructions;
     let type_alloc = context.type_alloc;
+    timer.add_counter("instructions", instructions.len());
+
+    let (errors, resolved_globals) = globals.decommission(&linker.files);
+
+    FlattenedGlobal {
+        instructions,
+        type_alloc,
+        errors: errors.into_storage(),
+        resolved_globals,
+    }
+}
 
-    let errors_globals = globals.decommission(&linker.files);
+fn apply_flattened_global(linker: &mut Linker, global_obj: GlobalUUID, flattened: FlattenedGlobal) {
+    let FlattenedGlobal {
+        mut instructions,
+        type_alloc,
+        errors,
+        resolved_globals,
+    } = flattened;
+    let file = linker.get_link_info(global_obj).file;
+    let errors_globals = (
+        ErrorCollector::from_storage(errors, file, &linker.files),
+        resolved_globals,
+    );
 
     let link_info: &mut LinkInfo = match global_obj {
         GlobalUUID::Module(module_uuid) => {
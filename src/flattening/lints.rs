@@ -1,7 +1,9 @@
 use sus_proc_macro::get_builtin_const;
 
-use crate::linker::{IsExtern, LinkInfo, AFTER_LINTS_CP};
+use crate::instantiation::list_of_lists::ListOfLists;
+use crate::linker::{IsExtern, LinkInfo, AFTER_LINTS_CP, AFTER_TYPECHECK_CP};
 use crate::prelude::*;
+use crate::profiling::PhaseTimer;
 use crate::typing::template::ParameterKind;
 
 use super::walk::for_each_generative_input_in_template_args;
@@ -10,6 +12,10 @@ use super::{ExpressionSource, Instruction, Module, WireReferencePathElement, Wir
 
 pub fn perform_lints(linker: &mut Linker) {
     for (_, md) in &mut linker.modules {
+        if !md.link_info.is_at_checkpoint(AFTER_TYPECHECK_CP) {
+            continue;
+        }
+        let _timer = PhaseTimer::new("lint", || md.link_info.get_full_name());
         let errors = ErrorCollector::from_storage(
             md.link_info.errors.take(),
             md.link_info.file,
@@ -78,7 +84,7 @@ fn find_unused_variables(md: &Module, errors: &ErrorCollector) {
     }
 
     while let Some(item) = wire_to_explore_queue.pop() {
-        for from in &instruction_fanins[item] {
+        for from in &instruction_fanins[item.get_hidden_value()] {
             if !is_instance_used_map[*from] {
                 is_instance_used_map[*from] = true;
                 wire_to_explore_queue.push(*from);
@@ -96,23 +102,21 @@ fn find_unused_variables(md: &Module, errors: &ErrorCollector) {
     }
 }
 
-fn make_fanins(
-    instructions: &FlatAlloc<Instruction, FlatIDMarker>,
-) -> FlatAlloc<Vec<FlatID>, FlatIDMarker> {
-    // Setup Wire Fanouts List for faster processing
-    let mut instruction_fanins: FlatAlloc<Vec<FlatID>, FlatIDMarker> =
-        instructions.map(|_| Vec::new());
+/// Indexed by [FlatID::get_hidden_value]. Edges are gathered in one list, and then sorted into the groups of a [ListOfLists],
+/// instead of allocating a Vec per instruction
+fn make_fanins(instructions: &FlatAlloc<Instruction, FlatIDMarker>) -> ListOfLists<FlatID> {
+    // (to, from) pairs
+    let mut edges: Vec<(usize, FlatID)> = Vec::with_capacity(instructions.len());
+    let mut add_edge = |to: FlatID, from: FlatID| edges.push((to.get_hidden_value(), from));
 
     for (inst_id, inst) in instructions.iter() {
-        let mut collector_func = |id| {
-            instruction_fanins[inst_id].push(id);
-        };
+        let mut collector_func = |id| add_edge(inst_id, id);
         match inst {
             Instruction::Write(conn) => {
                 if let Some(flat_root) = conn.to.root.get_root_flat() {
-                    instruction_fanins[flat_root].push(conn.from);
+                    add_edge(flat_root, conn.from);
                     WireReferencePathElement::for_each_dependency(&conn.to.path, |idx_wire| {
-                        instruction_fanins[flat_root].push(idx_wire)
+                        add_edge(flat_root, idx_wire)
                     });
                 }
             }
@@ -124,7 +128,7 @@ fn make_fanins(
             }
             Instruction::FuncCall(fc) => {
                 for a in &fc.arguments {
-                    instruction_fanins[fc.interface_reference.submodule_decl].push(*a);
+                    add_edge(fc.interface_reference.submodule_decl, *a);
                 }
             }
             Instruction::Declaration(decl) => {
@@ -140,16 +144,16 @@ fn make_fanins(
                 for id in FlatIDRange::new(stm.then_start, stm.else_end) {
                     if let Instruction::Write(conn) = &instructions[id] {
                         if let Some(flat_root) = conn.to.root.get_root_flat() {
-                            instruction_fanins[flat_root].push(stm.condition);
+                            add_edge(flat_root, stm.condition);
                         }
                     }
                 }
             }
             Instruction::ForStatement(stm) => {
-                instruction_fanins[stm.loop_var_decl].push(stm.start);
-                instruction_fanins[stm.loop_var_decl].push(stm.end);
+                add_edge(stm.loop_var_decl, stm.start);
+                add_edge(stm.loop_var_decl, stm.end);
             }
         }
     }
-    instruction_fanins
+    ListOfLists::from_random_access_iterator(instructions.len(), edges.iter().copied())
 }
@@ -12,8 +12,8 @@ use crate::prelude::*;
 use crate::typing::abstract_type::DomainType;
 use crate::typing::type_inference::{DomainVariableIDMarker, TypeVariableIDMarker};
 
-use std::cell::OnceCell;
 use std::ops::Deref;
+use std::sync::OnceLock;
 
 pub use flatten::flatten_all_globals;
 pub use initialization::gather_initial_file_data;
@@ -43,7 +43,7 @@ use crate::typing::{abstract_type::FullType, template::GlobalReference};
 ///     3.2: Concrete Typecheck, Latency Counting
 ///
 /// All Modules are stored in [Linker::modules] and indexed by [ModuleUUID]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Module {
     /// Created in Stage 1: Initialization
     pub link_info: LinkInfo,
@@ -139,7 +139,7 @@ impl Module {
 /// TODO: Structs #8
 ///
 /// All Types are stored in [Linker::types] and indexed by [TypeUUID]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct StructType {
     /// Created in Stage 1: Initialization
     pub link_info: LinkInfo,
@@ -153,7 +153,7 @@ pub struct StructType {
 /// Global constant, like `true`, `false`, or user-defined constants (TODO #19)
 ///
 /// All Constants are stored in [Linker::constants] and indexed by [ConstantUUID]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct NamedConstant {
     pub link_info: LinkInfo,
     pub output_decl: FlatID,
@@ -164,7 +164,7 @@ pub struct NamedConstant {
 /// UNFINISHED
 ///
 /// TODO: Structs #8
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct StructField {
     #[allow(unused)]
     pub name: String,
@@ -262,7 +262,7 @@ impl IdentifierType {
 ///     interface beep : int a -> bool b, int[3] c
 /// }
 /// ```
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Port {
     pub name: String,
     pub name_span: Span,
@@ -290,7 +290,7 @@ pub struct Port {
 ///     bool xyz, int[3] pqr = x.beep(3)
 /// }
 /// ```
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Interface {
     pub name_span: Span,
     pub name: String,
@@ -321,7 +321,7 @@ pub enum WireReferencePathElement {
 /// The root of a [WireReference]. Basically where the wire reference starts.
 ///
 /// This can be a local declaration, a global constant, the port of a submodule.
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum WireReferenceRoot {
     /// ```sus
     /// int local_var
@@ -363,7 +363,7 @@ impl WireReferenceRoot {
 /// [Expression] covers anything that can not be written to.
 ///
 /// Example: `myModule.port[a][b:c]`. (`myModule.port` is the [Self::root], `[a][b:c]` are two parts of the [Self::path])
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct WireReference {
     pub root: WireReferenceRoot,
     pub path: Vec<WireReferencePathElement>,
@@ -388,7 +388,7 @@ impl WireReference {
 }
 
 /// In a [Write], this represents what kind of write it is, based on keywords `reg` or `initial`
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum WriteModifiers {
     /// A regular write to a local wire (can include latency registers) or generative variable
     /// ```sus
@@ -422,7 +422,7 @@ impl WriteModifiers {
 ///     int b, int c = someFunc(3) // Two writes, one to b, one to c
 /// }
 /// ```
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Write {
     pub from: FlatID,
     pub to: WireReference,
@@ -501,7 +501,7 @@ pub struct PortReference {
 /// See [ExpressionSource]
 ///
 /// On instantiation, creates [crate::instantiation::RealWire] when non-generative
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Expression {
     pub typ: FullType,
     pub span: Span,
@@ -509,7 +509,7 @@ pub struct Expression {
 }
 
 /// See [Expression]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum ExpressionSource {
     WireRef(WireReference), // Used to add a span to the reference of a wire.
     UnaryOp {
@@ -534,7 +534,7 @@ impl ExpressionSource {
 ///
 /// Not to be confused with [crate::typing::abstract_type::AbstractType] which is for working with types in the flattening stage,
 /// or [crate::typing::concrete_type::ConcreteType], which is for working with types post instantiation.
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum WrittenType {
     Error(Span),
     TemplateVariable(Span, TemplateID),
@@ -594,14 +594,14 @@ impl DeclarationKind {
 /// It can be referenced by a [WireReferenceRoot::LocalDecl]
 ///
 /// A Declaration Instruction always corresponds to a new entry in the [self::name_context::LocalVariableContext].
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Declaration {
     pub typ_expr: WrittenType,
     pub typ: FullType,
     pub decl_span: Span,
     pub name_span: Span,
     pub name: String,
-    pub declaration_runtime_depth: OnceCell<usize>,
+    pub declaration_runtime_depth: OnceLock<usize>,
     /// Variables are read_only when they may not be controlled by the current block of code.
     /// This is for example, the inputs of the current module, or the outputs of nested modules.
     /// But could also be the iterator of a for loop.
@@ -621,7 +621,7 @@ pub struct Declaration {
 /// A SubModuleInstance Instruction always corresponds to a new entry in the [self::name_context::LocalVariableContext].
 ///
 /// When instantiating, creates a [crate::instantiation::SubModule]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct SubModuleInstance {
     pub module_ref: GlobalReference<ModuleUUID>,
     /// Name is not always present in source code. Such as in inline function call syntax: my_mod(a, b, c)
@@ -652,7 +652,7 @@ impl SubModuleInstance {
 }
 
 /// See [FuncCallInstruction]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct ModuleInterfaceReference {
     pub submodule_decl: FlatID,
     pub submodule_interface: InterfaceID,
@@ -707,7 +707,7 @@ pub struct ModuleInterfaceReference {
 ///     bool w = true | xor(true, false)
 /// }
 /// ```
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct FuncCallInstruction {
     pub interface_reference: ModuleInterfaceReference,
     /// arguments.len() == func_call_inputs.len() ALWAYS
@@ -727,7 +727,7 @@ impl FuncCallInstruction {
 }
 
 /// A control-flow altering [Instruction] to represent compiletime and runtime if & when statements.
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct IfStatement {
     pub condition: FlatID,
     pub is_generative: bool,
@@ -737,7 +737,7 @@ pub struct IfStatement {
 }
 
 /// A control-flow altering [Instruction] to represent compiletime looping on a generative index
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct ForStatement {
     pub loop_var_decl: FlatID,
     pub start: FlatID,
@@ -755,7 +755,7 @@ pub struct ForStatement {
 /// They can simply refer to the [FlatID] of these instructions, instead of some convoluted other representation.
 ///
 /// When executing, the instructions are processed in order. Control flow instructions like [IfStatement] and [ForStatement] can cause the executor to repeat or skip sections.
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum Instruction {
     SubModule(SubModuleInstance),
     FuncCall(FuncCallInstruction),
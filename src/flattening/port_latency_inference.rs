@@ -134,7 +134,7 @@ fn recurse_down_expression(
             }
         }
         ExpressionSource::Constant(Value::Integer(i)) => {
-            let offset: i64 = i.try_into().ok()?;
+            let offset: i64 = i.to_primitive()?;
             Some(PortLatencyLinearity {
                 offset,
                 arg_linear_factor: TVec::with_size(num_template_args, 0),
@@ -180,7 +180,7 @@ fn recurse_down_expression(
 /// of absolute latencies we know for these ports, and take the minimum latency we could find.
 /// This ensures that instantiating the module cannot ever expand beyond the context in which
 /// it is inferred. Finally, all
-#[derive(Default, Debug)]
+#[derive(Default, Debug, Clone)]
 pub struct PortLatencyInferenceInfo {
     //port_latency_groups: Vec<Vec<PortGroup>>,
     inference_candidates: TVec<Vec<LatencyInferenceCandidate>>,
@@ -1,12 +1,17 @@
 use crate::alloc::{zip_eq3, ArenaAllocator};
-use crate::errors::{ErrorInfo, ErrorInfoObject, FileKnowingErrorInfoObject};
+use crate::errors::{ErrorInfo, ErrorInfoObject, ErrorStore, FileKnowingErrorInfoObject};
 use crate::prelude::*;
 use crate::typing::abstract_type::AbstractType;
 use crate::typing::template::ParameterKind;
 use crate::typing::type_inference::{FailedUnification, HindleyMilner};
 
+use crate::config::config;
 use crate::debug::SpanDebugger;
-use crate::linker::{GlobalResolver, GlobalUUID, AFTER_TYPECHECK_CP};
+use crate::linker::{
+    GlobalResolver, GlobalUUID, ResolvedGlobals, AFTER_FLATTEN_CP, AFTER_TYPECHECK_CP,
+};
+use crate::parallel::parallel_map;
+use crate::profiling::PhaseTimer;
 
 use crate::typing::{
     abstract_type::{DomainType, TypeUnifier, BOOL_TYPE, INT_TYPE},
@@ -15,13 +20,35 @@ use crate::typing::{
 
 use super::*;
 
+/// Typechecks all modules that have been flattened.
+///
+/// Typechecking a module only reads the written types of other globals, so modules are typechecked in parallel (See [crate::config::ConfigStruct::jobs]).
+/// The resulting types are then applied to each module in [ModuleUUID] order.
 pub fn typecheck_all_modules(linker: &mut Linker) {
-    let module_uuids: Vec<ModuleUUID> = linker.modules.iter().map(|(id, _md)| id).collect();
-    for module_uuid in module_uuids {
-        let global_id = GlobalUUID::Module(module_uuid);
-        let errs_globals = GlobalResolver::take_errors_globals(linker, global_id);
-
+    // Incremental compilation: Modules that weren't reset don't need to be typechecked again
+    let module_uuids: Vec<ModuleUUID> = linker
+        .modules
+        .iter()
+        .filter(|(_id, md)| md.link_info.is_at_checkpoint(AFTER_FLATTEN_CP))
+        .map(|(id, _md)| id)
+        .collect();
+    let work: Vec<(ModuleUUID, (ErrorStore, ResolvedGlobals))> = module_uuids
+        .into_iter()
+        .map(|module_uuid| {
+            let global_id = GlobalUUID::Module(module_uuid);
+            (
+                module_uuid,
+                GlobalResolver::take_errors_globals(linker, global_id),
+            )
+        })
+        .collect();
+
+    let shared_linker: &Linker = linker;
+    let typechecked = parallel_map(config().jobs, work, |(module_uuid, errs_globals)| {
+        let linker = shared_linker;
         let working_on: &Module = &linker.modules[module_uuid];
+        let mut timer = PhaseTimer::new("typecheck", || working_on.link_info.get_full_name());
+        timer.add_counter("instructions", working_on.link_info.instructions.len());
         let globals = GlobalResolver::new(linker, &working_on.link_info, errs_globals);
 
         let ctx_info_string = format!("Typechecking {}", &working_on.link_info.name);
@@ -43,10 +70,28 @@ pub fn typecheck_all_modules(linker: &mut Linker) {
         context.typecheck();
 
         let type_checker = context.type_checker;
-        let errs_and_globals = globals.decommission(&linker.files);
+        let (errors, resolved_globals) = globals.decommission(&linker.files);
+
+        span_debugger.defuse();
+        (
+            module_uuid,
+            type_checker,
+            errors.into_storage(),
+            resolved_globals,
+        )
+    });
+
+    for (module_uuid, type_checker, errors, resolved_globals) in typechecked {
+        let file = linker.modules[module_uuid].link_info.file;
+        let errs_and_globals = (
+            ErrorCollector::from_storage(errors, file, &linker.files),
+            resolved_globals,
+        );
 
-        // Grab another mutable copy of md so it doesn't force a borrow conflict
         let working_on_mut = &mut linker.modules[module_uuid];
+        let ctx_info_string = format!("Applying types to {}", &working_on_mut.link_info.name);
+        let mut span_debugger = SpanDebugger::new(&ctx_info_string, &linker.files[file]);
+
         apply_types(
             type_checker,
             working_on_mut,
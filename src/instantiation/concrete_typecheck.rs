@@ -54,20 +54,22 @@ impl InstantiationContext<'_, '_> {
 
     fn typecheck_all_wires(&self) {
         for this_wire_id in self.wires.id_range() {
-            let this_wire = &self.wires[this_wire_id];
-            let span = self.md.get_instruction_span(this_wire.original_instruction);
+            let this_wire_typ = &self.wire_types[this_wire_id];
+            let span = self
+                .md
+                .get_instruction_span(self.wires[this_wire_id].original_instruction);
             span.debug();
 
-            match &this_wire.source {
+            match &self.wire_sources[this_wire_id] {
                 RealWireDataSource::ReadOnly => {}
                 RealWireDataSource::Multiplexer { is_state, sources } => {
                     if let Some(is_state) = is_state {
-                        assert!(is_state.is_of_type(&this_wire.typ));
+                        assert!(is_state.is_of_type(this_wire_typ));
                     }
                     for s in sources {
-                        let source_typ = &self.wires[s.from].typ;
-                        let destination_typ = self
-                            .walk_type_along_path(self.wires[this_wire_id].typ.clone(), &s.to_path);
+                        let source_typ = &self.wire_types[s.from];
+                        let destination_typ =
+                            self.walk_type_along_path(this_wire_typ.clone(), &s.to_path);
                         self.type_substitutor.unify_report_error(
                             &destination_typ,
                             source_typ,
@@ -90,13 +92,13 @@ impl InstantiationContext<'_, '_> {
                     };
 
                     self.type_substitutor.unify_report_error(
-                        &self.wires[right].typ,
+                        &self.wire_types[right],
                         &input_typ,
                         span,
                         "unary input",
                     );
                     self.type_substitutor.unify_report_error(
-                        &self.wires[this_wire_id].typ,
+                        this_wire_typ,
                         &output_typ,
                         span,
                         "unary output",
@@ -149,36 +151,36 @@ impl InstantiationContext<'_, '_> {
                         }
                     };
                     self.type_substitutor.unify_report_error(
-                        &self.wires[this_wire_id].typ,
+                        this_wire_typ,
                         &out,
                         span,
                         "binary output",
                     );
                     self.type_substitutor.unify_report_error(
-                        &self.wires[left].typ,
+                        &self.wire_types[left],
                         &in_left,
                         span,
                         "binary left",
                     );
                     self.type_substitutor.unify_report_error(
-                        &self.wires[right].typ,
+                        &self.wire_types[right],
                         &in_right,
                         span,
                         "binary right",
                     );
                 }
                 RealWireDataSource::Select { root, path } => {
-                    let found_typ = self.walk_type_along_path(self.wires[*root].typ.clone(), path);
+                    let found_typ = self.walk_type_along_path(self.wire_types[*root].clone(), path);
                     self.type_substitutor.unify_report_error(
                         &found_typ,
-                        &self.wires[this_wire_id].typ,
+                        this_wire_typ,
                         span,
                         "wire access",
                     );
                 }
                 RealWireDataSource::Constant { value } => {
                     assert!(
-                        value.is_of_type(&this_wire.typ),
+                        value.is_of_type(this_wire_typ),
                         "Assigned type to a constant should already be of the type"
                     );
                 }
@@ -187,11 +189,13 @@ impl InstantiationContext<'_, '_> {
     }
 
     fn finalize(&mut self) {
-        for (_id, w) in &mut self.wires {
-            if !w.typ.fully_substitute(&self.type_substitutor) {
-                let typ_as_str = w.typ.display(&self.linker.types);
+        for (id, typ) in &mut self.wire_types {
+            if !typ.fully_substitute(&self.type_substitutor) {
+                let typ_as_str = typ.display(&self.linker.types);
 
-                let span = self.md.get_instruction_span(w.original_instruction);
+                let span = self
+                    .md
+                    .get_instruction_span(self.wires[id].original_instruction);
                 span.debug();
                 self.errors.error(span, format!("Could not finalize this type, some parameters were still unknown: {typ_as_str}"));
             }
@@ -229,7 +233,7 @@ impl InstantiationContext<'_, '_> {
             let sub_module = &self.linker.modules[sm.module_uuid];
 
             for (port_id, p) in sm.port_map.iter_valids() {
-                let wire = &self.wires[p.maps_to_wire];
+                let wire_typ = &self.wire_types[p.maps_to_wire];
 
                 let port_decl_instr = sub_module.ports[port_id].declaration_instruction;
                 let port_decl =
@@ -243,7 +247,7 @@ impl InstantiationContext<'_, '_> {
                 );
 
                 self.type_substitutor
-                    .unify_must_succeed(&wire.typ, &typ_for_inference);
+                    .unify_must_succeed(wire_typ, &typ_for_inference);
             }
 
             delayed_constraints.push(SubmoduleTypecheckConstraint { sm_id });
@@ -373,111 +377,142 @@ impl DelayedConstraint<InstantiationContext<'_, '_>> for SubmoduleTypecheckConst
             context.md.link_info.instructions[sm.original_instruction].unwrap_submodule();
         let sub_module = &context.linker.modules[sm.module_uuid];
 
-        // Check if there's any argument that isn't known
-        for (_id, arg) in &mut sm.template_args {
-            if !arg.fully_substitute(&context.type_substitutor) {
-                // We don't actually *need* to already fully_substitute here, but it's convenient and saves some work
-                return DelayedConstraintStatus::NoProgress;
+        let template_args = match &sm.interned_template_args {
+            Some(template_args) => template_args.clone(),
+            None => {
+                // Check if there's any argument that isn't known
+                for (_id, arg) in &mut sm.template_args {
+                    if !arg.fully_substitute(&context.type_substitutor) {
+                        // We don't actually *need* to already fully_substitute here, but it's convenient and saves some work
+                        return DelayedConstraintStatus::NoProgress;
+                    }
+                }
+                // Interned once per submodule, later attempts and the cache lookup only use the handle
+                let template_args = context
+                    .linker
+                    .template_args_interner
+                    .intern(&sm.template_args);
+                sm.template_args = FlatAlloc::new();
+                sm.interned_template_args = Some(template_args.clone());
+                template_args
             }
-        }
+        };
 
-        if let Some(instance) = sub_module.instantiations.instantiate(
+        match sub_module.instantiations.instantiate(
             sub_module,
             context.linker,
-            sm.template_args.clone(),
+            template_args,
+            context.cancelled,
         ) {
-            for (_port_id, concrete_port, source_code_port, connecting_wire) in
-                zip_eq3(&instance.interface_ports, &sub_module.ports, &sm.port_map)
-            {
-                match (concrete_port, connecting_wire) {
-                    (None, None) => {} // Invalid port not connected, good!
-                    (None, Some(connecting_wire)) => {
-                        // Port is not enabled, but attempted to be used
-                        // A question may be "What if no port was in the source code? There would be no error reported"
-                        // But this is okay, because nonvisible ports are only possible for function calls
-                        // We have a second routine that reports invalid interfaces.
-                        for span in &connecting_wire.name_refs {
-                            context.errors.error(*span, format!("Port '{}' is used, but the instantiated module has this port disabled", source_code_port.name))
+            Ok(instance) => {
+                for (_port_id, concrete_port, source_code_port, connecting_wire) in
+                    zip_eq3(&instance.interface_ports, &sub_module.ports, &sm.port_map)
+                {
+                    match (concrete_port, connecting_wire) {
+                        (None, None) => {} // Invalid port not connected, good!
+                        (None, Some(connecting_wire)) => {
+                            // Port is not enabled, but attempted to be used
+                            // A question may be "What if no port was in the source code? There would be no error reported"
+                            // But this is okay, because nonvisible ports are only possible for function calls
+                            // We have a second routine that reports invalid interfaces.
+                            for span in &connecting_wire.name_refs {
+                                context.errors.error(*span, format!("Port '{}' is used, but the instantiated module has this port disabled", source_code_port.name))
                                 .info_obj_different_file(source_code_port, sub_module.link_info.file)
                                 .info_obj_same_file(submod_instr);
+                            }
                         }
-                    }
-                    (Some(_concrete_port), None) => {
-                        // Port is enabled, but not used
-                        context
-                            .errors
-                            .warn(
-                                submod_instr.module_ref.get_total_span(),
-                                format!("Unused port '{}'", source_code_port.name),
-                            )
-                            .info_obj_different_file(source_code_port, sub_module.link_info.file)
-                            .info_obj_same_file(submod_instr);
-                    }
-                    (Some(concrete_port), Some(connecting_wire)) => {
-                        let wire = &context.wires[connecting_wire.maps_to_wire];
-                        context.type_substitutor.unify_report_error(
-                            &wire.typ,
-                            &concrete_port.typ,
-                            submod_instr.module_ref.get_total_span(),
-                            || {
-                                let port_declared_here = source_code_port
-                                    .make_info(sub_module.link_info.file)
-                                    .unwrap();
-
-                                (
-                                    format!("Port '{}'", source_code_port.name),
-                                    vec![port_declared_here],
+                        (Some(_concrete_port), None) => {
+                            // Port is enabled, but not used
+                            context
+                                .errors
+                                .warn(
+                                    submod_instr.module_ref.get_total_span(),
+                                    format!("Unused port '{}'", source_code_port.name),
                                 )
-                            },
-                        );
+                                .info_obj_different_file(
+                                    source_code_port,
+                                    sub_module.link_info.file,
+                                )
+                                .info_obj_same_file(submod_instr);
+                        }
+                        (Some(concrete_port), Some(connecting_wire)) => {
+                            context.type_substitutor.unify_report_error(
+                                &context.wire_types[connecting_wire.maps_to_wire],
+                                &concrete_port.typ,
+                                submod_instr.module_ref.get_total_span(),
+                                || {
+                                    let port_declared_here = source_code_port
+                                        .make_info(sub_module.link_info.file)
+                                        .unwrap();
+
+                                    (
+                                        format!("Port '{}'", source_code_port.name),
+                                        vec![port_declared_here],
+                                    )
+                                },
+                            );
+                        }
                     }
                 }
-            }
-            for (_interface_id, interface_references, sm_interface) in
-                zip_eq(&sm.interface_call_sites, &sub_module.interfaces)
-            {
-                if !interface_references.is_empty() {
-                    let interface_name = &sm_interface.name;
-                    if let Some(representative_port) = sm_interface
-                        .func_call_inputs
-                        .first()
-                        .or(sm_interface.func_call_outputs.first())
-                    {
-                        if instance.interface_ports[representative_port].is_none() {
-                            for span in interface_references {
-                                context.errors.error(*span, format!("The interface '{interface_name}' is disabled in this submodule instance"))
+                for (_interface_id, interface_references, sm_interface) in
+                    zip_eq(&sm.interface_call_sites, &sub_module.interfaces)
+                {
+                    if !interface_references.is_empty() {
+                        let interface_name = &sm_interface.name;
+                        if let Some(representative_port) = sm_interface
+                            .func_call_inputs
+                            .first()
+                            .or(sm_interface.func_call_outputs.first())
+                        {
+                            if instance.interface_ports[representative_port].is_none() {
+                                for span in interface_references {
+                                    context.errors.error(*span, format!("The interface '{interface_name}' is disabled in this submodule instance"))
                                     .info_obj_same_file(submod_instr)
                                     .info((sm_interface.name_span, sub_module.link_info.file), format!("Interface '{interface_name}' declared here"));
+                                }
                             }
-                        }
-                    } else {
-                        for span in interface_references {
-                            context.errors.todo(*span, format!("Using empty interface '{interface_name}' (This is a TODO with Actions etc)"))
+                        } else {
+                            for span in interface_references {
+                                context.errors.todo(*span, format!("Using empty interface '{interface_name}' (This is a TODO with Actions etc)"))
                                 .info_obj_same_file(submod_instr)
                                 .info((sm_interface.name_span, sub_module.link_info.file), format!("Interface '{interface_name}' declared here"));
+                            }
+                        }
+                        if sm_interface
+                            .all_ports()
+                            .iter()
+                            .any(|port_id| instance.interface_ports[port_id].is_none())
+                        {
+                            // We say an interface is invalid if it has an invalid port.
+                            todo!("Invalid Interfaces");
                         }
-                    }
-                    if sm_interface
-                        .all_ports()
-                        .iter()
-                        .any(|port_id| instance.interface_ports[port_id].is_none())
-                    {
-                        // We say an interface is invalid if it has an invalid port.
-                        todo!("Invalid Interfaces");
                     }
                 }
-            }
 
-            sm.instance
-                .set(instance)
-                .expect("Can only set the instance of a submodule once");
-            DelayedConstraintStatus::Resolved
-        } else {
-            context.errors.error(
-                submod_instr.module_ref.get_total_span(),
-                "Error instantiating submodule",
-            );
-            DelayedConstraintStatus::NoProgress
+                sm.instance
+                    .set(instance)
+                    .expect("Can only set the instance of a submodule once");
+                DelayedConstraintStatus::Resolved
+            }
+            Err(InstantiateError::Errored) => {
+                context.errors.error(
+                    submod_instr.module_ref.get_total_span(),
+                    "Error instantiating submodule",
+                );
+                DelayedConstraintStatus::NoProgress
+            }
+            // The instance that needs this submodule is thrown away as well
+            Err(InstantiateError::Cancelled) => DelayedConstraintStatus::NoProgress,
+            Err(InstantiateError::Recursive) => {
+                context.errors.error(
+                    submod_instr.module_ref.get_total_span(),
+                    format!(
+                        "{} instantiates itself with the same template arguments",
+                        sub_module.link_info.name
+                    ),
+                );
+                DelayedConstraintStatus::NoProgress
+            }
         }
     }
 
@@ -490,7 +525,7 @@ impl DelayedConstraint<InstantiationContext<'_, '_>> for SubmoduleTypecheckConst
 
         let submodule_template_args_string = pretty_print_concrete_instance(
             &sub_module.link_info,
-            &sm.template_args,
+            sm.template_args(),
             &context.linker.types,
         );
         let message = format!("Could not fully instantiate {submodule_template_args_string}");
@@ -5,6 +5,7 @@
 //! As for typing, it only instantiates written types and leaves the rest for further typechecking.
 
 use std::ops::{Deref, Index, IndexMut};
+use std::sync::atomic::Ordering;
 
 use crate::linker::IsExtern;
 use crate::prelude::*;
@@ -13,7 +14,7 @@ use crate::typing::template::GlobalReference;
 use num::BigInt;
 
 use crate::flattening::*;
-use crate::value::{compute_binary_op, compute_unary_op, Value};
+use crate::value::{compute_binary_op, compute_unary_op, IntValue, Value};
 
 use crate::typing::{
     abstract_type::DomainType,
@@ -58,7 +59,9 @@ impl GenerationState<'_> {
                         caught_by_typecheck!("Non-array")
                     };
                     let array_len = a_box.len();
-                    let Some(tt) = usize::try_from(idx).ok().and_then(|pos| a_box.get_mut(pos))
+                    let Some(tt) = idx
+                        .to_primitive()
+                        .and_then(|pos: usize| Arc::make_mut(a_box).get_mut(pos))
                     else {
                         return Err((
                             bracket_span.inner_span(),
@@ -92,17 +95,17 @@ impl GenerationState<'_> {
             ))
         }
     }
-    fn get_generation_integer(&self, idx: FlatID) -> ExecutionResult<&BigInt> {
+    fn get_generation_integer(&self, idx: FlatID) -> ExecutionResult<&IntValue> {
         let val = self.get_generation_value(idx)?;
         Ok(val.unwrap_integer())
     }
-    fn get_generation_small_int<INT: for<'v> TryFrom<&'v BigInt>>(
+    fn get_generation_small_int<INT: TryFrom<i64> + for<'v> TryFrom<&'v BigInt>>(
         &self,
         idx: FlatID,
     ) -> ExecutionResult<INT> {
         let val = self.get_generation_value(idx)?;
         let val_as_int = val.unwrap_integer();
-        INT::try_from(val_as_int).map_err(|_| {
+        val_as_int.to_primitive().ok_or_else(|| {
             (
                 self.span_of(idx),
                 format!(
@@ -130,14 +133,14 @@ impl IndexMut<FlatID> for GenerationState<'_> {
 
 fn array_access<'v>(
     arr_val: &'v Value,
-    idx: &BigInt,
+    idx: &IntValue,
     span: BracketSpan,
 ) -> ExecutionResult<&'v Value> {
     let Value::Array(arr) = arr_val else {
         caught_by_typecheck!("Value must be an array")
     };
 
-    if let Some(elem) = usize::try_from(idx).ok().and_then(|idx| arr.get(idx)) {
+    if let Some(elem) = idx.to_primitive().and_then(|idx: usize| arr.get(idx)) {
         Ok(elem)
     } else {
         Err((
@@ -240,10 +243,10 @@ impl InstantiationContext<'_, '_> {
                 "clog2" => {
                     let (val, span) = self.get_first_template_argument_value(cst_ref);
                     let int_val = val.unwrap_integer();
-                    if *int_val > BigInt::ZERO {
-                        let int_val_minus_one: BigInt = int_val - 1;
+                    if *int_val > IntValue::ZERO {
+                        let int_val_minus_one = int_val - &IntValue::ONE;
 
-                        Value::Integer(BigInt::from(int_val_minus_one.bits()))
+                        Value::Integer(IntValue::from(int_val_minus_one.bits()))
                     } else {
                         return Err((span, format!("clog2 argument must be > 0, found {int_val}")));
                     }
@@ -320,7 +323,7 @@ impl InstantiationContext<'_, '_> {
                 &WireReferencePathElement::ArrayAccess { idx, bracket_span } => {
                     let idx_wire = self.get_wire_or_constant_as_wire(idx, domain);
                     assert_eq!(
-                        self.wires[idx_wire].typ, INT_CONCRETE_TYPE,
+                        self.wire_types[idx_wire], INT_CONCRETE_TYPE,
                         "Caught by typecheck"
                     );
                     preamble.push(RealWirePathElem::ArrayAccess {
@@ -345,13 +348,13 @@ impl InstantiationContext<'_, '_> {
         let RealWireDataSource::Multiplexer {
             is_state: _,
             sources,
-        } = &mut self.wires[write_to_wire].source
+        } = &mut self.wire_sources[write_to_wire]
         else {
             caught_by_typecheck!("Should only be a writeable wire here")
         };
 
         sources.push(MultiplexerSource {
-            to_path,
+            to_path: to_path.into_boxed_slice(),
             num_regs,
             from,
             condition: self.condition_stack.clone().into_boxed_slice(),
@@ -426,7 +429,7 @@ impl InstantiationContext<'_, '_> {
                 let RealWireDataSource::Multiplexer {
                     is_state: Some(initial_value),
                     sources: _,
-                } = &mut self.wires[root_wire].source
+                } = &mut self.wire_sources[root_wire]
                 else {
                     caught_by_typecheck!()
                 };
@@ -440,33 +443,36 @@ impl InstantiationContext<'_, '_> {
         Ok(())
     }
     fn compute_compile_time_wireref(&self, wire_ref: &WireReference) -> ExecutionResult<Value> {
-        let mut work_on_value: Value = match &wire_ref.root {
+        let named_constant_value;
+        let mut work_on_value: &Value = match &wire_ref.root {
             &WireReferenceRoot::LocalDecl(decl_id, _span) => {
-                self.generation_state.get_generation_value(decl_id)?.clone()
+                self.generation_state.get_generation_value(decl_id)?
+            }
+            WireReferenceRoot::NamedConstant(cst) => {
+                named_constant_value = self.get_named_constant_value(cst)?;
+                &named_constant_value
             }
-            WireReferenceRoot::NamedConstant(cst) => self.get_named_constant_value(cst)?,
             &WireReferenceRoot::SubModulePort(_) => {
                 todo!("Don't yet support compile time functions")
             }
         };
 
+        // Only clone the element that is selected in the end, not every array along the way
         for path_elem in &wire_ref.path {
             work_on_value = match path_elem {
                 &WireReferencePathElement::ArrayAccess { idx, bracket_span } => {
                     let idx = self.generation_state.get_generation_integer(idx)?;
 
-                    array_access(&work_on_value, idx, bracket_span)?.clone()
+                    array_access(work_on_value, idx, bracket_span)?
                 }
             }
         }
 
-        Ok(work_on_value)
+        Ok(work_on_value.clone())
     }
     fn compute_compile_time(&mut self, expression: &Expression) -> ExecutionResult<Value> {
         Ok(match &expression.source {
-            ExpressionSource::WireRef(wire_ref) => {
-                self.compute_compile_time_wireref(wire_ref)?.clone()
-            }
+            ExpressionSource::WireRef(wire_ref) => self.compute_compile_time_wireref(wire_ref)?,
             &ExpressionSource::UnaryOp { op, right } => {
                 let right_val = self.generation_state.get_generation_value(right)?;
                 compute_unary_op(op, right_val)
@@ -477,7 +483,6 @@ impl InstantiationContext<'_, '_> {
 
                 match op {
                     BinaryOperator::Divide | BinaryOperator::Modulo => {
-                        use num::Zero;
                         if right_val.unwrap_integer().is_zero() {
                             return Err((
                                 expression.span,
@@ -497,21 +502,34 @@ impl InstantiationContext<'_, '_> {
         })
     }
 
+    /// Every wire gets an entry in each of the wire tables, see [InstantiatedModule::wires]
+    fn alloc_wire(
+        &mut self,
+        wire: RealWire,
+        source: RealWireDataSource,
+        typ: ConcreteType,
+    ) -> WireID {
+        let wire_id = self.wires.alloc(wire);
+        self.wire_sources.alloc(source);
+        self.wire_types.alloc(typ);
+        self.wire_latencies.alloc(CALCULATE_LATENCY_LATER);
+        wire_id
+    }
+
     fn alloc_wire_for_const(
         &mut self,
         value: Value,
         original_instruction: FlatID,
         domain: DomainID,
     ) -> WireID {
-        self.wires.alloc(RealWire {
-            typ: value.get_type_best_effort(&mut self.type_substitutor),
-            source: RealWireDataSource::Constant { value },
+        let typ = value.get_type_best_effort(&mut self.type_substitutor);
+        let wire = RealWire {
             original_instruction,
             domain,
             name: self.unique_name_producer.get_unique_name(""),
             specified_latency: CALCULATE_LATENCY_LATER,
-            absolute_latency: CALCULATE_LATENCY_LATER,
-        })
+        };
+        self.alloc_wire(wire, RealWireDataSource::Constant { value }, typ)
     }
     fn get_wire_or_constant_as_wire(
         &mut self,
@@ -560,17 +578,16 @@ impl InstantiationContext<'_, '_> {
                 RealWireDataSource::ReadOnly
             };
             let domain = submodule_instruction.local_interface_domains[port_data.domain];
-            let new_wire = self.wires.alloc(RealWire {
-                source,
+            let wire = RealWire {
                 original_instruction: submod_instance.original_instruction,
                 domain: domain.unwrap_physical(),
-                typ: ConcreteType::Unknown(self.type_substitutor.alloc()),
                 name: self
                     .unique_name_producer
                     .get_unique_name(format!("{}_{}", submod_instance.name, port_data.name)),
                 specified_latency: CALCULATE_LATENCY_LATER,
-                absolute_latency: CALCULATE_LATENCY_LATER,
-            });
+            };
+            let typ = ConcreteType::Unknown(self.type_substitutor.alloc());
+            let new_wire = self.alloc_wire(wire, source, typ);
 
             let name_refs = if let Some(sp) = port_name_span {
                 vec![sp]
@@ -578,7 +595,7 @@ impl InstantiationContext<'_, '_> {
                 Vec::new()
             };
 
-            *wire_found = Some(SubModulePort {
+            self.submodules[sub_module_id].port_map[port_id] = Some(SubModulePort {
                 maps_to_wire: new_wire,
                 name_refs,
             });
@@ -629,7 +646,7 @@ impl InstantiationContext<'_, '_> {
 
                 RealWireDataSource::Select {
                     root: root_wire,
-                    path,
+                    path: path.into_boxed_slice(),
                 }
             }
             &ExpressionSource::UnaryOp { op, right } => {
@@ -645,15 +662,14 @@ impl InstantiationContext<'_, '_> {
                 unreachable!("Constant cannot be non-compile-time");
             }
         };
-        Ok(self.wires.alloc(RealWire {
+        let wire = RealWire {
             name: self.unique_name_producer.get_unique_name(""),
-            typ: ConcreteType::Unknown(self.type_substitutor.alloc()),
             original_instruction,
             domain,
-            source,
             specified_latency: CALCULATE_LATENCY_LATER,
-            absolute_latency: CALCULATE_LATENCY_LATER,
-        }))
+        };
+        let typ = ConcreteType::Unknown(self.type_substitutor.alloc());
+        Ok(self.alloc_wire(wire, source, typ))
     }
 
     fn instantiate_declaration(
@@ -692,15 +708,13 @@ impl InstantiationContext<'_, '_> {
             } else {
                 CALCULATE_LATENCY_LATER
             };
-            let wire_id = self.wires.alloc(RealWire {
+            let wire = RealWire {
                 name: self.unique_name_producer.get_unique_name(&wire_decl.name),
-                typ,
                 original_instruction,
                 domain: wire_decl.typ.domain.unwrap_physical(),
-                source,
                 specified_latency,
-                absolute_latency: CALCULATE_LATENCY_LATER,
-            });
+            };
+            let wire_id = self.alloc_wire(wire, source, typ);
             SubModuleOrWire::Wire(wire_id)
         })
     }
@@ -708,6 +722,12 @@ impl InstantiationContext<'_, '_> {
     fn instantiate_code_block(&mut self, block_range: FlatIDRange) -> ExecutionResult<()> {
         let mut instruction_range = block_range.into_iter();
         while let Some(original_instruction) = instruction_range.next() {
+            if self.cancelled.load(Ordering::Relaxed) {
+                return Err((
+                    self.md.get_instruction_span(original_instruction),
+                    "Instantiation was cancelled".to_owned(),
+                ));
+            }
             let instr = &self.md.link_info.instructions[original_instruction];
             self.md.get_instruction_span(original_instruction).debug();
             let instance_to_add: SubModuleOrWire = match instr {
@@ -737,12 +757,13 @@ impl InstantiationContext<'_, '_> {
                     }
                     SubModuleOrWire::SubModule(self.submodules.alloc(SubModule {
                         original_instruction,
-                        instance: OnceCell::new(),
+                        instance: OnceLock::new(),
                         port_map,
                         interface_call_sites,
                         name: self.unique_name_producer.get_unique_name(name_origin),
                         module_uuid: submodule.module_ref.id,
                         template_args,
+                        interned_template_args: None,
                     }))
                 }
                 Instruction::Declaration(wire_decl) => {
@@ -875,7 +896,7 @@ impl InstantiationContext<'_, '_> {
                             unreachable!()
                         };
                         *v = Value::Integer(current_val.clone());
-                        current_val += 1;
+                        current_val = &current_val + &IntValue::ONE;
                         self.instantiate_code_block(stm.loop_body)?;
                     }
 
@@ -892,13 +913,12 @@ impl InstantiationContext<'_, '_> {
         for (port_id, port) in &self.md.ports {
             let port_decl_id = port.declaration_instruction;
             if let SubModuleOrWire::Wire(wire_id) = &self.generation_state[port_decl_id] {
-                let wire = &self.wires[*wire_id];
                 self.interface_ports[port_id] = Some(InstantiatedPort {
                     wire: *wire_id,
                     is_input: port.is_input,
                     absolute_latency: CALCULATE_LATENCY_LATER,
-                    typ: wire.typ.clone(),
-                    domain: wire.domain,
+                    typ: self.wire_types[*wire_id].clone(),
+                    domain: self.wires[*wire_id].domain,
                 })
             }
         }
@@ -0,0 +1,141 @@
+//! The slots of the [super::InstantiationCache]. Every instance is built by exactly one thread, other threads that need it wait for it.
+//!
+//! A module that (transitively) instantiates itself with the same template arguments would wait for itself forever,
+//! either on one thread, or spread over several threads that each wait for the next.
+//! So before waiting, the chain of threads that the builder of the slot is waiting for is followed.
+//! If it leads back to the current thread, [Claim::Recursive] is returned instead.
+
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::ThreadId;
+
+use super::InstantiatedModule;
+
+/// For every thread that is waiting on a slot, the thread that is building it. Slots only change state while this is locked
+static WAITING_FOR: Mutex<Vec<(ThreadId, ThreadId)>> = Mutex::new(Vec::new());
+/// Notified whenever a slot stops being built
+static BUILD_FINISHED: Condvar = Condvar::new();
+
+#[derive(Debug)]
+enum SlotState {
+    Empty,
+    Building(ThreadId),
+    Built(Arc<InstantiatedModule>),
+}
+
+#[derive(Debug)]
+pub struct InstanceSlot {
+    state: Mutex<SlotState>,
+}
+
+impl Default for InstanceSlot {
+    fn default() -> Self {
+        Self {
+            state: Mutex::new(SlotState::Empty),
+        }
+    }
+}
+
+pub enum Claim<'s> {
+    /// The calling thread has to build the instance
+    Build(BuildGuard<'s>),
+    Built(Arc<InstantiatedModule>),
+    /// Building the instance requires (transitively) this same instance
+    Recursive,
+}
+
+/// Whether following [WAITING_FOR] from `thread` leads to `target`
+fn waits_for(waiting_for: &[(ThreadId, ThreadId)], mut thread: ThreadId, target: ThreadId) -> bool {
+    loop {
+        if thread == target {
+            return true;
+        }
+        match waiting_for.iter().find(|(waiter, _)| *waiter == thread) {
+            Some((_, builder)) => thread = *builder,
+            None => return false,
+        }
+    }
+}
+
+impl InstanceSlot {
+    /// The instance, if it has been built already
+    pub fn get(&self) -> Option<Arc<InstantiatedModule>> {
+        match &*self.state.lock().unwrap() {
+            SlotState::Built(instance) => Some(instance.clone()),
+            SlotState::Empty | SlotState::Building(_) => None,
+        }
+    }
+
+    /// Blocks while another thread is building the instance
+    pub fn claim(&self) -> Claim<'_> {
+        let current_thread = std::thread::current().id();
+        let mut waiting_for = WAITING_FOR.lock().unwrap();
+        loop {
+            let builder = {
+                let mut state = self.state.lock().unwrap();
+                match &*state {
+                    SlotState::Built(instance) => return Claim::Built(instance.clone()),
+                    SlotState::Empty => {
+                        *state = SlotState::Building(current_thread);
+                        return Claim::Build(BuildGuard { slot: self });
+                    }
+                    SlotState::Building(builder) => *builder,
+                }
+            };
+            if waits_for(&waiting_for, builder, current_thread) {
+                return Claim::Recursive;
+            }
+            waiting_for.push((current_thread, builder));
+            waiting_for = BUILD_FINISHED.wait(waiting_for).unwrap();
+            waiting_for.retain(|(waiter, _)| *waiter != current_thread);
+        }
+    }
+
+    fn set_state(&self, new_state: SlotState) {
+        let _waiting_for = WAITING_FOR.lock().unwrap();
+        *self.state.lock().unwrap() = new_state;
+        BUILD_FINISHED.notify_all();
+    }
+}
+
+/// If dropped without [BuildGuard::finish], for instance because building panicked, the slot is emptied again
+pub struct BuildGuard<'s> {
+    slot: &'s InstanceSlot,
+}
+
+impl BuildGuard<'_> {
+    pub fn finish(self, instance: Arc<InstantiatedModule>) {
+        self.slot.set_state(SlotState::Built(instance));
+        std::mem::forget(self);
+    }
+}
+
+impl Drop for BuildGuard<'_> {
+    fn drop(&mut self) {
+        self.slot.set_state(SlotState::Empty);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn claiming_a_slot_that_is_being_built_on_the_same_thread_is_recursive() {
+        let slot = InstanceSlot::default();
+        let Claim::Build(_build) = slot.claim() else {
+            panic!("An empty slot must be built by the first thread to claim it");
+        };
+        assert!(matches!(slot.claim(), Claim::Recursive));
+    }
+
+    #[test]
+    fn abandoned_slots_are_built_again() {
+        let slot = InstanceSlot::default();
+        let Claim::Build(build) = slot.claim() else {
+            panic!("An empty slot must be built by the first thread to claim it");
+        };
+        drop(build);
+        assert!(matches!(slot.claim(), Claim::Build(_)));
+        assert!(slot.get().is_none());
+    }
+}
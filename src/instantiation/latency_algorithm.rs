@@ -1,4 +1,7 @@
+use std::{cmp::Reverse, collections::BinaryHeap};
+
 use crate::config::config;
+use crate::parallel::parallel_map;
 
 use super::list_of_lists::ListOfLists;
 
@@ -56,11 +59,6 @@ pub fn convert_fanin_to_fanout(fanins: &ListOfLists<FanInOut>) -> ListOfLists<Fa
     )
 }
 
-struct LatencyStackElem<'d> {
-    node_idx: usize,
-    remaining_fanout: std::slice::Iter<'d, FanInOut>,
-}
-
 /// The node for the latency-counting graph. See [solve_latencies]
 #[derive(Clone, Copy)]
 struct LatencyNode {
@@ -88,10 +86,6 @@ impl LatencyNode {
         assert!(!self.pinned);
         self.pinned = true;
     }
-    fn unpin(&mut self) {
-        assert!(self.pinned);
-        self.pinned = false;
-    }
     fn is_pinned(&self) -> bool {
         self.pinned
     }
@@ -113,11 +107,8 @@ impl LatencyNode {
         assert!(self.is_set());
         assert!(self.pinned);
     }
-    fn update_and_pin<const BACKWARDS: bool>(
-        &mut self,
-        from: LatencyNode,
-        delta: i64,
-    ) -> LatencyNodeUpdate {
+    /// Returns the new latency if going through `from` would push this node further (backward resp. forward)
+    fn proposed_update<const BACKWARDS: bool>(&self, from: LatencyNode, delta: i64) -> Option<i64> {
         from.assert_is_set();
         assert!(delta != i64::MIN);
 
@@ -127,30 +118,160 @@ impl LatencyNode {
         } else {
             new_latency > self.abs_lat || self.abs_lat == i64::MIN
         };
-        if should_update {
-            if self.pinned {
-                LatencyNodeUpdate::ErrorPinnedConflict { new_latency }
+        should_update.then_some(new_latency)
+    }
+}
+
+/// Finds the strongly connected components of the graph with an iterative version of Tarjan's algorithm.
+///
+/// Returns for each node the index of its component. These are numbered in topological order,
+/// so every fanout goes to a component with an equal or higher index.
+fn topological_scc_ranks(fanouts: &ListOfLists<FanInOut>) -> Vec<usize> {
+    const UNVISITED: usize = usize::MAX;
+
+    struct TarjanState {
+        visit_index: Vec<usize>,
+        lowlink: Vec<usize>,
+        on_scc_stack: Vec<bool>,
+        scc_stack: Vec<usize>,
+        next_visit_index: usize,
+    }
+    impl TarjanState {
+        fn visit(&mut self, node: usize) {
+            self.visit_index[node] = self.next_visit_index;
+            self.lowlink[node] = self.next_visit_index;
+            self.next_visit_index += 1;
+            self.on_scc_stack[node] = true;
+            self.scc_stack.push(node);
+        }
+    }
+
+    let num_nodes = fanouts.len();
+    let mut state = TarjanState {
+        visit_index: vec![UNVISITED; num_nodes],
+        lowlink: vec![0; num_nodes],
+        on_scc_stack: vec![false; num_nodes],
+        scc_stack: Vec::new(),
+        next_visit_index: 0,
+    };
+    let mut scc_of = vec![0; num_nodes];
+    let mut num_sccs = 0;
+    let mut call_stack: Vec<(usize, std::slice::Iter<'_, FanInOut>)> = Vec::new();
+
+    for root in 0..num_nodes {
+        if state.visit_index[root] != UNVISITED {
+            continue;
+        }
+        state.visit(root);
+        call_stack.push((root, fanouts[root].iter()));
+
+        while let Some((node, remaining_fanout)) = call_stack.last_mut() {
+            let node = *node;
+            if let Some(&FanInOut { other, .. }) = remaining_fanout.next() {
+                if state.visit_index[other] == UNVISITED {
+                    state.visit(other);
+                    call_stack.push((other, fanouts[other].iter()));
+                } else if state.on_scc_stack[other] {
+                    state.lowlink[node] = state.lowlink[node].min(state.visit_index[other]);
+                }
             } else {
-                self.abs_lat = new_latency;
-                self.pinned = true;
-                LatencyNodeUpdate::Updated
+                call_stack.pop();
+                if let Some((parent, _)) = call_stack.last() {
+                    state.lowlink[*parent] = state.lowlink[*parent].min(state.lowlink[node]);
+                }
+                if state.lowlink[node] == state.visit_index[node] {
+                    loop {
+                        let member = state.scc_stack.pop().unwrap();
+                        state.on_scc_stack[member] = false;
+                        scc_of[member] = num_sccs;
+                        if member == node {
+                            break;
+                        }
+                    }
+                    num_sccs += 1;
+                }
             }
-        } else {
-            LatencyNodeUpdate::NoChange
         }
     }
+
+    // Tarjan's algorithm finishes components in reverse topological order
+    for scc in &mut scc_of {
+        *scc = num_sccs - 1 - *scc;
+    }
+    scc_of
 }
 
-enum LatencyNodeUpdate {
-    NoChange,
-    Updated,
-    ErrorPinnedConflict { new_latency: i64 },
+const NO_PARENT: usize = usize::MAX;
+
+/// Reused by all [count_latency] calls of one [solve_latencies]
+///
+/// Nodes are processed in topological order of their strongly connected component, such that outside of cycles,
+/// every node is only explored once, after all of its predecessors have been settled.
+struct LatencyCountingScratch {
+    /// See [topological_scc_ranks]
+    scc_rank: Vec<usize>,
+    queue: BinaryHeap<Reverse<(usize, usize)>>,
+    in_queue: Vec<bool>,
+    /// The node that last updated this node's latency in the current [count_latency]. Always forms a forest rooted in the start nodes
+    parent: Vec<usize>,
+    /// Unpinned nodes that were given a latency since the last [LatencyCountingScratch::clear_unpinned_latencies]
+    touched: Vec<usize>,
 }
 
-fn clear_unpinned_latencies(working_latencies: &mut [LatencyNode]) {
-    for l in working_latencies {
-        if !l.pinned {
-            l.abs_lat = i64::MIN;
+impl LatencyCountingScratch {
+    fn new(fanouts: &ListOfLists<FanInOut>) -> Self {
+        let num_nodes = fanouts.len();
+        Self {
+            scc_rank: topological_scc_ranks(fanouts),
+            queue: BinaryHeap::new(),
+            in_queue: vec![false; num_nodes],
+            parent: vec![NO_PARENT; num_nodes],
+            touched: Vec::new(),
+        }
+    }
+
+    fn enqueue<const BACKWARDS: bool>(&mut self, node: usize) {
+        if !self.in_queue[node] {
+            self.in_queue[node] = true;
+            let rank = self.scc_rank[node];
+            let order = if BACKWARDS { usize::MAX - rank } else { rank };
+            self.queue.push(Reverse((order, node)));
+        }
+    }
+
+    /// Checks if `ancestor` led to `node` in the current [count_latency] pass. If it did, an edge from `node` to `ancestor` closes a cycle.
+    ///
+    /// A cycle always lies within a single strongly connected component, so we can stop as soon as we leave it
+    fn is_ancestor(&self, ancestor: usize, node: usize) -> bool {
+        let scc = self.scc_rank[ancestor];
+        let mut cur = node;
+        while cur != NO_PARENT && self.scc_rank[cur] == scc {
+            if cur == ancestor {
+                return true;
+            }
+            cur = self.parent[cur];
+        }
+        false
+    }
+
+    /// The path that led to `node`, starting at one of the start nodes of the current [count_latency], or at `ancestor`
+    fn path_to(&self, node: usize, stop_at: usize) -> Vec<usize> {
+        let mut path = vec![node];
+        let mut cur = node;
+        while cur != stop_at && self.parent[cur] != NO_PARENT {
+            cur = self.parent[cur];
+            path.push(cur);
+        }
+        path.reverse();
+        path
+    }
+
+    fn clear_unpinned_latencies(&mut self, working_latencies: &mut [LatencyNode]) {
+        for node in self.touched.drain(..) {
+            let l = &mut working_latencies[node];
+            if !l.pinned {
+                l.abs_lat = i64::MIN;
+            }
         }
     }
 }
@@ -161,114 +282,91 @@ fn clear_unpinned_latencies(working_latencies: &mut [LatencyNode]) {
 /// Then backward pass, moving nodes forward in latency as much as possible.
 /// Only moving forward is possible, and only when not confliciting with a later node
 ///
-/// Keep reusing the same stack to reduce memory allocations
+/// Explores all nodes reachable from the start nodes in topological order (See [LatencyCountingScratch]).
+/// Pinned nodes are never changed, and are not explored further.
 ///
 /// Requires working_latencies[start_node].is_pinned() == true
-///
-/// Leaves working_latencies[start_node].is_pinned() == true
-fn count_latency<'d, const BACKWARDS: bool>(
+fn count_latency<const BACKWARDS: bool>(
     working_latencies: &mut [LatencyNode],
-    fanouts: &'d ListOfLists<FanInOut>,
-    start_node: usize,
-    stack: &mut Vec<LatencyStackElem<'d>>,
+    fanouts: &ListOfLists<FanInOut>,
+    start_nodes: impl IntoIterator<Item = usize>,
+    scratch: &mut LatencyCountingScratch,
 ) -> Result<(), LatencyCountingError> {
-    working_latencies[start_node].assert_is_set_and_pinned();
+    assert!(scratch.queue.is_empty());
 
-    assert!(stack.is_empty());
+    for start_node in start_nodes {
+        working_latencies[start_node].assert_is_set_and_pinned();
+        scratch.parent[start_node] = NO_PARENT;
+        scratch.enqueue::<BACKWARDS>(start_node);
+    }
 
-    stack.push(LatencyStackElem {
-        node_idx: start_node,
-        remaining_fanout: fanouts[start_node].iter(),
-    });
+    while let Some(Reverse((_order, node))) = scratch.queue.pop() {
+        scratch.in_queue[node] = false;
+        let from = working_latencies[node];
 
-    while let Some(top) = stack.last_mut() {
-        if let Some(&FanInOut {
+        for &FanInOut {
             other: to_node,
             delta_latency,
-        }) = top.remaining_fanout.next()
+        } in &fanouts[node]
         {
-            working_latencies[top.node_idx].assert_is_set();
-
-            match working_latencies[to_node]
-                .update_and_pin::<BACKWARDS>(working_latencies[top.node_idx], delta_latency)
-            {
-                LatencyNodeUpdate::NoChange => {} // Nothing
-                LatencyNodeUpdate::Updated => {
-                    stack.push(LatencyStackElem {
-                        node_idx: to_node,
-                        remaining_fanout: fanouts[to_node].iter(),
-                    });
-                }
-                LatencyNodeUpdate::ErrorPinnedConflict { new_latency } => {
-                    // Decide if this is a net positive latency cycle or a conflicting specified latencies error
-                    if let Some(conflict_begin) =
-                        stack.iter().position(|elem| elem.node_idx == to_node)
-                    {
-                        let mut conflict_path: Vec<SpecifiedLatency> = stack[conflict_begin..]
-                            .iter()
-                            .map(|elem| SpecifiedLatency {
-                                wire: elem.node_idx,
-                                latency: working_latencies[elem.node_idx].get(),
-                            })
-                            .collect();
-                        if BACKWARDS {
-                            conflict_path.reverse();
-                        }
-                        return Err(LatencyCountingError::NetPositiveLatencyCycle {
-                            conflict_path,
-                            net_roundtrip_latency: new_latency
-                                - working_latencies[start_node].get(),
-                        });
-                    } else {
-                        assert!(!BACKWARDS, "This should not appear in backwards exploration, because port conflicts should have been found in the forward pass already");
-
-                        let conflict_path = stack
-                            .iter()
-                            .map(|elem| SpecifiedLatency {
-                                wire: elem.node_idx,
-                                latency: working_latencies[elem.node_idx].get(),
-                            })
-                            .chain(std::iter::once(SpecifiedLatency {
-                                wire: to_node,
-                                latency: new_latency,
-                            }))
-                            .collect();
-                        return Err(LatencyCountingError::ConflictingSpecifiedLatencies {
-                            conflict_path,
-                        });
-                    };
-                }
+            let Some(new_latency) =
+                working_latencies[to_node].proposed_update::<BACKWARDS>(from, delta_latency)
+            else {
+                continue;
+            };
+
+            if scratch.is_ancestor(to_node, node) {
+                scratch.queue.clear();
+                scratch.in_queue.fill(false);
+
+                let mut conflict_path: Vec<SpecifiedLatency> = scratch
+                    .path_to(node, to_node)
+                    .into_iter()
+                    .map(|wire| SpecifiedLatency {
+                        wire,
+                        latency: working_latencies[wire].get(),
+                    })
+                    .collect();
+                let start_latency = working_latencies[to_node].get();
+                let net_roundtrip_latency = if BACKWARDS {
+                    conflict_path.reverse();
+                    start_latency - new_latency
+                } else {
+                    new_latency - start_latency
+                };
+                return Err(LatencyCountingError::NetPositiveLatencyCycle {
+                    conflict_path,
+                    net_roundtrip_latency,
+                });
             }
-        } else {
-            working_latencies[top.node_idx].unpin();
-            stack.pop();
-        }
-    }
-
-    // Repin start node, because we unpinned it when unwinding the stack
-    working_latencies[start_node].pin();
 
-    Ok(())
-}
-
-fn count_latency_all_in_list<'d, const BACKWARDS: bool>(
-    working_latencies: &mut [LatencyNode],
-    fanouts: &'d ListOfLists<FanInOut>,
-    nodes: &[SpecifiedLatency],
-    stack: &mut Vec<LatencyStackElem<'d>>,
-) -> Result<(), LatencyCountingError> {
-    for start_node in nodes {
-        working_latencies[start_node.wire].assert_is_set_and_pinned();
-    }
-
-    for start_node in nodes {
-        working_latencies[start_node.wire].assert_is_set_and_pinned();
-        count_latency::<BACKWARDS>(working_latencies, fanouts, start_node.wire, stack)?;
-        working_latencies[start_node.wire].assert_is_set_and_pinned();
-    }
+            if working_latencies[to_node].is_pinned() {
+                assert!(!BACKWARDS, "This should not appear in backwards exploration, because port conflicts should have been found in the forward pass already");
+                scratch.queue.clear();
+                scratch.in_queue.fill(false);
+
+                let conflict_path = scratch
+                    .path_to(node, NO_PARENT)
+                    .into_iter()
+                    .map(|wire| SpecifiedLatency {
+                        wire,
+                        latency: working_latencies[wire].get(),
+                    })
+                    .chain(std::iter::once(SpecifiedLatency {
+                        wire: to_node,
+                        latency: new_latency,
+                    }))
+                    .collect();
+                return Err(LatencyCountingError::ConflictingSpecifiedLatencies { conflict_path });
+            }
 
-    for start_node in nodes {
-        working_latencies[start_node.wire].assert_is_set_and_pinned();
+            if !working_latencies[to_node].is_set() {
+                scratch.touched.push(to_node);
+            }
+            working_latencies[to_node].abs_lat = new_latency;
+            scratch.parent[to_node] = node;
+            scratch.enqueue::<BACKWARDS>(to_node);
+        }
     }
 
     Ok(())
@@ -316,14 +414,108 @@ fn pop_a_port(ports: &mut Vec<PortLatencyCandidate>) -> Option<PortLatencyCandid
     Some(ports.swap_remove(found_idx))
 }
 
-/// All elements in latencies must initially be [LatencyNode::UNSET] or pinned known values
+/// Solves the latencies of all wires, returning only the first error. See [solve_latencies_per_component]
 pub fn solve_latencies(
     fanins: &ListOfLists<FanInOut>,
     fanouts: &ListOfLists<FanInOut>,
     inputs: &[usize],
     outputs: &[usize],
-    mut specified_latencies: Vec<SpecifiedLatency>,
+    specified_latencies: Vec<SpecifiedLatency>,
 ) -> Result<Vec<i64>, LatencyCountingError> {
+    solve_latencies_per_component(fanins, fanouts, inputs, outputs, specified_latencies)
+        .map_err(|mut errors| errors.swap_remove(0))
+}
+
+/// Components at least this big are worth solving on a separate thread
+const PARALLEL_COMPONENT_SIZE: usize = 1024;
+
+/// Latencies never propagate between the weakly connected components of the graph, so these can be solved separately.
+///
+/// Returns the nodes of each component in increasing order
+fn connected_components(
+    fanins: &ListOfLists<FanInOut>,
+    fanouts: &ListOfLists<FanInOut>,
+) -> Vec<Vec<usize>> {
+    let mut visited = vec![false; fanins.len()];
+    let mut components = Vec::new();
+    let mut to_visit = Vec::new();
+    for root in 0..fanins.len() {
+        if visited[root] {
+            continue;
+        }
+        visited[root] = true;
+        to_visit.push(root);
+        let mut nodes = Vec::new();
+        while let Some(node) = to_visit.pop() {
+            nodes.push(node);
+            for &FanInOut { other, .. } in fanins[node].iter().chain(fanouts[node].iter()) {
+                if !visited[other] {
+                    visited[other] = true;
+                    to_visit.push(other);
+                }
+            }
+        }
+        nodes.sort_unstable();
+        components.push(nodes);
+    }
+    components
+}
+
+/// The part of a latency counting problem that lies within one connected component, with node indices local to that component
+struct ComponentProblem {
+    nodes: Vec<usize>,
+    inputs: Vec<usize>,
+    outputs: Vec<usize>,
+    specified_latencies: Vec<SpecifiedLatency>,
+}
+
+impl LatencyCountingError {
+    fn map_wires(self, f: impl Fn(usize) -> usize) -> Self {
+        let map_path = |path: Vec<SpecifiedLatency>| -> Vec<SpecifiedLatency> {
+            path.into_iter()
+                .map(|SpecifiedLatency { wire, latency }| SpecifiedLatency {
+                    wire: f(wire),
+                    latency,
+                })
+                .collect()
+        };
+        match self {
+            LatencyCountingError::ConflictingSpecifiedLatencies { conflict_path } => {
+                LatencyCountingError::ConflictingSpecifiedLatencies {
+                    conflict_path: map_path(conflict_path),
+                }
+            }
+            LatencyCountingError::NetPositiveLatencyCycle {
+                conflict_path,
+                net_roundtrip_latency,
+            } => LatencyCountingError::NetPositiveLatencyCycle {
+                conflict_path: map_path(conflict_path),
+                net_roundtrip_latency,
+            },
+            LatencyCountingError::IndeterminablePortLatency { bad_ports } => {
+                LatencyCountingError::IndeterminablePortLatency {
+                    bad_ports: bad_ports
+                        .into_iter()
+                        .map(|(wire, a, b)| (f(wire), a, b))
+                        .collect(),
+                }
+            }
+        }
+    }
+}
+
+/// All elements in latencies must initially be [LatencyNode::UNSET] or pinned known values
+///
+/// Every connected component of the graph is solved on its own, such that errors in one component don't hide those in others.
+/// Components without any specified latency have no reference point, and so are left at [i64::MIN].
+/// If no latencies are specified at all, one of the ports is picked as the reference.
+pub fn solve_latencies_per_component(
+    fanins: &ListOfLists<FanInOut>,
+    fanouts: &ListOfLists<FanInOut>,
+    inputs: &[usize],
+    outputs: &[usize],
+    mut specified_latencies: Vec<SpecifiedLatency>,
+) -> Result<Vec<i64>, Vec<LatencyCountingError>> {
     if config().debug_print_latency_graph {
         print_latency_test_case(fanins, inputs, outputs, &specified_latencies);
     }
@@ -332,22 +524,129 @@ pub fn solve_latencies(
         return Ok(Vec::new());
     }
 
-    // The current set of latencies
-    let mut working_latencies = vec![LatencyNode::UNSET; fanins.len()];
-    // This stack is reused by [count_latency] calls
-    let mut stack = Vec::new();
-    // This list contains all ports that still need to be placed. This list gathers port assignments as they happen,
-    // and reports errors if port conflicts arise
-    let mut ports_to_place = Vec::with_capacity(inputs.len() + outputs.len());
-
     // If no latencies are given, we have to initialize an arbitrary one ourselves. Prefer input ports over output ports over regular wires
     if specified_latencies.is_empty() {
         let wire = *inputs.first().unwrap_or(outputs.first().unwrap_or(&0));
         specified_latencies.push(SpecifiedLatency { wire, latency: 0 });
     }
 
-    // Set up the specified latencies
+    let components = connected_components(fanins, fanouts);
+    if components.len() == 1 {
+        return solve_component(fanins, fanouts, inputs, outputs, &specified_latencies)
+            .map_err(|err| vec![err]);
+    }
+
+    let mut component_of = vec![0; fanins.len()];
+    let mut local_idx = vec![0; fanins.len()];
+    for (component_id, nodes) in components.iter().enumerate() {
+        for (local, node) in nodes.iter().enumerate() {
+            component_of[*node] = component_id;
+            local_idx[*node] = local;
+        }
+    }
+
+    let mut problems: Vec<ComponentProblem> = components
+        .into_iter()
+        .map(|nodes| ComponentProblem {
+            nodes,
+            inputs: Vec::new(),
+            outputs: Vec::new(),
+            specified_latencies: Vec::new(),
+        })
+        .collect();
+    for i in inputs {
+        problems[component_of[*i]].inputs.push(local_idx[*i]);
+    }
+    for o in outputs {
+        problems[component_of[*o]].outputs.push(local_idx[*o]);
+    }
     for spec_lat in &specified_latencies {
+        problems[component_of[spec_lat.wire]]
+            .specified_latencies
+            .push(SpecifiedLatency {
+                wire: local_idx[spec_lat.wire],
+                latency: spec_lat.latency,
+            });
+    }
+    problems.retain(|problem| !problem.specified_latencies.is_empty());
+
+    let num_large_components = problems
+        .iter()
+        .filter(|problem| problem.nodes.len() >= PARALLEL_COMPONENT_SIZE)
+        .count();
+    let jobs = if num_large_components >= 2 {
+        config().jobs
+    } else {
+        1
+    };
+
+    let results = parallel_map(jobs, problems, |problem| {
+        let to_local = |nodes: &ListOfLists<FanInOut>| -> ListOfLists<FanInOut> {
+            problem
+                .nodes
+                .iter()
+                .map(|node| {
+                    nodes[*node].iter().map(
+                        |&FanInOut {
+                             other,
+                             delta_latency,
+                         }| FanInOut {
+                            other: local_idx[other],
+                            delta_latency,
+                        },
+                    )
+                })
+                .collect()
+        };
+        let result = solve_component(
+            &to_local(fanins),
+            &to_local(fanouts),
+            &problem.inputs,
+            &problem.outputs,
+            &problem.specified_latencies,
+        );
+        (problem.nodes, result)
+    });
+
+    let mut latencies = vec![i64::MIN; fanins.len()];
+    let mut errors = Vec::new();
+    for (nodes, result) in results {
+        match result {
+            Ok(component_latencies) => {
+                for (node, latency) in std::iter::zip(nodes, component_latencies) {
+                    latencies[node] = latency;
+                }
+            }
+            Err(err) => errors.push(err.map_wires(|local| nodes[local])),
+        }
+    }
+    if errors.is_empty() {
+        Ok(latencies)
+    } else {
+        Err(errors)
+    }
+}
+
+/// Solves a graph in which every node is reachable from the specified latencies, ignoring edge directions
+fn solve_component(
+    fanins: &ListOfLists<FanInOut>,
+    fanouts: &ListOfLists<FanInOut>,
+    inputs: &[usize],
+    outputs: &[usize],
+    specified_latencies: &[SpecifiedLatency],
+) -> Result<Vec<i64>, LatencyCountingError> {
+    assert!(!specified_latencies.is_empty());
+
+    // The current set of latencies
+    let mut working_latencies = vec![LatencyNode::UNSET; fanins.len()];
+    // Shared by all [count_latency] calls. Fanins and fanouts have the same strongly connected components
+    let mut scratch = LatencyCountingScratch::new(fanouts);
+    // This list contains all ports that still need to be placed. This list gathers port assignments as they happen,
+    // and reports errors if port conflicts arise
+    let mut ports_to_place = Vec::with_capacity(inputs.len() + outputs.len());
+
+    // Set up the specified latencies
+    for spec_lat in specified_latencies {
         working_latencies[spec_lat.wire] = LatencyNode::new_pinned(spec_lat.latency);
     }
 
@@ -370,27 +669,30 @@ pub fn solve_latencies(
         }
     }
 
+    let specified_wires = || specified_latencies.iter().map(|spec| spec.wire);
+
     // First forward run from the initial latency assignment to discover other ports
-    count_latency_all_in_list::<false>(
+    count_latency::<false>(
         &mut working_latencies,
         fanouts,
-        &specified_latencies,
-        &mut stack,
+        specified_wires(),
+        &mut scratch,
     )?;
     inform_all_ports(&mut ports_to_place, &working_latencies)?;
-    clear_unpinned_latencies(&mut working_latencies);
+    scratch.clear_unpinned_latencies(&mut working_latencies);
 
     // Then backward run
-    count_latency_all_in_list::<true>(
+    count_latency::<true>(
         &mut working_latencies,
         fanins,
-        &specified_latencies,
-        &mut stack,
+        specified_wires(),
+        &mut scratch,
     )?;
     inform_all_ports(&mut ports_to_place, &working_latencies)?;
-    clear_unpinned_latencies(&mut working_latencies);
+    scratch.clear_unpinned_latencies(&mut working_latencies);
 
     // Finally, we start specifying each unspecified port in turn, and checking for any conflicts with other ports
+    // Only the part of the graph reached from the port has to be cleared again afterwards
     while let Some(chosen_port) = pop_a_port(&mut ports_to_place) {
         working_latencies[chosen_port.wire] = LatencyNode::new_pinned(chosen_port.latency_proposal);
 
@@ -398,25 +700,37 @@ pub fn solve_latencies(
             count_latency::<false>(
                 &mut working_latencies,
                 fanouts,
-                chosen_port.wire,
-                &mut stack,
+                [chosen_port.wire],
+                &mut scratch,
             )?;
         } else {
-            count_latency::<true>(&mut working_latencies, fanins, chosen_port.wire, &mut stack)?;
+            count_latency::<true>(
+                &mut working_latencies,
+                fanins,
+                [chosen_port.wire],
+                &mut scratch,
+            )?;
         }
         inform_all_ports(&mut ports_to_place, &working_latencies)?;
-        clear_unpinned_latencies(&mut working_latencies);
+        scratch.clear_unpinned_latencies(&mut working_latencies);
     }
     // It may be that some ports are leftover after this while loop. That just means they weren't connected to a port we have seen.
-    // TODO multi-cluster ports
+    // TODO multi-cluster ports within one connected component
+
+    let pinned_wires = |working_latencies: &[LatencyNode]| -> Vec<usize> {
+        (0..working_latencies.len())
+            .filter(|idx| working_latencies[*idx].is_pinned())
+            .collect()
+    };
 
     // Now that we have all the ports, we can fill in the internal latencies
-    for idx in 0..working_latencies.len() {
-        if working_latencies[idx].is_pinned() {
-            // it's a defined latency!
-            count_latency::<false>(&mut working_latencies, fanouts, idx, &mut stack)?;
-        }
-    }
+    let defined_latencies = pinned_wires(&working_latencies);
+    count_latency::<false>(
+        &mut working_latencies,
+        fanouts,
+        defined_latencies,
+        &mut scratch,
+    )?;
 
     // First pin all these latencies
     for latency in working_latencies.iter_mut() {
@@ -430,11 +744,13 @@ pub fn solve_latencies(
     }
 
     // Finally we add in the backwards latencies. TODO maybe be more conservative here?
-    for idx in 0..working_latencies.len() {
-        if working_latencies[idx].is_pinned() {
-            count_latency::<true>(&mut working_latencies, fanins, idx, &mut stack)?;
-        }
-    }
+    let defined_latencies = pinned_wires(&working_latencies);
+    count_latency::<true>(
+        &mut working_latencies,
+        fanins,
+        defined_latencies,
+        &mut scratch,
+    )?;
 
     Ok(working_latencies
         .into_iter()
@@ -942,6 +1258,53 @@ mod tests {
         assert_eq!(net_roundtrip_latency, 1);
     }
 
+    #[test]
+    fn check_errors_reported_per_component() {
+        let fanins: [&[FanInOut]; 10] = [
+            /*0*/ &[],
+            /*1*/ &[mk_fan(0, 0), mk_fan(4, -4)],
+            /*2*/ &[mk_fan(1, 3)],
+            /*3*/ &[mk_fan(2, 0)],
+            /*4*/ &[mk_fan(2, 2)],
+            /*5*/ &[],
+            /*6*/ &[mk_fan(5, 0), mk_fan(9, -4)],
+            /*7*/ &[mk_fan(6, 3)],
+            /*8*/ &[mk_fan(7, 0)],
+            /*9*/ &[mk_fan(7, 2)],
+        ];
+        let fanins = ListOfLists::from_slice_slice(&fanins);
+        let fanouts = convert_fanin_to_fanout(&fanins);
+
+        let specified_latencies = vec![
+            SpecifiedLatency {
+                wire: 0,
+                latency: 0,
+            },
+            SpecifiedLatency {
+                wire: 5,
+                latency: 0,
+            },
+        ];
+        let errors =
+            solve_latencies_per_component(&fanins, &fanouts, &[0, 5], &[3, 8], specified_latencies)
+                .unwrap_err();
+
+        assert_eq!(errors.len(), 2);
+        for (err, component_nodes) in std::iter::zip(errors, [0..5, 5..10]) {
+            let LatencyCountingError::NetPositiveLatencyCycle {
+                conflict_path,
+                net_roundtrip_latency,
+            } = err
+            else {
+                unreachable!()
+            };
+            assert_eq!(net_roundtrip_latency, 1);
+            assert!(conflict_path
+                .iter()
+                .all(|elem| component_nodes.contains(&elem.wire)));
+        }
+    }
+
     #[test]
     fn input_used_further() {
         let fanins: [&[FanInOut]; 4] = [
@@ -3,9 +3,10 @@ use std::{cmp::max, iter::zip};
 use crate::prelude::*;
 
 use crate::{
+    alloc::{ScratchArena, ScratchTable},
     flattening::{Instruction, WriteModifiers},
     instantiation::latency_algorithm::{
-        convert_fanin_to_fanout, solve_latencies, FanInOut, LatencyCountingError,
+        convert_fanin_to_fanout, solve_latencies_per_component, FanInOut, LatencyCountingError,
     },
 };
 
@@ -82,15 +83,18 @@ fn filter_unique_write_flats<'w>(
     result
 }
 
-struct WireToLatencyMap {
-    map_wire_to_latency_node: FlatAlloc<usize, WireIDMarker>,
-    domain_infos: FlatAlloc<LatencyDomainInfo, DomainIDMarker>,
+/// Its tables only live during [InstantiationContext::compute_latencies], so they are taken from a [ScratchArena]
+struct WireToLatencyMap<'s> {
+    map_wire_to_latency_node: ScratchTable<'s, usize, WireIDMarker>,
+    domain_infos: FlatAlloc<LatencyDomainInfo<'s>, DomainIDMarker>,
     /// Wires that are ports point to the next port in the chain, to form a complete cycle. This binds all the ports togehter
-    next_port_chain: FlatAlloc<Option<(WireID, i64)>, WireIDMarker>,
+    next_port_chain: ScratchTable<'s, Option<(WireID, i64)>, WireIDMarker>,
 }
 
-struct LatencyDomainInfo {
-    latency_node_meanings: Vec<WireID>,
+struct LatencyDomainInfo<'s> {
+    latency_node_meanings: &'s mut [WireID],
+    /// Number of [Self::latency_node_meanings] assigned so far
+    num_latency_nodes: usize,
     initial_values: Vec<SpecifiedLatency>,
     input_ports: Vec<usize>,
     output_ports: Vec<usize>,
@@ -128,61 +132,60 @@ impl RealWireDataSource {
     }
 }
 
-impl InstantiatedModule {
-    /// Is used to add implicit registers to wires that are used longer than one cycle.
-    ///
-    /// If needed only the same cycle it is generated, then this is equal to [RealWire::absolute_latency].
-    pub fn compute_needed_untils(&self) -> FlatAlloc<i64, WireIDMarker> {
-        let mut result = self.wires.map(|(_id, w)| w.absolute_latency);
-
-        for (_id, w) in &self.wires {
-            w.source.iter_sources_with_min_latency(|other, _| {
-                let nu = &mut result[other];
-
-                *nu = max(*nu, w.absolute_latency);
-            });
-        }
-
-        result
+/// Until which cycle each wire is used. Is used to add implicit registers to wires that are used longer than one cycle.
+///
+/// If needed only the same cycle it is generated, then this is equal to its latency in `wire_latencies`.
+pub fn compute_needed_untils(
+    wire_sources: &FlatAlloc<RealWireDataSource, WireIDMarker>,
+    wire_latencies: &FlatAlloc<i64, WireIDMarker>,
+) -> FlatAlloc<i64, WireIDMarker> {
+    let mut result = wire_latencies.clone();
+
+    for (id, source) in wire_sources {
+        let absolute_latency = wire_latencies[id];
+        source.iter_sources_with_min_latency(|other, _| {
+            let nu = &mut result[other];
+
+            *nu = max(*nu, absolute_latency);
+        });
     }
+
+    result
 }
 
 impl InstantiationContext<'_, '_> {
-    fn make_wire_to_latency_map(&self) -> WireToLatencyMap {
-        const PLACEHOLDER: usize = usize::MAX;
-
-        let mut map_wire_to_latency_node: FlatAlloc<usize, WireIDMarker> =
-            self.wires.map(|_| PLACEHOLDER);
-
-        let mut domain_infos: FlatAlloc<LatencyDomainInfo, DomainIDMarker> =
-            self.md.domains.id_range().map(|domain| {
-                let mut latency_node_meanings = Vec::with_capacity(self.wires.len());
-                let mut initial_values = Vec::new();
-
-                for (w_id, w) in &self.wires {
-                    if w.domain == domain {
-                        let new_idx = latency_node_meanings.len();
-                        latency_node_meanings.push(w_id);
-                        debug_assert!(map_wire_to_latency_node[w_id] == PLACEHOLDER);
-                        map_wire_to_latency_node[w_id] = new_idx;
-
-                        if w.specified_latency != CALCULATE_LATENCY_LATER {
-                            initial_values.push(SpecifiedLatency {
-                                wire: new_idx,
-                                latency: w.specified_latency,
-                            });
-                        }
-                    }
-                }
-
-                LatencyDomainInfo {
-                    latency_node_meanings,
-                    initial_values,
-                    input_ports: Vec::new(),
-                    output_ports: Vec::new(),
-                }
+    fn make_wire_to_latency_map<'s>(&self, scratch: &'s ScratchArena) -> WireToLatencyMap<'s> {
+        // Counted first, such that every domain gets exactly the space it needs, rather than room for all wires
+        let mut num_wires_per_domain: FlatAlloc<usize, DomainIDMarker> = self.md.domains.map(|_| 0);
+        for (_id, w) in &self.wires {
+            num_wires_per_domain[w.domain] += 1;
+        }
+        let mut domain_infos: FlatAlloc<LatencyDomainInfo, DomainIDMarker> = num_wires_per_domain
+            .map(|(_domain, num_wires)| LatencyDomainInfo {
+                latency_node_meanings: scratch.alloc_slice(*num_wires, WireID::PLACEHOLDER),
+                num_latency_nodes: 0,
+                initial_values: Vec::new(),
+                input_ports: Vec::new(),
+                output_ports: Vec::new(),
             });
 
+        // A single pass over the wires, assigning each wire the next latency node of its domain
+        let mut map_wire_to_latency_node = scratch.alloc_table(self.wires.len(), 0);
+        for (w_id, w) in &self.wires {
+            let domain_info = &mut domain_infos[w.domain];
+            let new_idx = domain_info.num_latency_nodes;
+            domain_info.latency_node_meanings[new_idx] = w_id;
+            domain_info.num_latency_nodes += 1;
+
+            if w.specified_latency != CALCULATE_LATENCY_LATER {
+                domain_info.initial_values.push(SpecifiedLatency {
+                    wire: new_idx,
+                    latency: w.specified_latency,
+                });
+            }
+            map_wire_to_latency_node[w_id] = new_idx;
+        }
+
         for (_id, p) in self.interface_ports.iter_valids() {
             let domain_to_edit = &mut domain_infos[p.domain];
             let latency_node = map_wire_to_latency_node[p.wire];
@@ -194,8 +197,7 @@ impl InstantiationContext<'_, '_> {
             .push(latency_node);
         }
 
-        let mut next_port_chain: FlatAlloc<Option<(WireID, i64)>, WireIDMarker> =
-            self.wires.map(|_| None);
+        let mut next_port_chain = scratch.alloc_table(self.wires.len(), None);
 
         for (_sm_id, sm) in &self.submodules {
             // Instances may not be valid (or may not exist yet due to inference)
@@ -243,11 +245,6 @@ impl InstantiationContext<'_, '_> {
             }
         }
 
-        // Every wire has been covered
-        debug_assert!(map_wire_to_latency_node
-            .iter()
-            .all(|(_id, v)| *v != PLACEHOLDER));
-
         WireToLatencyMap {
             map_wire_to_latency_node,
             domain_infos,
@@ -268,15 +265,13 @@ impl InstantiationContext<'_, '_> {
         for wire_id in latency_node_to_wire_map {
             fanins.new_group();
 
-            self.wires[*wire_id]
-                .source
-                .iter_sources_with_min_latency(|from, delta_latency| {
-                    assert_eq!(self.wires[from].domain, domain_id);
-                    fanins.push_to_last_group(FanInOut {
-                        other: latency_node_mapper.map_wire_to_latency_node[from],
-                        delta_latency,
-                    });
+            self.wire_sources[*wire_id].iter_sources_with_min_latency(|from, delta_latency| {
+                assert_eq!(self.wires[from].domain, domain_id);
+                fanins.push_to_last_group(FanInOut {
+                    other: latency_node_mapper.map_wire_to_latency_node[from],
+                    delta_latency,
                 });
+            });
 
             if let Some((from, delta_latency)) = latency_node_mapper.next_port_chain[*wire_id] {
                 fanins.push_to_last_group(FanInOut {
@@ -291,19 +286,20 @@ impl InstantiationContext<'_, '_> {
 
     // Returns a proper interface if all ports involved did not produce an error. If a port did produce an error then returns None.
     // Computes all latencies involved
-    pub fn compute_latencies(&mut self) {
+    pub fn compute_latencies(&mut self, scratch: &ScratchArena) {
         let mut any_invalid_port = false;
         for (port_id, p) in self.interface_ports.iter_valids() {
             if !p.is_input {
-                let port_wire = &self.wires[p.wire];
                 let RealWireDataSource::Multiplexer {
                     is_state: _,
                     sources,
-                } = &port_wire.source
+                } = &self.wire_sources[p.wire]
                 else {
                     unreachable!()
                 };
-                if sources.is_empty() && port_wire.specified_latency == CALCULATE_LATENCY_LATER {
+                if sources.is_empty()
+                    && self.wires[p.wire].specified_latency == CALCULATE_LATENCY_LATER
+                {
                     any_invalid_port = true;
                     let port = &self.md.ports[port_id];
                     self.errors.error(port.name_span, format!("Pre-emptive error because latency-unspecified '{}' is never written to. \n(This is because work-in-progress code would get a lot of latency counting errors while unfinished)", port.name));
@@ -314,7 +310,7 @@ impl InstantiationContext<'_, '_> {
             return;
         } // Early exit so we don't flood WIP modules with "Node not reached by Latency Counting" errors
 
-        let latency_node_mapper = self.make_wire_to_latency_map();
+        let latency_node_mapper = self.make_wire_to_latency_map(scratch);
 
         for (domain_id, domain_info) in &latency_node_mapper.domain_infos {
             let fanins = self.make_fanins(
@@ -326,7 +322,7 @@ impl InstantiationContext<'_, '_> {
             // Process fanouts
             let fanouts = convert_fanin_to_fanout(&fanins);
 
-            match solve_latencies(
+            match solve_latencies_per_component(
                 &fanins,
                 &fanouts,
                 &domain_info.input_ports,
@@ -337,11 +333,11 @@ impl InstantiationContext<'_, '_> {
                     for (node, lat) in
                         zip(domain_info.latency_node_meanings.iter(), latencies.iter())
                     {
-                        let wire = &mut self.wires[*node];
-                        wire.absolute_latency = *lat;
+                        self.wire_latencies[*node] = *lat;
                         if *lat == CALCULATE_LATENCY_LATER {
-                            let source_location =
-                                self.md.get_instruction_span(wire.original_instruction);
+                            let source_location = self
+                                .md
+                                .get_instruction_span(self.wires[*node].original_instruction);
                             self.errors.error(
                                 source_location,
                                 "Latency Counting couldn't reach this node".to_string(),
@@ -349,15 +345,17 @@ impl InstantiationContext<'_, '_> {
                         }
                     }
                 }
-                Err(err) => {
-                    self.report_error(&domain_info.latency_node_meanings, err);
+                Err(errors) => {
+                    for err in errors {
+                        self.report_error(&domain_info.latency_node_meanings, err);
+                    }
                 }
             };
         }
 
         // Finally update interface absolute latencies
         for (_id, port) in self.interface_ports.iter_valids_mut() {
-            port.absolute_latency = self.wires[port.wire].absolute_latency;
+            port.absolute_latency = self.wire_latencies[port.wire];
         }
     }
 
@@ -376,7 +374,7 @@ impl InstantiationContext<'_, '_> {
             let RealWireDataSource::Multiplexer {
                 is_state: _,
                 sources,
-            } = &to_wire.source
+            } = &self.wire_sources[to_wire_id]
             else {
                 continue;
             }; // We can only name multiplexers
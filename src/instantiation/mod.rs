@@ -1,20 +1,26 @@
 mod concrete_typecheck;
 mod execute;
-mod latency_algorithm;
+mod instance_slot;
+pub mod latency_algorithm;
 mod latency_count;
-mod list_of_lists;
+pub mod list_of_lists;
 mod unique_names;
 
+use instance_slot::{Claim, InstanceSlot};
 use unique_names::UniqueNames;
 
+use crate::alloc::ScratchArena;
 use crate::prelude::*;
+use crate::typing::interner::Interned;
 use crate::typing::template::TVec;
 use crate::typing::type_inference::{ConcreteTypeVariableIDMarker, TypeSubstitutor};
 
-use std::cell::OnceCell;
-use std::{cell::RefCell, collections::HashMap, rc::Rc};
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex, OnceLock};
 
 use crate::flattening::{BinaryOperator, Module, UnaryOperator};
+use crate::profiling::PhaseTimer;
 use crate::{
     config,
     errors::{CompileError, ErrorStore},
@@ -54,7 +60,7 @@ impl RealWirePathElem {
 /// See [RealWireDataSource::Multiplexer]
 #[derive(Debug)]
 pub struct MultiplexerSource {
-    pub to_path: Vec<RealWirePathElem>,
+    pub to_path: Box<[RealWirePathElem]>,
     pub num_regs: i64,
     pub from: WireID,
     pub condition: Box<[ConditionStackElem]>,
@@ -82,7 +88,7 @@ pub enum RealWireDataSource {
     },
     Select {
         root: WireID,
-        path: Vec<RealWirePathElem>,
+        path: Box<[RealWirePathElem]>,
     },
     Constant {
         value: Value,
@@ -93,19 +99,17 @@ pub enum RealWireDataSource {
 ///
 /// It can have a latency count and domain. All wires have a name, either the name they were given by the user, or a generated name like _1, _13
 ///
+/// Its source, type and latency are kept in tables of their own, see [InstantiatedModule::wire_sources]
+///
 /// Generated from a [crate::flattening::Expression] instruction
 #[derive(Debug)]
 pub struct RealWire {
-    pub source: RealWireDataSource,
     /// If it's a port of a module, then this must be the submodule
     pub original_instruction: FlatID,
-    pub typ: ConcreteType,
     pub name: String,
     pub domain: DomainID,
     /// non i64::MIN values specify specified latency
     pub specified_latency: i64,
-    /// The computed latencies after latency counting
-    pub absolute_latency: i64,
 }
 
 /// See [SubModule]
@@ -127,12 +131,23 @@ pub struct SubModulePort {
 #[derive(Debug)]
 pub struct SubModule {
     pub original_instruction: FlatID,
-    pub instance: OnceCell<Rc<InstantiatedModule>>,
+    pub instance: OnceLock<Arc<InstantiatedModule>>,
     pub port_map: FlatAlloc<Option<SubModulePort>, PortIDMarker>,
     pub interface_call_sites: FlatAlloc<Vec<Span>, InterfaceIDMarker>,
     pub name: String,
     pub module_uuid: ModuleUUID,
-    pub template_args: TVec<ConcreteType>,
+    /// Inferred during concrete typechecking. Moved into [Self::interned_template_args] once fully known
+    template_args: TVec<ConcreteType>,
+    /// From [Linker::template_args_interner]. Keys the [InstantiationCache] lookup of [Self::instance]
+    pub interned_template_args: Option<Interned<TVec<ConcreteType>>>,
+}
+
+impl SubModule {
+    pub fn template_args(&self) -> &TVec<ConcreteType> {
+        self.interned_template_args
+            .as_deref()
+            .unwrap_or(&self.template_args)
+    }
 }
 
 /// Generated from [Module::ports]
@@ -161,11 +176,30 @@ pub struct InstantiatedModule {
     /// This matches the ports in [Module::ports]. Ports are not `None` when they are not part of this instantiation.
     pub interface_ports: FlatAlloc<Option<InstantiatedPort>, PortIDMarker>,
     pub wires: FlatAlloc<RealWire, WireIDMarker>,
+    /// This and the other `wire_` tables run parallel to [Self::wires].
+    /// Latency counting, typechecking and code generation each loop over all wires, and only read the tables they need
+    pub wire_sources: FlatAlloc<RealWireDataSource, WireIDMarker>,
+    pub wire_types: FlatAlloc<ConcreteType, WireIDMarker>,
+    /// The computed latencies after latency counting
+    pub wire_latencies: FlatAlloc<i64, WireIDMarker>,
+    /// See [latency_count::compute_needed_untils]
+    pub wire_needed_untils: FlatAlloc<i64, WireIDMarker>,
     pub submodules: FlatAlloc<SubModule, SubModuleIDMarker>,
     /// See [GenerationState]
     pub generation_state: FlatAlloc<SubModuleOrWire, FlatIDMarker>,
 }
 
+impl InstantiatedModule {
+    fn print_wires(&self) {
+        for (id, w) in &self.wires {
+            println!(
+                "{id:?} -> {w:?} {:?} = {:?}",
+                self.wire_types[id], self.wire_sources[id]
+            );
+        }
+    }
+}
+
 /// See [GenerationState]
 #[derive(Debug, Clone)]
 pub enum SubModuleOrWire {
@@ -200,6 +234,17 @@ impl SubModuleOrWire {
     }
 }
 
+/// Why [InstantiationCache::instantiate] didn't return an instance
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum InstantiateError {
+    /// The instance has errors, which are reported on the module itself
+    Errored,
+    /// The instance (transitively) instantiates itself with the same template arguments
+    Recursive,
+    /// See [Linker::instantiate_roots]. Nothing was cached, the instance is built again when it is next requested
+    Cancelled,
+}
+
 /// Stored per module [Module].
 /// With this you can instantiate a module for different sets of template arguments.
 /// It caches the instantiations that have been made, such that they need not be repeated.
@@ -207,7 +252,18 @@ impl SubModuleOrWire {
 /// Also, with incremental builds (#49) this will be a prime area for investigation
 #[derive(Debug)]
 pub struct InstantiationCache {
-    cache: RefCell<HashMap<TVec<ConcreteType>, Rc<InstantiatedModule>>>,
+    /// Each instance gets its own slot, such that the lock on the map is only held briefly,
+    /// while threads requesting an instance that is still being built wait on that slot alone
+    ///
+    /// The keys come from [Linker::template_args_interner], so hashing and comparing them doesn't walk the types
+    cache: Mutex<HashMap<Interned<TVec<ConcreteType>>, Arc<InstanceSlot>>>,
+}
+
+/// Instances aren't cloned, the clone instantiates them again when they are requested
+impl Clone for InstantiationCache {
+    fn clone(&self) -> Self {
+        Self::new()
+    }
 }
 
 impl Default for InstantiationCache {
@@ -219,55 +275,66 @@ impl Default for InstantiationCache {
 impl InstantiationCache {
     pub fn new() -> Self {
         Self {
-            cache: RefCell::new(HashMap::new()),
+            cache: Mutex::new(HashMap::new()),
         }
     }
 
+    /// Safe to call from multiple threads at once. Every set of template arguments is instantiated exactly once,
+    /// other threads requesting the same instance block until it is done. See [instance_slot]
+    ///
+    /// `template_args` must come from [Linker::template_args_interner], the lookup only hashes and compares the handle
     pub fn instantiate(
         &self,
         md: &Module,
         linker: &Linker,
-        template_args: TVec<ConcreteType>,
-    ) -> Option<Rc<InstantiatedModule>> {
-        let cache_borrow = self.cache.borrow();
-
-        // Temporary, no template arguments yet
-        let instance = if let Some(found) = cache_borrow.get(&template_args) {
-            found.clone()
-        } else {
-            std::mem::drop(cache_borrow);
-
-            let result = perform_instantiation(md, linker, &template_args);
-
-            if config().should_print_for_debug(config().debug_print_module_contents, &result.name) {
-                println!("[[Instantiated {}]]", result.name);
-                for (id, w) in &result.wires {
-                    println!("{id:?} -> {w:?}");
-                }
-                for (id, sm) in &result.submodules {
-                    println!("SubModule {id:?}: {sm:?}");
+        template_args: Interned<TVec<ConcreteType>>,
+        cancelled: &AtomicBool,
+    ) -> Result<Arc<InstantiatedModule>, InstantiateError> {
+        let slot = self
+            .cache
+            .lock()
+            .unwrap()
+            .entry(template_args.clone())
+            .or_default()
+            .clone();
+
+        let instance = match slot.claim() {
+            Claim::Built(instance) => instance,
+            Claim::Recursive => return Err(InstantiateError::Recursive),
+            Claim::Build(build) => {
+                // Dropping `build` empties the slot again, so threads waiting for it retry or notice the cancellation themselves
+                let Some(result) = perform_instantiation(md, linker, &template_args, cancelled)
+                else {
+                    return Err(InstantiateError::Cancelled);
+                };
+
+                if config()
+                    .should_print_for_debug(config().debug_print_module_contents, &result.name)
+                {
+                    println!("[[Instantiated {}]]", result.name);
+                    result.print_wires();
+                    for (id, sm) in &result.submodules {
+                        println!("SubModule {id:?}: {sm:?}");
+                    }
                 }
-            }
 
-            let result_ref = Rc::new(result);
-            assert!(self
-                .cache
-                .borrow_mut()
-                .insert(template_args, result_ref.clone())
-                .is_none());
-            result_ref
+                let instance = Arc::new(result);
+                build.finish(instance.clone());
+                instance
+            }
         };
 
         if !instance.errors.did_error {
-            Some(instance.clone())
+            Ok(instance)
         } else {
-            None
+            Err(InstantiateError::Errored)
         }
     }
 
     pub fn for_each_error(&self, func: &mut impl FnMut(&CompileError)) {
-        let cache_borrow = self.cache.borrow();
-        for inst in cache_borrow.values() {
+        let cache_lock = self.cache.lock().unwrap();
+        // Instances that are still being built by another thread are skipped
+        for inst in cache_lock.values().filter_map(|slot| slot.get()) {
             for err in &inst.errors {
                 func(err)
             }
@@ -275,18 +342,20 @@ impl InstantiationCache {
     }
 
     pub fn clear_instances(&mut self) {
-        self.cache.borrow_mut().clear()
+        self.cache.get_mut().unwrap().clear()
     }
 
     // Also passes over invalid instances. Instance validity should not be assumed!
     // Only used for things like syntax highlighting
     pub fn for_each_instance(
         &self,
-        mut f: impl FnMut(&TVec<ConcreteType>, &Rc<InstantiatedModule>),
+        mut f: impl FnMut(&TVec<ConcreteType>, &Arc<InstantiatedModule>),
     ) {
-        let borrow = self.cache.borrow();
-        for (k, v) in borrow.iter() {
-            f(k, v)
+        let cache_lock = self.cache.lock().unwrap();
+        for (k, slot) in cache_lock.iter() {
+            if let Some(v) = slot.get() {
+                f(&**k, &v)
+            }
         }
     }
 }
@@ -321,7 +390,11 @@ pub struct ConditionStackElem {
 struct InstantiationContext<'fl, 'l> {
     name: String,
     generation_state: GenerationState<'fl>,
+    /// Always grown together, see [InstantiatedModule::wire_sources]
     wires: FlatAlloc<RealWire, WireIDMarker>,
+    wire_sources: FlatAlloc<RealWireDataSource, WireIDMarker>,
+    wire_types: FlatAlloc<ConcreteType, WireIDMarker>,
+    wire_latencies: FlatAlloc<i64, WireIDMarker>,
     submodules: FlatAlloc<SubModule, SubModuleIDMarker>,
 
     type_substitutor: TypeSubstitutor<ConcreteType, ConcreteTypeVariableIDMarker>,
@@ -336,6 +409,8 @@ struct InstantiationContext<'fl, 'l> {
     template_args: &'fl TVec<ConcreteType>,
     md: &'fl Module,
     linker: &'l Linker,
+    /// Checked before every instruction, such that even long generative code stops soon after it is set
+    cancelled: &'l AtomicBool,
 }
 
 /// Mangle the module name for use in code generation
@@ -351,11 +426,30 @@ fn mangle_name(str: &str) -> String {
 }
 
 impl InstantiationContext<'_, '_> {
-    fn extract(self) -> InstantiatedModule {
+    /// Instances are kept for the rest of compilation (and for as long as the language server runs),
+    /// so the slack left over from growing their tables during execution is released here
+    fn extract(mut self) -> InstantiatedModule {
+        self.wires.shrink_to_fit();
+        self.wire_sources.shrink_to_fit();
+        self.wire_types.shrink_to_fit();
+        self.wire_latencies.shrink_to_fit();
+        self.submodules.shrink_to_fit();
+        for (_id, source) in &mut self.wire_sources {
+            if let RealWireDataSource::Multiplexer { sources, .. } = source {
+                sources.shrink_to_fit();
+            }
+        }
         InstantiatedModule {
             mangled_name: mangle_name(&self.name),
             name: self.name,
+            wire_needed_untils: latency_count::compute_needed_untils(
+                &self.wire_sources,
+                &self.wire_latencies,
+            ),
             wires: self.wires,
+            wire_sources: self.wire_sources,
+            wire_types: self.wire_types,
+            wire_latencies: self.wire_latencies,
             submodules: self.submodules,
             interface_ports: self.interface_ports,
             generation_state: self.generation_state.generation_state,
@@ -364,13 +458,17 @@ impl InstantiationContext<'_, '_> {
     }
 }
 
+/// Returns [None] if `cancelled` was set while running. The partial instance is thrown away
 fn perform_instantiation(
     md: &Module,
     linker: &Linker,
     template_args: &TVec<ConcreteType>,
-) -> InstantiatedModule {
+    cancelled: &AtomicBool,
+) -> Option<InstantiatedModule> {
+    let name = pretty_print_concrete_instance(&md.link_info, template_args, &linker.types);
+    let mut timer = PhaseTimer::new("instantiate", || name.clone());
     let mut context = InstantiationContext {
-        name: pretty_print_concrete_instance(&md.link_info, template_args, &linker.types),
+        name,
         generation_state: GenerationState {
             md,
             generation_state: md
@@ -381,6 +479,9 @@ fn perform_instantiation(
         type_substitutor: TypeSubstitutor::new(),
         condition_stack: Vec::new(),
         wires: FlatAlloc::new(),
+        wire_sources: FlatAlloc::new(),
+        wire_types: FlatAlloc::new(),
+        wire_latencies: FlatAlloc::new(),
         submodules: FlatAlloc::new(),
         interface_ports: md.ports.map(|_| None),
         errors: ErrorCollector::new_empty(md.link_info.file, &linker.files),
@@ -388,6 +489,7 @@ fn perform_instantiation(
         template_args,
         md,
         linker,
+        cancelled,
     };
 
     // Don't instantiate modules that already errored. Otherwise instantiator may crash
@@ -397,21 +499,32 @@ fn perform_instantiation(
             md.link_info.name
         );
         context.errors.set_did_error();
-        return context.extract();
+        return Some(context.extract());
     }
 
     println!("Instantiating {}", md.link_info.name);
 
-    if let Err(e) = context.execute_module() {
+    let execute_timer = PhaseTimer::new("execute", || context.name.clone());
+    let execute_result = context.execute_module();
+    drop(execute_timer);
+    if cancelled.load(Ordering::Relaxed) {
+        return None;
+    }
+    if let Err(e) = execute_result {
         context.errors.error(e.0, e.1);
 
-        return context.extract();
+        return Some(context.extract());
     }
+    timer.add_counter("wires", context.wires.len());
+    timer.add_counter("submodules", context.submodules.len());
 
     if config().should_print_for_debug(config().debug_print_module_contents, &context.name) {
         println!("[[Executed {}]]", &context.name);
         for (id, w) in &context.wires {
-            println!("{id:?} -> {w:?}");
+            println!(
+                "{id:?} -> {w:?} {:?} = {:?}",
+                context.wire_types[id], context.wire_sources[id]
+            );
         }
         for (id, sm) in &context.submodules {
             println!("SubModule {id:?}: {sm:?}");
@@ -419,10 +532,20 @@ fn perform_instantiation(
     }
 
     println!("Concrete Typechecking {}", md.link_info.name);
+    let concrete_typecheck_timer = PhaseTimer::new("concrete typecheck", || context.name.clone());
     context.typecheck();
+    drop(concrete_typecheck_timer);
+    // Submodules that were cancelled are missing
+    if cancelled.load(Ordering::Relaxed) {
+        return None;
+    }
 
     println!("Latency Counting {}", md.link_info.name);
-    context.compute_latencies();
+    let latency_timer = PhaseTimer::new("latency counting", || context.name.clone());
+    // The temporary tables of latency counting are freed all at once, here at the end of the instantiation
+    let scratch = ScratchArena::new();
+    context.compute_latencies(&scratch);
+    drop(latency_timer);
 
-    context.extract()
+    Some(context.extract())
 }
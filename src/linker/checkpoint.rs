@@ -40,4 +40,10 @@ impl LinkInfo {
         self.errors.reset_to(cp.errors_cp);
         self.resolved_globals.reset_to(cp.resolved_globals_cp);
     }
+    /// True if the last checkpoint this global reached is `checkpoint_id`.
+    ///
+    /// Compilation stages use this to skip globals that were not reset by incremental compilation (#49)
+    pub fn is_at_checkpoint(&self, checkpoint_id: usize) -> bool {
+        self.checkpoints.len() == checkpoint_id + 1
+    }
 }
@@ -0,0 +1,158 @@
+//! Incremental compilation (#49)
+//!
+//! Every global remembers which other globals it used in [LinkInfo::resolved_globals].
+//! When files are added, updated or removed, [Linker::recompile_all] uses this to only reset and redo the globals that could be affected by the change.
+
+use std::collections::{HashMap, HashSet};
+
+use super::*;
+
+/// Everything that changed in the global namespace since the last [Linker::recompile_all]
+#[derive(Debug, Default, Clone)]
+pub struct PendingChanges {
+    /// Globals that have been removed. Their UUIDs may already have been reused for new globals
+    removed_globals: HashSet<GlobalUUID>,
+    /// Names of globals that were added or removed. Anything resolving these names may now resolve differently
+    changed_names: HashSet<String>,
+}
+
+impl PendingChanges {
+    pub fn is_empty(&self) -> bool {
+        self.removed_globals.is_empty() && self.changed_names.is_empty()
+    }
+    pub fn global_removed(&mut self, global: GlobalUUID, name: String) {
+        self.removed_globals.insert(global);
+        self.changed_names.insert(name);
+    }
+    pub fn global_added(&mut self, name: &str) {
+        if !self.changed_names.contains(name) {
+            self.changed_names.insert(name.to_owned());
+        }
+    }
+}
+
+/// Reverse of [ResolvedGlobals]: For each global, the globals that referenced it while being compiled.
+pub struct DependencyGraph {
+    dependents: HashMap<GlobalUUID, Vec<GlobalUUID>>,
+}
+
+impl DependencyGraph {
+    pub fn new(linker: &Linker) -> Self {
+        let mut dependents: HashMap<GlobalUUID, Vec<GlobalUUID>> = HashMap::new();
+        for global in linker.iter_all_globals() {
+            for referenced in linker.get_link_info(global).resolved_globals.iter() {
+                if referenced == global {
+                    continue;
+                }
+                let list = dependents.entry(referenced).or_default();
+                // referenced_globals contains many duplicates. Since we push all of one global at once, checking the last one suffices
+                if list.last() != Some(&global) {
+                    list.push(global);
+                }
+            }
+        }
+        Self { dependents }
+    }
+
+    /// All globals that directly referenced `global`
+    pub fn dependents_of(&self, global: GlobalUUID) -> &[GlobalUUID] {
+        self.dependents
+            .get(&global)
+            .map(|v| v.as_slice())
+            .unwrap_or(&[])
+    }
+
+    /// All globals that transitively depend on any of `roots`, excluding the roots themselves unless they are part of a cycle
+    pub fn transitive_dependents(
+        &self,
+        roots: impl IntoIterator<Item = GlobalUUID>,
+    ) -> HashSet<GlobalUUID> {
+        let mut result = HashSet::new();
+        let mut queue: Vec<GlobalUUID> = roots.into_iter().collect();
+        while let Some(global) = queue.pop() {
+            for dependent in self.dependents_of(global) {
+                if result.insert(*dependent) {
+                    queue.push(*dependent);
+                }
+            }
+        }
+        result
+    }
+}
+
+impl Linker {
+    pub fn iter_all_globals(&self) -> impl Iterator<Item = GlobalUUID> + '_ {
+        let modules = self.modules.iter().map(|(id, _)| GlobalUUID::Module(id));
+        let types = self.types.iter().map(|(id, _)| GlobalUUID::Type(id));
+        let constants = self
+            .constants
+            .iter()
+            .map(|(id, _)| GlobalUUID::Constant(id));
+        modules.chain(types).chain(constants)
+    }
+
+    /// Finds all globals that may be affected by [Self::pending_changes], and resets them back to [AFTER_INITIAL_PARSE_CP].
+    ///
+    /// Returns the number of globals that were reset
+    pub fn reset_invalidated_globals(&mut self) -> usize {
+        let changes = std::mem::take(&mut self.pending_changes);
+        if changes.is_empty() {
+            return 0;
+        }
+
+        let graph = DependencyGraph::new(self);
+
+        // Globals that are themselves affected by the change. Removed globals don't exist anymore, but their dependents do
+        let mut roots: Vec<GlobalUUID> = changes.removed_globals.iter().copied().collect();
+        for global in self.iter_all_globals() {
+            let link_info = self.get_link_info(global);
+            // Globals that failed name resolution may now succeed
+            if !link_info.resolved_globals.all_resolved()
+                || changes.changed_names.contains(&link_info.name)
+            {
+                roots.push(global);
+            }
+        }
+        let mut to_reset = graph.transitive_dependents(roots.iter().copied());
+        for global in roots {
+            if !changes.removed_globals.contains(&global) {
+                to_reset.insert(global);
+            }
+        }
+
+        for global in &to_reset {
+            let link_info = Linker::get_link_info_mut(
+                &mut self.modules,
+                &mut self.types,
+                &mut self.constants,
+                *global,
+            );
+            self.reference_index
+                .forget(*global, &link_info.resolved_globals);
+            match *global {
+                GlobalUUID::Module(md_id) => {
+                    let Module {
+                        link_info,
+                        instantiations,
+                        ..
+                    } = &mut self.modules[md_id];
+                    link_info.reset_to(AFTER_INITIAL_PARSE_CP);
+                    link_info.instructions.clear();
+                    instantiations.clear_instances();
+                }
+                GlobalUUID::Type(typ_id) => {
+                    self.types[typ_id]
+                        .link_info
+                        .reset_to(AFTER_INITIAL_PARSE_CP);
+                }
+                GlobalUUID::Constant(cst_id) => {
+                    self.constants[cst_id]
+                        .link_info
+                        .reset_to(AFTER_INITIAL_PARSE_CP);
+                }
+            }
+        }
+        self.template_args_interner.remove_unused();
+        to_reset.len()
+    }
+}
@@ -1,14 +1,21 @@
 use crate::{
     flattening::{Instruction, NamedConstant},
     prelude::*,
-    typing::template::{
-        GenerativeParameterKind, Parameter, ParameterKind, TVec, TypeParameterKind,
+    typing::{
+        concrete_type::ConcreteType,
+        interner::Interner,
+        template::{GenerativeParameterKind, Parameter, ParameterKind, TVec, TypeParameterKind},
     },
 };
 
 pub mod checkpoint;
+mod incremental;
+mod reference_index;
 mod resolver;
 use arrayvec::ArrayVec;
+pub use incremental::DependencyGraph;
+use incremental::PendingChanges;
+pub use reference_index::ReferenceIndex;
 pub use resolver::*;
 
 use std::{
@@ -78,7 +85,7 @@ pub const AFTER_LINTS_CP: usize = 3;
 /// Represents any global. Stored in [Linker] and each is uniquely indexed by [GlobalUUID]
 ///
 /// Base class for [Module], [StructType], [NamedConstant]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct LinkInfo {
     pub file: FileUUID,
     pub span: Span,
@@ -99,11 +106,11 @@ pub struct LinkInfo {
     /// Created in Stage 2: Flattening. type data is filled out during Typechecking
     pub instructions: FlatAlloc<Instruction, FlatIDMarker>,
 
-    /// Reset checkpoints. These are to reset errors and resolved_globals for incremental compilation.
+    /// Reset checkpoints. These are to reset errors and resolved_globals for incremental compilation (#49).
     ///
-    /// TODO the system is there, just need to actually do incremental compilation (#49)
+    /// Globals that are not affected by a change keep their checkpoints, and are skipped by the compilation stages. See [LinkInfo::is_at_checkpoint]
     ///
-    /// Right now it already functions as a sanity check, to make sure no steps in building modules/types are skipped
+    /// It also functions as a sanity check, to make sure no steps in building modules/types are skipped
     pub checkpoints: ArrayVec<CheckPoint, 4>,
 }
 
@@ -133,6 +140,7 @@ impl LinkInfo {
 /// Data associated with a file. Such as the text, the parse tree, and all [Module]s, [StructType]s, or [NamedConstant]s.
 ///
 /// All FileDatas are stored in [Linker::files], and indexed by [FileUUID]
+#[derive(Clone)]
 pub struct FileData {
     pub file_identifier: String,
     pub file_text: FileText,
@@ -192,6 +200,7 @@ impl From<ConstantUUID> for GlobalUUID {
     }
 }
 
+#[derive(Clone)]
 enum NamespaceElement {
     Global(GlobalUUID),
     Colission(Box<[GlobalUUID]>),
@@ -206,12 +215,47 @@ enum NamespaceElement {
 /// It also keeps track of the global namespace.
 ///
 /// Incremental operations such as adding and removing files can be performed on this
+#[derive(Clone)]
 pub struct Linker {
     pub types: ArenaAllocator<StructType, TypeUUIDMarker>,
     pub modules: ArenaAllocator<Module, ModuleUUIDMarker>,
     pub constants: ArenaAllocator<NamedConstant, ConstantUUIDMarker>,
     pub files: ArenaAllocator<FileData, FileUUIDMarker>,
     global_namespace: HashMap<String, NamespaceElement>,
+    /// Used by [Linker::recompile_all] to only recompile what is needed
+    pending_changes: PendingChanges,
+    /// The template arguments of all instances, such that [crate::instantiation::InstantiationCache] lookups are cheap
+    pub template_args_interner: Interner<TVec<ConcreteType>>,
+    /// The modules [Linker::recompile_all] instantiates
+    pub instantiation_roots: InstantiationRoots,
+    /// Updated at the end of [Linker::recompile_all_up_to_instantiation]
+    pub reference_index: ReferenceIndex,
+}
+
+/// Which modules [Linker::recompile_all] instantiates. Submodules are instantiated along with the modules that use them,
+/// so restricting the roots skips all modules not reachable from them.
+///
+/// Only modules without template parameters can be roots
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub enum InstantiationRoots {
+    #[default]
+    AllModules,
+    /// Given with `--top` or `--standalone`
+    Named(HashSet<String>),
+    /// All modules in the files with these [FileData::file_identifier]s. The language server uses the files open in the editor
+    InFiles(HashSet<String>),
+}
+
+impl InstantiationRoots {
+    pub fn includes(&self, md: &Module, files: &ArenaAllocator<FileData, FileUUIDMarker>) -> bool {
+        match self {
+            InstantiationRoots::AllModules => true,
+            InstantiationRoots::Named(names) => names.contains(&md.link_info.name),
+            InstantiationRoots::InFiles(file_identifiers) => {
+                file_identifiers.contains(&files[md.link_info.file].file_identifier)
+            }
+        }
+    }
 }
 
 impl Default for Linker {
@@ -228,6 +272,10 @@ impl Linker {
             constants: ArenaAllocator::new(),
             files: ArenaAllocator::new(),
             global_namespace: HashMap::new(),
+            pending_changes: PendingChanges::default(),
+            template_args_interner: Interner::new(),
+            reference_index: ReferenceIndex::default(),
+            instantiation_roots: InstantiationRoots::AllModules,
         }
     }
 
@@ -333,17 +381,14 @@ impl Linker {
         for v in file_data.associated_values.drain(..) {
             let was_new_item_in_set = to_remove_set.insert(v);
             assert!(was_new_item_in_set);
-            match v {
-                GlobalUUID::Module(id) => {
-                    self.modules.free(id);
-                }
-                GlobalUUID::Type(id) => {
-                    self.types.free(id);
-                }
-                GlobalUUID::Constant(id) => {
-                    self.constants.free(id);
-                }
-            }
+            let link_info = match v {
+                GlobalUUID::Module(id) => self.modules.free(id).link_info,
+                GlobalUUID::Type(id) => self.types.free(id).link_info,
+                GlobalUUID::Constant(id) => self.constants.free(id).link_info,
+            };
+            self.reference_index.forget(v, &link_info.resolved_globals);
+            let name = link_info.name;
+            self.pending_changes.global_removed(v, name);
         }
 
         // Remove from global namespace
@@ -389,6 +434,14 @@ impl Linker {
         });
 
         let parsing_errors = other_parsing_errors.into_storage();
+        for v in &associated_values {
+            let name = match *v {
+                GlobalUUID::Module(id) => &self.modules[id].link_info.name,
+                GlobalUUID::Type(id) => &self.types[id].link_info.name,
+                GlobalUUID::Constant(id) => &self.constants[id].link_info.name,
+            };
+            self.pending_changes.global_added(name);
+        }
         let file_data = &mut self.files[file_id];
         file_data.parsing_errors = parsing_errors;
         file_data.associated_values = associated_values;
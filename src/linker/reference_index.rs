@@ -0,0 +1,80 @@
+//! Reverse index of [LinkInfo::resolved_globals], used by the language server for find-references and rename.
+//!
+//! All references to a global, its ports, interfaces and parameters lie within the global itself or within the globals that resolved it.
+//! So instead of walking every file in the workspace, only those globals have to be walked.
+//!
+//! Unlike [super::DependencyGraph], this is kept across [Linker::recompile_all] calls, and only updated for the globals that changed.
+
+use std::collections::{HashMap, HashSet};
+
+use super::*;
+
+#[derive(Debug, Default, Clone)]
+pub struct ReferenceIndex {
+    /// For each global, the globals that referenced it. May still contain globals that were removed since, until their dependents are recompiled
+    referenced_by: HashMap<GlobalUUID, HashSet<GlobalUUID>>,
+    /// How many of the [LinkInfo::resolved_globals] of each global have been added to [Self::referenced_by].
+    /// Between resets, [ResolvedGlobals] only grows, so only the new ones have to be added
+    num_indexed: HashMap<GlobalUUID, usize>,
+}
+
+impl ReferenceIndex {
+    /// Adds the globals that were newly resolved since the last update
+    fn update(&mut self, global: GlobalUUID, resolved_globals: &ResolvedGlobals) {
+        let num_indexed = self.num_indexed.entry(global).or_default();
+        for referenced in resolved_globals.iter().skip(*num_indexed) {
+            *num_indexed += 1;
+            if referenced != global {
+                self.referenced_by
+                    .entry(referenced)
+                    .or_default()
+                    .insert(global);
+            }
+        }
+    }
+
+    /// Must be called before the [LinkInfo::resolved_globals] of `global` are reset, or `global` is removed
+    pub fn forget(&mut self, global: GlobalUUID, resolved_globals: &ResolvedGlobals) {
+        let Some(num_indexed) = self.num_indexed.remove(&global) else {
+            return;
+        };
+        for referenced in resolved_globals.iter().take(num_indexed) {
+            if let Some(referencers) = self.referenced_by.get_mut(&referenced) {
+                referencers.remove(&global);
+            }
+        }
+    }
+
+    /// All globals that resolved `global`. Removed globals are filtered out
+    pub fn referenced_by<'s>(
+        &'s self,
+        global: GlobalUUID,
+        linker: &'s Linker,
+    ) -> impl Iterator<Item = GlobalUUID> + 's {
+        self.referenced_by
+            .get(&global)
+            .into_iter()
+            .flatten()
+            .copied()
+            .filter(|referencer| linker.global_exists(*referencer))
+    }
+}
+
+impl Linker {
+    /// Brings [Linker::reference_index] up to date with the [LinkInfo::resolved_globals] of all globals
+    pub fn update_reference_index(&mut self) {
+        let mut index = std::mem::take(&mut self.reference_index);
+        for global in self.iter_all_globals() {
+            index.update(global, &self.get_link_info(global).resolved_globals);
+        }
+        self.reference_index = index;
+    }
+
+    pub fn global_exists(&self, global: GlobalUUID) -> bool {
+        match global {
+            GlobalUUID::Module(md_id) => self.modules.get(md_id).is_some(),
+            GlobalUUID::Type(typ_id) => self.types.get(typ_id).is_some(),
+            GlobalUUID::Constant(cst_id) => self.constants.get(cst_id).is_some(),
+        }
+    }
+}
@@ -9,7 +9,7 @@ use self::checkpoint::ResolvedGlobalsCheckpoint;
 use super::*;
 
 /// See [GlobalResolver]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct ResolvedGlobals {
     referenced_globals: Vec<GlobalUUID>,
     all_resolved: bool,
@@ -35,6 +35,14 @@ impl ResolvedGlobals {
     pub fn checkpoint(&self) -> ResolvedGlobalsCheckpoint {
         ResolvedGlobalsCheckpoint(self.referenced_globals.len(), self.all_resolved)
     }
+    /// All globals that were referenced. May contain duplicates
+    pub fn iter(&self) -> impl Iterator<Item = GlobalUUID> + '_ {
+        self.referenced_globals.iter().copied()
+    }
+    /// False if some name could not be resolved. When new globals are added, this name may now resolve
+    pub fn all_resolved(&self) -> bool {
+        self.all_resolved
+    }
 }
 
 struct LinkingErrorLocation {
@@ -44,7 +52,7 @@ struct LinkingErrorLocation {
 }
 
 /// This struct encapsulates the concept of name resolution. It reports name-not-found errors,
-/// and remembers all of the requested globals in preparation for #49
+/// and remembers all of the requested globals for incremental compilation (#49, See [super::incremental])
 pub struct GlobalResolver<'linker> {
     linker: &'linker Linker,
     pub file_data: &'linker FileData,
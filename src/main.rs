@@ -1,6 +1,8 @@
 #![doc = include_str!("../README.md")]
 
 mod alloc;
+#[cfg(test)]
+mod benchmarks;
 mod block_vector;
 
 mod config;
@@ -9,7 +11,10 @@ mod errors;
 mod file_position;
 mod flattening;
 mod instantiation;
+mod mem_report;
+mod parallel;
 mod prelude;
+mod profiling;
 mod to_string;
 mod typing;
 mod value;
@@ -52,17 +57,29 @@ fn main() -> Result<(), Box<dyn Error + Sync + Send>> {
         panic!("LSP not enabled!")
     }
 
-    let (linker, mut paths_arena) = compile_all(file_paths);
+    let (mut linker, mut paths_arena, cached) =
+        compile_all(file_paths.clone(), codegen_backend.as_ref());
     print_all_errors(&linker, &mut paths_arena.file_sources);
 
     if config.early_exit != EarlyExitUpTo::CodeGen {
+        profiling::report_time_passes();
+        if config.mem_report {
+            print!("{}", mem_report::MemoryReport::new(&linker));
+        }
+        if config.watch {
+            dev_aid::watch::watch_files(
+                &file_paths,
+                &mut linker,
+                &mut paths_arena,
+                codegen_backend.as_ref(),
+            );
+        }
         return Ok(());
     }
 
     if config.codegen {
-        for (_id, md) in &linker.modules {
-            codegen_backend.codegen_to_file(md, &linker);
-        }
+        let _timer = profiling::PhaseTimer::whole_phase("codegen");
+        codegen_backend.codegen_all_to_files(&linker, &cached);
     }
 
     if let Some(md_name) = &config.codegen_module_and_dependencies_one_file {
@@ -76,7 +93,36 @@ fn main() -> Result<(), Box<dyn Error + Sync + Send>> {
             std::process::exit(1);
         };
 
-        codegen_backend.codegen_with_dependencies(&linker, md.1, &format!("{md_name}_standalone"));
+        let _timer = profiling::PhaseTimer::whole_phase("codegen");
+        codegen_backend.codegen_with_dependencies(
+            &linker,
+            md.1,
+            &format!("{md_name}_standalone"),
+            &cached,
+        );
+    }
+
+    if let Some(cache_dir) = &config.cache_dir {
+        codegen::disk_cache::store_hierarchies(
+            cache_dir,
+            &linker,
+            codegen_backend.file_extension(),
+        );
+        codegen::disk_cache::evict_least_recently_used(cache_dir);
+    }
+
+    profiling::report_time_passes();
+    if config.mem_report {
+        print!("{}", mem_report::MemoryReport::new(&linker));
+    }
+
+    if config.watch {
+        dev_aid::watch::watch_files(
+            &file_paths,
+            &mut linker,
+            &mut paths_arena,
+            codegen_backend.as_ref(),
+        );
     }
 
     Ok(())
@@ -0,0 +1,229 @@
+//! Estimates of the memory held by the [Linker], printed with `--mem-report`, or requested from the language server with `sus/memoryReport`
+//!
+//! Only the allocations a structure owns directly are counted: the capacity of its tables, and the text of its names and messages.
+//! Values nested deeper, like compile-time arrays and types, are not followed. Tree-sitter doesn't expose the size of its trees,
+//! so those are estimated from their number of nodes.
+//!
+//! The [crate::typing::type_inference::TypeSubstitutor]s are not listed, they only live while a global is being typechecked or instantiated.
+
+use std::fmt::{self, Display};
+use std::mem::size_of;
+
+use crate::instantiation::{InstantiatedModule, MultiplexerSource, RealWireDataSource};
+use crate::linker::GlobalUUID;
+use crate::prelude::*;
+
+/// Rough heap size of one tree-sitter node. Many leaf nodes are stored inline, and take less
+const TREE_SITTER_BYTES_PER_NODE: usize = 64;
+/// Number of per-instance rows in the report
+const NUM_LARGEST_INSTANCES_TO_PRINT: usize = 25;
+
+fn kib(bytes: usize) -> f64 {
+    bytes as f64 / 1024.0
+}
+
+struct FileMemory {
+    file_identifier: String,
+    text: usize,
+    tree_nodes: usize,
+    parsing_errors: usize,
+}
+
+impl FileMemory {
+    fn tree(&self) -> usize {
+        self.tree_nodes * TREE_SITTER_BYTES_PER_NODE
+    }
+    fn total(&self) -> usize {
+        self.text + self.tree() + self.parsing_errors
+    }
+}
+
+struct InstanceMemory {
+    name: String,
+    wires: usize,
+    submodules: usize,
+    generation_state: usize,
+    errors: usize,
+    /// Names and ports
+    other: usize,
+}
+
+impl InstanceMemory {
+    fn of(inst: &InstantiatedModule) -> Self {
+        let mut wires = inst.wires.allocated_bytes()
+            + inst.wire_sources.allocated_bytes()
+            + inst.wire_types.allocated_bytes()
+            + inst.wire_latencies.allocated_bytes()
+            + inst.wire_needed_untils.allocated_bytes();
+        for (_id, w) in &inst.wires {
+            wires += w.name.capacity();
+        }
+        for (_id, source) in &inst.wire_sources {
+            if let RealWireDataSource::Multiplexer { sources, .. } = source {
+                wires += sources.capacity() * size_of::<MultiplexerSource>();
+            }
+        }
+        let mut submodules = inst.submodules.allocated_bytes();
+        for (_id, sm) in &inst.submodules {
+            submodules += sm.name.capacity()
+                + sm.port_map.allocated_bytes()
+                + sm.interface_call_sites.allocated_bytes()
+                + sm.template_args().allocated_bytes();
+            for (_id, call_sites) in &sm.interface_call_sites {
+                submodules += call_sites.capacity() * size_of::<Span>();
+            }
+        }
+        Self {
+            name: inst.name.clone(),
+            wires,
+            submodules,
+            generation_state: inst.generation_state.allocated_bytes(),
+            errors: inst.errors.allocated_bytes(),
+            other: inst.name.capacity()
+                + inst.mangled_name.capacity()
+                + inst.interface_ports.allocated_bytes(),
+        }
+    }
+    fn total(&self) -> usize {
+        self.wires + self.submodules + self.generation_state + self.errors + self.other
+    }
+}
+
+/// A module, type or constant. Only modules have instances
+struct GlobalMemory {
+    name: String,
+    instructions: usize,
+    errors: usize,
+    instances: Vec<InstanceMemory>,
+}
+
+impl GlobalMemory {
+    fn instances_total(&self) -> usize {
+        self.instances.iter().map(InstanceMemory::total).sum()
+    }
+    fn total(&self) -> usize {
+        self.instructions + self.errors + self.instances_total()
+    }
+}
+
+pub struct MemoryReport {
+    files: Vec<FileMemory>,
+    globals: Vec<GlobalMemory>,
+}
+
+impl MemoryReport {
+    pub fn new(linker: &Linker) -> Self {
+        let mut files: Vec<FileMemory> = linker
+            .files
+            .iter()
+            .map(|(_id, file)| FileMemory {
+                file_identifier: file.file_identifier.clone(),
+                text: file.file_text.allocated_bytes(),
+                tree_nodes: file.tree.root_node().descendant_count(),
+                parsing_errors: file.parsing_errors.allocated_bytes(),
+            })
+            .collect();
+        files.sort_by_key(|file| std::cmp::Reverse(file.total()));
+
+        let mut globals: Vec<GlobalMemory> = linker
+            .iter_all_globals()
+            .map(|global| {
+                let link_info = linker.get_link_info(global);
+                let mut instances = Vec::new();
+                if let GlobalUUID::Module(md_id) = global {
+                    linker.modules[md_id].instantiations.for_each_instance(
+                        |_template_args, inst| instances.push(InstanceMemory::of(inst)),
+                    );
+                }
+                GlobalMemory {
+                    name: link_info.get_full_name(),
+                    instructions: link_info.instructions.allocated_bytes(),
+                    errors: link_info.errors.allocated_bytes(),
+                    instances,
+                }
+            })
+            .collect();
+        globals.sort_by_key(|global| std::cmp::Reverse(global.total()));
+
+        Self { files, globals }
+    }
+
+    pub fn total(&self) -> usize {
+        let files: usize = self.files.iter().map(FileMemory::total).sum();
+        let globals: usize = self.globals.iter().map(GlobalMemory::total).sum();
+        files + globals
+    }
+}
+
+/// The tables are sorted from largest to smallest
+impl Display for MemoryReport {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(f, "==== Memory per file (KiB) ====")?;
+        writeln!(
+            f,
+            "{:<48} {:>10} {:>10} {:>10} {:>10}",
+            "File", "Text", "Tree", "Errors", "Total"
+        )?;
+        for file in &self.files {
+            writeln!(
+                f,
+                "{:<48} {:>10.1} {:>10.1} {:>10.1} {:>10.1}",
+                file.file_identifier,
+                kib(file.text),
+                kib(file.tree()),
+                kib(file.parsing_errors),
+                kib(file.total())
+            )?;
+        }
+
+        writeln!(f)?;
+        writeln!(f, "==== Memory per global (KiB) ====")?;
+        writeln!(
+            f,
+            "{:<32} {:>12} {:>10} {:>9} {:>10} {:>10}",
+            "Global", "Instructions", "Errors", "Instances", "Inst. KiB", "Total"
+        )?;
+        for global in &self.globals {
+            writeln!(
+                f,
+                "{:<32} {:>12.1} {:>10.1} {:>9} {:>10.1} {:>10.1}",
+                global.name,
+                kib(global.instructions),
+                kib(global.errors),
+                global.instances.len(),
+                kib(global.instances_total()),
+                kib(global.total())
+            )?;
+        }
+
+        let mut instances: Vec<&InstanceMemory> = self
+            .globals
+            .iter()
+            .flat_map(|global| &global.instances)
+            .collect();
+        instances.sort_by_key(|inst| std::cmp::Reverse(inst.total()));
+        writeln!(f)?;
+        writeln!(f, "==== Largest instances (KiB) ====")?;
+        writeln!(
+            f,
+            "{:<40} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}",
+            "Instance", "Wires", "Submodules", "Gen. state", "Errors", "Other", "Total"
+        )?;
+        for inst in instances.iter().take(NUM_LARGEST_INSTANCES_TO_PRINT) {
+            writeln!(
+                f,
+                "{:<40} {:>10.1} {:>10.1} {:>10.1} {:>10.1} {:>10.1} {:>10.1}",
+                inst.name,
+                kib(inst.wires),
+                kib(inst.submodules),
+                kib(inst.generation_state),
+                kib(inst.errors),
+                kib(inst.other),
+                kib(inst.total())
+            )?;
+        }
+
+        writeln!(f)?;
+        writeln!(f, "Total: {:.1} KiB", kib(self.total()))
+    }
+}
@@ -0,0 +1,52 @@
+//! Helpers for running independent per-global work on multiple threads. See [crate::config::ConfigStruct::jobs]
+
+use std::sync::{
+    atomic::{AtomicUsize, Ordering},
+    Mutex,
+};
+
+/// Worker threads run the same deeply recursive code as the main thread, so give them a comparable stack
+const WORKER_STACK_SIZE: usize = 8 * 1024 * 1024;
+
+/// Applies `f` to every item, using up to `jobs` threads. The results are returned in the order of `items`, regardless of which thread finished first.
+///
+/// Idle threads grab the next unprocessed item, such that a few large items don't hold up the rest.
+///
+/// With `jobs == 1` everything simply runs on the calling thread.
+pub fn parallel_map<T: Send, R: Send>(
+    jobs: usize,
+    items: Vec<T>,
+    f: impl Fn(T) -> R + Sync,
+) -> Vec<R> {
+    let num_items = items.len();
+    let num_threads = jobs.min(num_items);
+    if num_threads <= 1 {
+        return items.into_iter().map(f).collect();
+    }
+
+    let work: Vec<Mutex<Option<T>>> = items.into_iter().map(|v| Mutex::new(Some(v))).collect();
+    let results: Vec<Mutex<Option<R>>> = (0..num_items).map(|_| Mutex::new(None)).collect();
+    let next_item = AtomicUsize::new(0);
+
+    std::thread::scope(|scope| {
+        for _ in 0..num_threads {
+            std::thread::Builder::new()
+                .stack_size(WORKER_STACK_SIZE)
+                .spawn_scoped(scope, || loop {
+                    let idx = next_item.fetch_add(1, Ordering::Relaxed);
+                    if idx >= num_items {
+                        break;
+                    }
+                    let item = work[idx].lock().unwrap().take().unwrap();
+                    let result = f(item);
+                    *results[idx].lock().unwrap() = Some(result);
+                })
+                .expect("Could not spawn worker thread");
+        }
+    });
+
+    results
+        .into_iter()
+        .map(|r| r.into_inner().unwrap().unwrap())
+        .collect()
+}
@@ -0,0 +1,297 @@
+//! Timing and counters for the compiler phases, enabled with `--time-passes` or `--time-passes-json`
+//!
+//! Every [PhaseTimer] records one event when it is dropped. Events from all threads are gathered,
+//! and can then be printed as a table with [print_time_passes_table], or written as Chrome trace JSON with [write_chrome_trace].
+//! Such a trace can be opened with `chrome://tracing` or <https://ui.perfetto.dev>.
+//!
+//! Submodules are instantiated while their parent is being instantiated, so timers of the same phase can nest.
+//! The table counts the self time of such a timer: the time spent in a nested timer of a phase that was already running is left out
+//! of all the timers around it. The trace keeps the full durations, as trace viewers show the nesting themselves.
+
+use std::{
+    cell::{Cell, RefCell},
+    collections::HashMap,
+    fmt::Write as _,
+    io::Write,
+    path::Path,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        LazyLock, Mutex,
+    },
+    time::{Duration, Instant},
+};
+
+use crate::config::config;
+
+/// Number of per-item rows printed by [print_time_passes_table]
+const NUM_SLOWEST_ITEMS_TO_PRINT: usize = 25;
+
+static PROFILING_ENABLED: LazyLock<bool> = LazyLock::new(|| {
+    let config = config();
+    LazyLock::force(&PROFILING_START);
+    config.time_passes || config.time_passes_json.is_some()
+});
+static PROFILING_START: LazyLock<Instant> = LazyLock::new(Instant::now);
+static EVENTS: Mutex<Vec<PhaseEvent>> = Mutex::new(Vec::new());
+static NEXT_THREAD_ID: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    static THREAD_ID: usize = NEXT_THREAD_ID.fetch_add(1, Ordering::Relaxed);
+    static UNIFICATIONS: Cell<u64> = const { Cell::new(0) };
+    /// The [PhaseTimer]s running on this thread, innermost last
+    static OPEN_TIMERS: RefCell<Vec<OpenTimer>> = const { RefCell::new(Vec::new()) };
+}
+
+fn profiling_enabled() -> bool {
+    *PROFILING_ENABLED
+}
+
+struct OpenTimer {
+    phase: &'static str,
+    /// Time spent in nested timers of a phase that was already running, which isn't part of this timer's self time
+    excluded: Duration,
+}
+
+/// Called on every step of type unification. Attributed to the [PhaseTimer]s running on this thread
+pub fn count_unification() {
+    UNIFICATIONS.with(|c| c.set(c.get() + 1));
+}
+
+struct PhaseEvent {
+    phase: &'static str,
+    /// Usually the module, instance or file the phase was working on. Empty for events covering a whole phase
+    item: String,
+    thread: usize,
+    start: Duration,
+    duration: Duration,
+    /// [Self::duration], without the nested timers of phases that were already running
+    self_duration: Duration,
+    counters: Vec<(&'static str, u64)>,
+}
+
+/// Measures the time from its creation until it is dropped. Does nothing unless profiling is enabled
+pub struct PhaseTimer {
+    running: Option<RunningTimer>,
+}
+
+struct RunningTimer {
+    phase: &'static str,
+    item: String,
+    start: Instant,
+    /// Index in [OPEN_TIMERS]
+    depth: usize,
+    unifications_at_start: u64,
+    counters: Vec<(&'static str, u64)>,
+}
+
+impl PhaseTimer {
+    /// `item` is only evaluated when profiling is enabled
+    pub fn new(phase: &'static str, item: impl FnOnce() -> String) -> Self {
+        let running = profiling_enabled().then(|| RunningTimer {
+            phase,
+            item: item(),
+            start: Instant::now(),
+            depth: OPEN_TIMERS.with_borrow_mut(|open| {
+                open.push(OpenTimer {
+                    phase,
+                    excluded: Duration::ZERO,
+                });
+                open.len() - 1
+            }),
+            unifications_at_start: UNIFICATIONS.with(Cell::get),
+            counters: Vec::new(),
+        });
+        Self { running }
+    }
+
+    /// For a timer that covers a whole phase, rather than a single module
+    pub fn whole_phase(phase: &'static str) -> Self {
+        Self::new(phase, String::new)
+    }
+
+    pub fn add_counter(&mut self, name: &'static str, count: usize) {
+        if let Some(running) = &mut self.running {
+            running.counters.push((name, count as u64));
+        }
+    }
+}
+
+impl Drop for PhaseTimer {
+    fn drop(&mut self) {
+        let Some(mut running) = self.running.take() else {
+            return;
+        };
+        let duration = running.start.elapsed();
+        let excluded = OPEN_TIMERS.with_borrow_mut(|open| {
+            let Some(this) = open.get(running.depth) else {
+                return Duration::ZERO;
+            };
+            let excluded = this.excluded;
+            open.truncate(running.depth);
+            if open.iter().any(|outer| outer.phase == running.phase) {
+                // Whatever of this timer wasn't excluded from the outer timers yet
+                let newly_excluded = duration.saturating_sub(excluded);
+                for outer in open.iter_mut() {
+                    outer.excluded += newly_excluded;
+                }
+            }
+            excluded
+        });
+        let unifications = UNIFICATIONS.with(Cell::get) - running.unifications_at_start;
+        if unifications != 0 {
+            running.counters.push(("unifications", unifications));
+        }
+        let event = PhaseEvent {
+            phase: running.phase,
+            item: running.item,
+            thread: THREAD_ID.with(|id| *id),
+            start: running.start.saturating_duration_since(*PROFILING_START),
+            duration,
+            self_duration: duration.saturating_sub(excluded),
+            counters: running.counters,
+        };
+        EVENTS.lock().unwrap().push(event);
+    }
+}
+
+/// Prints the total self time per phase, followed by the individual modules and instances that took longest
+pub fn print_time_passes_table() {
+    let events = EVENTS.lock().unwrap();
+
+    struct PhaseTotal {
+        first_start: Duration,
+        total: Duration,
+        num_items: usize,
+    }
+    let mut totals: HashMap<&'static str, PhaseTotal> = HashMap::new();
+    for event in events.iter() {
+        let total = totals.entry(event.phase).or_insert(PhaseTotal {
+            first_start: event.start,
+            total: Duration::ZERO,
+            num_items: 0,
+        });
+        total.first_start = total.first_start.min(event.start);
+        total.total += event.self_duration;
+        if !event.item.is_empty() {
+            total.num_items += 1;
+        }
+    }
+    let mut totals: Vec<(&'static str, PhaseTotal)> = totals.into_iter().collect();
+    totals.sort_by_key(|(_, total)| total.first_start);
+
+    let mut table = String::new();
+    writeln!(table, "==== Time per phase ====").unwrap();
+    writeln!(table, "{:<28} {:>12} {:>8}", "Phase", "Time (ms)", "Items").unwrap();
+    for (phase, total) in &totals {
+        writeln!(
+            table,
+            "{phase:<28} {:>12.3} {:>8}",
+            total.total.as_secs_f64() * 1000.0,
+            total.num_items
+        )
+        .unwrap();
+    }
+    writeln!(
+        table,
+        "(Phases run in parallel with --jobs report the time summed over all threads)"
+    )
+    .unwrap();
+
+    let mut items: Vec<&PhaseEvent> = events.iter().filter(|e| !e.item.is_empty()).collect();
+    items.sort_by(|a, b| b.self_duration.cmp(&a.self_duration));
+    writeln!(table).unwrap();
+    writeln!(table, "==== Slowest items ====").unwrap();
+    writeln!(
+        table,
+        "{:<28} {:>12}  {:<40} Counters",
+        "Phase", "Time (ms)", "Item"
+    )
+    .unwrap();
+    for event in items.iter().take(NUM_SLOWEST_ITEMS_TO_PRINT) {
+        let counters: Vec<String> = event
+            .counters
+            .iter()
+            .map(|(name, count)| format!("{name}={count}"))
+            .collect();
+        writeln!(
+            table,
+            "{:<28} {:>12.3}  {:<40} {}",
+            event.phase,
+            event.self_duration.as_secs_f64() * 1000.0,
+            event.item,
+            counters.join(" ")
+        )
+        .unwrap();
+    }
+
+    print!("{table}");
+}
+
+fn write_json_string(out: &mut String, s: &str) {
+    out.push('"');
+    for c in s.chars() {
+        match c {
+            '"' => out.push_str("\\\""),
+            '\\' => out.push_str("\\\\"),
+            '\n' => out.push_str("\\n"),
+            c if (c as u32) < 0x20 => write!(out, "\\u{:04x}", c as u32).unwrap(),
+            c => out.push(c),
+        }
+    }
+    out.push('"');
+}
+
+/// Writes all events in the Chrome Trace Event Format, as "complete" (`"ph":"X"`) events
+pub fn write_chrome_trace(path: &Path) -> std::io::Result<()> {
+    let events = EVENTS.lock().unwrap();
+
+    let mut json = String::from("{\"traceEvents\":[\n");
+    for (idx, event) in events.iter().enumerate() {
+        if idx != 0 {
+            json.push_str(",\n");
+        }
+        json.push_str("{\"name\":");
+        if event.item.is_empty() {
+            write_json_string(&mut json, event.phase);
+        } else {
+            write_json_string(&mut json, &format!("{} {}", event.phase, event.item));
+        }
+        json.push_str(",\"cat\":");
+        write_json_string(&mut json, event.phase);
+        write!(
+            json,
+            ",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{},\"args\":{{",
+            event.thread,
+            event.start.as_micros(),
+            event.duration.as_micros()
+        )
+        .unwrap();
+        for (idx, (name, count)) in event.counters.iter().enumerate() {
+            if idx != 0 {
+                json.push(',');
+            }
+            write_json_string(&mut json, name);
+            write!(json, ":{count}").unwrap();
+        }
+        json.push_str("}}");
+    }
+    json.push_str("\n]}\n");
+
+    std::fs::File::create(path)?.write_all(json.as_bytes())
+}
+
+/// Outputs whatever was requested on the command line. Call once compilation is done.
+///
+/// The reported events are dropped, such that the next report, like after a recompilation with `--watch`, only covers what happened since
+pub fn report_time_passes() {
+    let config = config();
+    if config.time_passes {
+        print_time_passes_table();
+    }
+    if let Some(path) = &config.time_passes_json {
+        if let Err(err) = write_chrome_trace(path) {
+            eprintln!("Could not write trace to {}: {err}", path.display());
+        }
+    }
+    EVENTS.lock().unwrap().clear();
+}
@@ -1,10 +1,9 @@
-use num::BigInt;
 use sus_proc_macro::get_builtin_type;
 
 use crate::prelude::*;
 use std::ops::Deref;
 
-use crate::value::Value;
+use crate::value::{IntValue, Value};
 
 use super::template::TVec;
 
@@ -71,7 +70,7 @@ impl ConcreteType {
     /// Returns the size of this type in *wires*. So int #(MAX: 255) would return '8'
     ///
     /// If it contains any Unknowns, then returns None
-    pub fn sizeof(&self) -> Option<BigInt> {
+    pub fn sizeof(&self) -> Option<IntValue> {
         match self {
             ConcreteType::Named(reference) => Some(Self::sizeof_named(reference).into()),
             ConcreteType::Value(_value) => unreachable!("Root of ConcreteType cannot be a value"),
@@ -84,7 +83,7 @@ impl ConcreteType {
                     return None;
                 };
 
-                typ_sz *= arr_sz.unwrap_integer();
+                typ_sz = &typ_sz * arr_sz.unwrap_integer();
 
                 Some(typ_sz)
             }
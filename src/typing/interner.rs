@@ -0,0 +1,173 @@
+//! Hash-consing of immutable values, like the [crate::typing::template::TVec]<[crate::typing::concrete_type::ConcreteType]> that key instantiations
+//!
+//! Equal values interned in the same [Interner] share one allocation, so an [Interned] handle is compared and hashed by address.
+//! The structural hash and comparison is done once, when the value is interned.
+
+use std::{
+    borrow::Borrow,
+    collections::HashSet,
+    fmt::Debug,
+    hash::{DefaultHasher, Hash, Hasher},
+    ops::Deref,
+    sync::{Arc, Mutex},
+};
+
+/// A shared, immutable value. Only compare [Interned] handles that came from the same [Interner]
+pub struct Interned<T>(Arc<T>);
+
+impl<T> Clone for Interned<T> {
+    fn clone(&self) -> Self {
+        Self(self.0.clone())
+    }
+}
+
+impl<T> Deref for Interned<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.0
+    }
+}
+
+impl<T> PartialEq for Interned<T> {
+    fn eq(&self, other: &Self) -> bool {
+        Arc::ptr_eq(&self.0, &other.0)
+    }
+}
+impl<T> Eq for Interned<T> {}
+
+impl<T> Hash for Interned<T> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        Arc::as_ptr(&self.0).hash(state)
+    }
+}
+
+impl<T: Debug> Debug for Interned<T> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        self.0.fmt(f)
+    }
+}
+
+/// The entries in [Interner] are hashed by value, such that they can be found from a `&T`
+struct ByValue<T>(Arc<T>);
+
+impl<T: PartialEq> PartialEq for ByValue<T> {
+    fn eq(&self, other: &Self) -> bool {
+        *self.0 == *other.0
+    }
+}
+impl<T: Eq> Eq for ByValue<T> {}
+
+impl<T: Hash> Hash for ByValue<T> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.0.hash(state)
+    }
+}
+
+impl<T> Borrow<T> for ByValue<T> {
+    fn borrow(&self) -> &T {
+        &self.0
+    }
+}
+
+/// Number of independently locked parts of an [Interner], such that threads interning different values rarely wait on each other
+const NUM_SHARDS: usize = 16;
+
+/// Safe to use from multiple threads at once. Callers should intern a value once and pass the [Interned] handle around,
+/// interning hashes and compares the whole value
+pub struct Interner<T> {
+    shards: [Mutex<HashSet<ByValue<T>>>; NUM_SHARDS],
+}
+
+impl<T: Hash + Eq + Clone> Interner<T> {
+    pub fn new() -> Self {
+        Self {
+            shards: std::array::from_fn(|_| Mutex::new(HashSet::new())),
+        }
+    }
+
+    fn shard(&self, value: &T) -> &Mutex<HashSet<ByValue<T>>> {
+        let mut hasher = DefaultHasher::new();
+        value.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize % NUM_SHARDS]
+    }
+
+    /// Only clones `value` the first time it is seen
+    pub fn intern(&self, value: &T) -> Interned<T> {
+        let mut values = self.shard(value).lock().unwrap();
+        if let Some(found) = values.get(value) {
+            return Interned(found.0.clone());
+        }
+        let new_value = Arc::new(value.clone());
+        values.insert(ByValue(new_value.clone()));
+        Interned(new_value)
+    }
+
+    /// Forgets the values for which no [Interned] handle exists anymore
+    pub fn remove_unused(&mut self) {
+        for shard in &mut self.shards {
+            shard
+                .get_mut()
+                .unwrap()
+                .retain(|v| Arc::strong_count(&v.0) > 1);
+        }
+    }
+
+    #[cfg(test)]
+    fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap().len())
+            .sum()
+    }
+}
+
+impl<T: Hash + Eq + Clone> Default for Interner<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// The clone shares the existing values, so [Interned] handles from either [Interner] stay comparable
+impl<T: Hash + Eq> Clone for Interner<T> {
+    fn clone(&self) -> Self {
+        Self {
+            shards: std::array::from_fn(|idx| {
+                let values = self.shards[idx].lock().unwrap();
+                Mutex::new(values.iter().map(|v| ByValue(v.0.clone())).collect())
+            }),
+        }
+    }
+}
+
+impl<T> Debug for Interner<T> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("Interner").finish_non_exhaustive()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn equal_values_share_a_handle() {
+        let interner: Interner<Vec<u32>> = Interner::new();
+        let a = interner.intern(&vec![1, 2, 3]);
+        let b = interner.intern(&vec![1, 2, 3]);
+        let c = interner.intern(&vec![3, 2, 1]);
+        assert_eq!(a, b);
+        assert_ne!(a, c);
+        assert_eq!(*b, vec![1, 2, 3]);
+    }
+
+    #[test]
+    fn remove_unused_keeps_live_values() {
+        let mut interner: Interner<Vec<u32>> = Interner::new();
+        let kept = interner.intern(&vec![1]);
+        drop(interner.intern(&vec![2]));
+        interner.remove_unused();
+        assert_eq!(interner.len(), 1);
+        assert_eq!(interner.intern(&vec![1]), kept);
+    }
+}
@@ -1,4 +1,5 @@
 pub mod abstract_type;
 pub mod concrete_type;
+pub mod interner;
 pub mod template;
 pub mod type_inference;
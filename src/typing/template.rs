@@ -9,7 +9,7 @@ use crate::{alloc::UUID, prelude::*};
 /// ```sus
 /// FIFO #(DEPTH : 32, T : type int)
 /// ```
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct GlobalReference<ID> {
     pub name_span: Span,
     pub id: ID,
@@ -39,7 +39,7 @@ impl<ID> GlobalReference<ID> {
 /// See [crate::linker::LinkInfo]
 ///
 /// Not to be confused with [TemplateArg], which is the argument passed to this parameter.
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct Parameter {
     pub name: String,
     pub name_span: Span,
@@ -47,7 +47,7 @@ pub struct Parameter {
 }
 
 /// See [Parameter]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct GenerativeParameterKind {
     pub decl_span: Span,
     /// Set at the end of Flattening
@@ -55,13 +55,13 @@ pub struct GenerativeParameterKind {
 }
 
 /// See [Parameter]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct TypeParameterKind {}
 
 /// See [Parameter]
 ///
 /// Must match the [TemplateArgKind] that is passed
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum ParameterKind {
     Type(TypeParameterKind),
     Generative(GenerativeParameterKind),
@@ -91,7 +91,7 @@ impl ParameterKind {
 /// Not to be confused with [Parameter], which it is passed into.
 ///
 /// When instantiated, this becomes a [ConcreteTemplateArg]
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct TemplateArg {
     pub name_span: Span,
     pub value_span: Span,
@@ -101,7 +101,7 @@ pub struct TemplateArg {
 /// See [TemplateArg]
 ///
 /// The argument kind passed to [ParameterKind], which it must match
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum TemplateArgKind {
     Type(WrittenType),
     Value(FlatID),
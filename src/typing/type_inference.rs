@@ -1,12 +1,12 @@
 //! Implements the Hindley-Milner algorithm for Type Inference.
 
-use std::cell::{OnceCell, RefCell};
+use std::cell::{Cell, OnceCell, RefCell};
 use std::fmt::Debug;
 use std::marker::PhantomData;
 use std::ops::{BitAnd, Deref, DerefMut, Index};
 use std::thread::panicking;
 
-use crate::block_vector::{BlockVec, BlockVecIter};
+use crate::block_vector::BlockVec;
 use crate::errors::ErrorInfo;
 use crate::prelude::*;
 
@@ -46,36 +46,87 @@ pub struct FailedUnification<MyType> {
 /// Pretty big block size so for most typing needs we only need one
 const BLOCK_SIZE: usize = 512;
 
+/// A node of the union-find forest in [TypeSubstitutor]
+///
+/// Variables that were unified with each other form a tree. Only the root of that tree holds the substitution
+struct TypeVariable<MyType> {
+    parent: Cell<usize>,
+    /// Upper bound on the height of the tree below this variable. Only meaningful for roots
+    rank: Cell<u32>,
+    substitution: OnceCell<MyType>,
+}
+
+impl<MyType> TypeVariable<MyType> {
+    fn new_root(idx: usize) -> Self {
+        Self {
+            parent: Cell::new(idx),
+            rank: Cell::new(0),
+            substitution: OnceCell::new(),
+        }
+    }
+}
+
 /// Implements Hindley-Milner type inference
 ///
 /// It actually already does eager inference where possible (through [Self::unify])
 ///
 /// When eager inference is not possible, [DelayedConstraintsList] should be used
+///
+/// Unifying two variables merges them in a union-find forest with path compression and union by rank,
+/// so chains of variables never have to be walked again
 pub struct TypeSubstitutor<MyType: HindleyMilner<VariableIDMarker>, VariableIDMarker: UUIDMarker> {
-    substitution_map: BlockVec<OnceCell<MyType>, BLOCK_SIZE>,
+    variables: BlockVec<TypeVariable<MyType>, BLOCK_SIZE>,
     failed_unifications: RefCell<Vec<FailedUnification<MyType>>>,
     _ph: PhantomData<VariableIDMarker>,
 }
 
-impl<'v, MyType: HindleyMilner<VariableIDMarker> + 'v, VariableIDMarker: UUIDMarker> IntoIterator
-    for &'v TypeSubstitutor<MyType, VariableIDMarker>
+impl<MyType: HindleyMilner<VariableIDMarker>, VariableIDMarker: UUIDMarker>
+    Index<UUID<VariableIDMarker>> for TypeSubstitutor<MyType, VariableIDMarker>
 {
-    type Item = &'v OnceCell<MyType>;
-
-    type IntoIter = BlockVecIter<'v, OnceCell<MyType>, BLOCK_SIZE>;
+    type Output = OnceCell<MyType>;
 
-    fn into_iter(self) -> Self::IntoIter {
-        self.substitution_map.iter()
+    /// The substitution of the whole class of variables this has been unified with
+    fn index(&self, index: UUID<VariableIDMarker>) -> &Self::Output {
+        &self.variables[self.find(index.get_hidden_value())].substitution
     }
 }
 
 impl<MyType: HindleyMilner<VariableIDMarker>, VariableIDMarker: UUIDMarker>
-    Index<UUID<VariableIDMarker>> for TypeSubstitutor<MyType, VariableIDMarker>
+    TypeSubstitutor<MyType, VariableIDMarker>
 {
-    type Output = OnceCell<MyType>;
+    /// Returns the root of the class of `var`, and points everything on the way there directly at it
+    fn find(&self, var: usize) -> usize {
+        let mut root = var;
+        loop {
+            let parent = self.variables[root].parent.get();
+            if parent == root {
+                break;
+            }
+            root = parent;
+        }
+        let mut cur = var;
+        while cur != root {
+            let next = self.variables[cur].parent.replace(root);
+            cur = next;
+        }
+        root
+    }
 
-    fn index(&self, index: UUID<VariableIDMarker>) -> &Self::Output {
-        &self.substitution_map[index.get_hidden_value()]
+    /// Hangs the tree of root `child` below root `parent`
+    fn link(&self, child: usize, parent: usize) {
+        self.variables[child].parent.set(parent);
+        let child_rank = self.variables[child].rank.get();
+        let parent_rank = &self.variables[parent].rank;
+        parent_rank.set(parent_rank.get().max(child_rank + 1));
+    }
+
+    /// Union by rank of two roots that don't have a substitution yet
+    fn union_empty_roots(&self, a: usize, b: usize) {
+        if self.variables[a].rank.get() < self.variables[b].rank.get() {
+            self.link(a, b);
+        } else {
+            self.link(b, a);
+        }
     }
 }
 
@@ -125,7 +176,7 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
 {
     pub fn new() -> Self {
         Self {
-            substitution_map: BlockVec::new(),
+            variables: BlockVec::new(),
             failed_unifications: RefCell::new(Vec::new()),
             _ph: PhantomData,
         }
@@ -133,9 +184,9 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
 
     pub fn init(variable_alloc: &UUIDAllocator<VariableIDMarker>) -> Self {
         Self {
-            substitution_map: variable_alloc
+            variables: variable_alloc
                 .into_iter()
-                .map(|_| OnceCell::new())
+                .map(|id| TypeVariable::new_root(id.get_hidden_value()))
                 .collect(),
             failed_unifications: RefCell::new(Vec::new()),
             _ph: PhantomData,
@@ -143,26 +194,28 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
     }
 
     pub fn alloc(&self) -> UUID<VariableIDMarker> {
-        UUID::from_hidden_value(self.substitution_map.alloc(OnceCell::new()))
+        let new_variable = TypeVariable::new_root(self.variables.len());
+        UUID::from_hidden_value(self.variables.alloc(new_variable))
     }
 
     pub fn id_range(&self) -> UUIDRange<VariableIDMarker> {
-        UUIDRange::new_with_length(self.substitution_map.len())
+        UUIDRange::new_with_length(self.variables.len())
     }
 
     fn does_typ_reference_var_recurse_with_substitution(
         &self,
         does_this: &MyType,
-        reference_this: UUID<VariableIDMarker>,
+        reference_this_root: usize,
     ) -> bool {
         let mut does_it_reference_it = false;
         does_this.for_each_unknown(&mut |v: UUID<VariableIDMarker>| {
-            if v == reference_this {
+            let v_root = self.find(v.get_hidden_value());
+            if v_root == reference_this_root {
                 does_it_reference_it = true;
-            } else if let Some(found_substitution) = self[v].get() {
+            } else if let Some(found_substitution) = self.variables[v_root].substitution.get() {
                 does_it_reference_it |= self.does_typ_reference_var_recurse_with_substitution(
                     found_substitution,
-                    reference_this,
+                    reference_this_root,
                 );
             }
         });
@@ -171,27 +224,42 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
 
     fn try_fill_empty_var<'s>(
         &'s self,
-        empty_var: UUID<VariableIDMarker>,
+        empty_var_root: usize,
         mut replace_with: &'s MyType,
     ) -> UnifyResult {
-        assert!(self[empty_var].get().is_none());
+        assert!(self.variables[empty_var_root].substitution.get().is_none());
 
         // 1-deep Unknowns should be dug out, becuase they don't create infinite types
         while let HindleyMilnerInfo::TypeVar(unknown_synonym) = replace_with.get_hm_info() {
-            if let Some(found_subst) = self[unknown_synonym].get() {
+            let synonym_root = self.find(unknown_synonym.get_hidden_value());
+            if let Some(found_subst) = self.variables[synonym_root].substitution.get() {
                 replace_with = found_subst;
-            } else if unknown_synonym == empty_var {
-                return UnifyResult::Success;
             } else {
-                assert!(self[empty_var].set(replace_with.clone()).is_ok());
+                if synonym_root != empty_var_root {
+                    self.union_empty_roots(empty_var_root, synonym_root);
+                }
                 return UnifyResult::Success;
             }
         }
 
-        if self.does_typ_reference_var_recurse_with_substitution(replace_with, empty_var) {
+        if self.does_typ_reference_var_recurse_with_substitution(replace_with, empty_var_root) {
             UnifyResult::NoInfiniteTypes
         } else {
-            assert!(self[empty_var].set(replace_with.clone()).is_ok());
+            assert!(self.variables[empty_var_root]
+                .substitution
+                .set(replace_with.clone())
+                .is_ok());
+            UnifyResult::Success
+        }
+    }
+
+    /// Merges the class of the empty root `empty_root` into that of `substituted_root`
+    fn join_empty_to_substituted(&self, empty_root: usize, substituted_root: usize) -> UnifyResult {
+        let substitution = self.variables[substituted_root].substitution.get().unwrap();
+        if self.does_typ_reference_var_recurse_with_substitution(substitution, empty_root) {
+            UnifyResult::NoInfiniteTypes
+        } else {
+            self.link(empty_root, substituted_root);
             UnifyResult::Success
         }
     }
@@ -200,21 +268,27 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
     /// Unification is loosely based on this video: https://www.youtube.com/watch?v=KNbRLTLniZI
     ///
     /// The main change is that I don't keep a substitution list,
-    /// but immediately apply substitutions to [Self::substitution_map]
+    /// but immediately apply substitutions to [Self::variables]
     #[must_use]
     fn unify(&self, a: &MyType, b: &MyType) -> UnifyResult {
+        crate::profiling::count_unification();
         let result = match (a.get_hm_info(), b.get_hm_info(), a, b) {
             (HindleyMilnerInfo::TypeVar(a_var), HindleyMilnerInfo::TypeVar(b_var), _, _) => {
-                if a_var == b_var {
-                    UnifyResult::Success // Same var, all ok
+                let a_root = self.find(a_var.get_hidden_value());
+                let b_root = self.find(b_var.get_hidden_value());
+                if a_root == b_root {
+                    UnifyResult::Success // Same class, all ok
                 } else {
-                    match (self[a_var].get(), self[b_var].get()) {
+                    match (
+                        self.variables[a_root].substitution.get(),
+                        self.variables[b_root].substitution.get(),
+                    ) {
                         (None, None) => {
-                            assert!(self[a_var].set(b.clone()).is_ok());
+                            self.union_empty_roots(a_root, b_root);
                             UnifyResult::Success
                         }
-                        (None, Some(subs_b)) => self.try_fill_empty_var(a_var, subs_b),
-                        (Some(subs_a), None) => self.try_fill_empty_var(b_var, subs_a),
+                        (None, Some(_)) => self.join_empty_to_substituted(a_root, b_root),
+                        (Some(_), None) => self.join_empty_to_substituted(b_root, a_root),
                         (Some(subs_a), Some(subs_b)) => self.unify(subs_a, subs_b),
                     }
                 }
@@ -228,10 +302,11 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
             }
             (HindleyMilnerInfo::TypeFunc(_), HindleyMilnerInfo::TypeVar(v), tf, _)
             | (HindleyMilnerInfo::TypeVar(v), HindleyMilnerInfo::TypeFunc(_), _, tf) => {
-                if let Some(subs) = self[v].get() {
+                let v_root = self.find(v.get_hidden_value());
+                if let Some(subs) = self.variables[v_root].substitution.get() {
                     self.unify(subs, tf)
                 } else {
-                    self.try_fill_empty_var(v, tf)
+                    self.try_fill_empty_var(v_root, tf)
                 }
             }
         };
@@ -242,6 +317,7 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
 
         result
     }
+
     pub fn unify_must_succeed(&self, a: &MyType, b: &MyType) {
         assert!(
             self.unify(a, b) == UnifyResult::Success,
@@ -276,12 +352,19 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
         self.failed_unifications.replace(Vec::new())
     }
 
-    pub fn iter(&self) -> BlockVecIter<'_, OnceCell<MyType>, BLOCK_SIZE> {
-        self.into_iter()
+    /// One substitution per class of unified variables
+    pub fn iter(&self) -> impl Iterator<Item = &OnceCell<MyType>> + '_ {
+        self.variables
+            .iter()
+            .enumerate()
+            .filter(|(idx, var)| var.parent.get() == *idx)
+            .map(|(_, var)| &var.substitution)
     }
 
     /// Used for sanity-checking. The graph of Unknown nodes must be non-cyclical, such that we don't create infinite types
     ///
+    /// The nodes are the roots of the classes of unified variables, as only those hold substitutions
+    ///
     /// Implements https://en.wikipedia.org/wiki/Tarjan%27s_strongly_connected_components_algorithm
     pub fn check_no_unknown_loop(&self) {
         #[derive(Clone, Copy)]
@@ -305,13 +388,17 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
 
             let mut is_infinite_loop = false;
 
-            if let Some(substitutes_to) = slf[unknown_id].get() {
+            if let Some(substitutes_to) = slf.variables[unknown_id.get_hidden_value()]
+                .substitution
+                .get()
+            {
                 if node_in_path[unknown_id].is_part_of_stack {
                     is_infinite_loop = true;
                 } else {
                     node_in_path[unknown_id].is_part_of_stack = true;
                     substitutes_to.for_each_unknown(&mut |id| {
-                        if !is_infinite_loop && is_node_infinite_loop(slf, node_in_path, id) {
+                        let root = UUID::from_hidden_value(slf.find(id.get_hidden_value()));
+                        if !is_infinite_loop && is_node_infinite_loop(slf, node_in_path, root) {
                             is_infinite_loop = true;
                         }
                     });
@@ -327,7 +414,7 @@ impl<MyType: HindleyMilner<VariableIDMarker> + Clone + Debug, VariableIDMarker:
         }
 
         let mut node_in_path: FlatAlloc<NodeInfo, VariableIDMarker> = FlatAlloc::with_size(
-            self.substitution_map.len(),
+            self.variables.len(),
             NodeInfo {
                 is_not_part_of_loop: false,
                 is_part_of_stack: false,
@@ -473,8 +560,7 @@ impl HindleyMilner<TypeVariableIDMarker> for AbstractType {
             AbstractType::Named(_) | AbstractType::Template(_) => true, // Template Name & Name is included in get_hm_info
             AbstractType::Array(arr_typ) => arr_typ.fully_substitute(substitutor),
             AbstractType::Unknown(var) => {
-                let Some(replacement) = substitutor.substitution_map[var.get_hidden_value()].get()
-                else {
+                let Some(replacement) = substitutor[*var].get() else {
                     return false;
                 };
                 assert!(!std::ptr::eq(self, replacement));
@@ -521,7 +607,7 @@ impl HindleyMilner<DomainVariableIDMarker> for DomainType {
         match self {
             DomainType::Generative | DomainType::Physical(_) => true, // Do nothing, These are done already
             DomainType::Unknown(var) => {
-                *self = *substitutor.substitution_map[var.get_hidden_value()].get().expect("It's impossible for domain variables to remain, as any unset domain variable would have been replaced with a new physical domain");
+                *self = *substitutor[*var].get().expect("It's impossible for domain variables to remain, as any unset domain variable would have been replaced with a new physical domain");
                 self.fully_substitute(substitutor)
             }
         }
@@ -591,8 +677,7 @@ impl HindleyMilner<ConcreteTypeVariableIDMarker> for ConcreteType {
                 arr_typ.fully_substitute(substitutor) && arr_sz.fully_substitute(substitutor)
             }
             ConcreteType::Unknown(var) => {
-                let Some(replacement) = substitutor.substitution_map[var.get_hidden_value()].get()
-                else {
+                let Some(replacement) = substitutor[*var].get() else {
                     return false;
                 };
                 *self = replacement.clone();
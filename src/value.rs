@@ -1,4 +1,8 @@
-use std::ops::Deref;
+use std::cmp::Ordering;
+use std::fmt::{Display, Formatter};
+use std::ops::{Add, Deref, Div, Mul, Neg, Rem, Sub};
+use std::str::FromStr;
+use std::sync::Arc;
 
 use num::BigInt;
 
@@ -15,8 +19,9 @@ use crate::typing::{
 #[derive(Debug, Clone, PartialEq, Eq, Hash)]
 pub enum Value {
     Bool(bool),
-    Integer(BigInt),
-    Array(Box<[Value]>),
+    Integer(IntValue),
+    /// Shared copy-on-write. Cloning an array is O(1), and writing to one only copies it if it is shared. See [Arc::make_mut]
+    Array(Arc<Vec<Value>>),
     /// The initial [Value] a variable has, before it's been set. (translates to `'x` don't care)
     Unset,
     Error,
@@ -78,7 +83,7 @@ impl Value {
     }
 
     #[track_caller]
-    pub fn unwrap_integer(&self) -> &BigInt {
+    pub fn unwrap_integer(&self) -> &IntValue {
         let Self::Integer(i) = self else {
             panic!("{:?} is not an integer!", self)
         };
@@ -90,8 +95,7 @@ impl Value {
         let Self::Integer(i) = self else {
             panic!("{:?} is not an integer!", self)
         };
-        use num::ToPrimitive;
-        i.to_usize().expect("Integer too large? Program crash")
+        i.to_primitive().expect("Integer too large? Program crash")
     }
 
     #[track_caller]
@@ -103,6 +107,154 @@ impl Value {
     }
 }
 
+/// A compile-time integer of arbitrary size.
+///
+/// Nearly all of these, like loop counters, array indices and sizes, fit in an [i64], so those are stored inline.
+/// Only once a result doesn't fit, does it move to a heap-allocated [BigInt].
+///
+/// Every number has exactly one representation, which is what makes the derived [PartialEq] and [Hash] correct
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub struct IntValue(IntRepr);
+
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+enum IntRepr {
+    Small(i64),
+    /// Never fits in an [i64]
+    Big(Box<BigInt>),
+}
+
+impl IntValue {
+    pub const ZERO: IntValue = IntValue(IntRepr::Small(0));
+    pub const ONE: IntValue = IntValue(IntRepr::Small(1));
+
+    pub fn is_zero(&self) -> bool {
+        *self == Self::ZERO
+    }
+
+    /// The number of bits needed to represent the magnitude of this number
+    pub fn bits(&self) -> u64 {
+        match &self.0 {
+            IntRepr::Small(v) => (u64::BITS - v.unsigned_abs().leading_zeros()) as u64,
+            IntRepr::Big(v) => v.bits(),
+        }
+    }
+
+    /// For converting to [usize], [i64], etc. None if it doesn't fit
+    pub fn to_primitive<INT: TryFrom<i64> + for<'v> TryFrom<&'v BigInt>>(&self) -> Option<INT> {
+        match &self.0 {
+            IntRepr::Small(v) => INT::try_from(*v).ok(),
+            IntRepr::Big(v) => INT::try_from(v.as_ref()).ok(),
+        }
+    }
+
+    fn to_big(&self) -> BigInt {
+        match &self.0 {
+            IntRepr::Small(v) => BigInt::from(*v),
+            IntRepr::Big(v) => v.as_ref().clone(),
+        }
+    }
+}
+
+impl From<BigInt> for IntValue {
+    fn from(value: BigInt) -> Self {
+        match i64::try_from(&value) {
+            Ok(v) => IntValue(IntRepr::Small(v)),
+            Err(_) => IntValue(IntRepr::Big(Box::new(value))),
+        }
+    }
+}
+
+impl From<i64> for IntValue {
+    fn from(value: i64) -> Self {
+        IntValue(IntRepr::Small(value))
+    }
+}
+
+macro_rules! impl_int_value_from_primitive {
+    ($($int:ty),*) => {$(
+        impl From<$int> for IntValue {
+            fn from(value: $int) -> Self {
+                match i64::try_from(value) {
+                    Ok(v) => IntValue(IntRepr::Small(v)),
+                    Err(_) => IntValue(IntRepr::Big(Box::new(BigInt::from(value)))),
+                }
+            }
+        }
+    )*};
+}
+impl_int_value_from_primitive!(u64, usize);
+
+impl FromStr for IntValue {
+    type Err = num::bigint::ParseBigIntError;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match i64::from_str(s) {
+            Ok(v) => Ok(IntValue(IntRepr::Small(v))),
+            Err(_) => BigInt::from_str(s).map(IntValue::from),
+        }
+    }
+}
+
+impl Display for IntValue {
+    fn fmt(&self, f: &mut Formatter<'_>) -> std::fmt::Result {
+        match &self.0 {
+            IntRepr::Small(v) => v.fmt(f),
+            IntRepr::Big(v) => v.fmt(f),
+        }
+    }
+}
+
+impl PartialOrd for IntValue {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for IntValue {
+    fn cmp(&self, other: &Self) -> Ordering {
+        match (&self.0, &other.0) {
+            (IntRepr::Small(a), IntRepr::Small(b)) => a.cmp(b),
+            _ => self.to_big().cmp(&other.to_big()),
+        }
+    }
+}
+
+/// Implements an operator with the checked [i64] operation, and only falls back to [BigInt] on overflow
+macro_rules! impl_int_value_op {
+    ($op_trait:ident, $op_fn:ident, $checked_fn:ident) => {
+        impl $op_trait<&IntValue> for &IntValue {
+            type Output = IntValue;
+
+            fn $op_fn(self, rhs: &IntValue) -> IntValue {
+                if let (IntRepr::Small(a), IntRepr::Small(b)) = (&self.0, &rhs.0) {
+                    if let Some(result) = a.$checked_fn(*b) {
+                        return IntValue(IntRepr::Small(result));
+                    }
+                }
+                IntValue::from(self.to_big().$op_fn(rhs.to_big()))
+            }
+        }
+    };
+}
+impl_int_value_op!(Add, add, checked_add);
+impl_int_value_op!(Sub, sub, checked_sub);
+impl_int_value_op!(Mul, mul, checked_mul);
+impl_int_value_op!(Div, div, checked_div);
+impl_int_value_op!(Rem, rem, checked_rem);
+
+impl Neg for &IntValue {
+    type Output = IntValue;
+
+    fn neg(self) -> IntValue {
+        if let IntRepr::Small(v) = &self.0 {
+            if let Some(result) = v.checked_neg() {
+                return IntValue(IntRepr::Small(result));
+            }
+        }
+        IntValue::from(-self.to_big())
+    }
+}
+
 pub fn compute_unary_op(op: UnaryOperator, v: &Value) -> Value {
     if *v == Value::Error {
         unreachable!("unary op on Value::Error!")
@@ -174,7 +326,7 @@ impl ConcreteType {
                     let content_typ = arr_typ.get_initial_val();
                     arr.resize(arr_size, content_typ);
                 }
-                Value::Array(arr.into_boxed_slice())
+                Value::Array(Arc::new(arr))
             }
             ConcreteType::Value(_) | ConcreteType::Unknown(_) => unreachable!(),
         }